@@ -0,0 +1,287 @@
+// Scene-scaling benchmark. Runs the headless oculus4 build once per case,
+// sweeping object count, texture count, eye buffer scale, stereo mode,
+// multi-resolution rendering and job threads, and collects the one-line
+// summary every run prints with --bench. --animate keeps the boxes moving,
+// so every frame runs the full scene update.
+//
+// usage: o4bench [--exe path] [--frames n] [--objects 100,1000,...]
+//                [--textures 0,16,...] [--scales 0.5,1.0,...] [--stereo 0,1] [--multires 0,1]
+//                [--threads 1,2,4,...] [--animate]
+//                [--out results.jsonl] [--baseline baseline.jsonl] [--threshold pct]
+//
+// Results are written as JSON lines, one case per line; a results file can
+// be used as the baseline of a later run. With --baseline, a case whose CPU
+// or GPU p50, draw calls or state changes grow by more than threshold
+// percent (default 10) over its baseline entry is a regression, and the
+// exit code is 1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <string>
+#include <vector>
+#include "../oculus4/compat.h"
+
+// the headless build sits next to o4bench (make puts both in build/)
+#ifdef _WIN32
+#define popen _popen
+#define pclose _pclose
+#define BENCH_DEFAULT_EXE "oculus4_headless.exe"
+#else
+#define BENCH_DEFAULT_EXE "oculus4_headless"
+#endif
+
+struct BenchResult
+{
+	int   objects, textures, stereo, multires, threads, animate, frames;
+	float scale;
+	float cpu_p50, cpu_p95, gpu_p50, gpu_p95;
+	float draw_calls, state_changes;
+};
+
+static bool json_number(const char* line, const char* key, float& out)
+{
+	std::string k = std::string("\"") + key + "\":";
+	const char *p = strstr(line, k.c_str());
+	if (!p)
+		return false;
+	out = (float)atof(p + k.size());
+	return true;
+}
+
+static bool parse_result(const char* line, BenchResult& r)
+{
+	float objects, textures, stereo, frames;
+	if (!json_number(line, "objects", objects) || !json_number(line, "textures", textures) ||
+		!json_number(line, "scale", r.scale) || !json_number(line, "stereo", stereo) ||
+		!json_number(line, "frames", frames) ||
+		!json_number(line, "cpu_ms_p50", r.cpu_p50) || !json_number(line, "cpu_ms_p95", r.cpu_p95) ||
+		!json_number(line, "gpu_ms_p50", r.gpu_p50) || !json_number(line, "gpu_ms_p95", r.gpu_p95) ||
+		!json_number(line, "draw_calls", r.draw_calls) || !json_number(line, "state_changes", r.state_changes))
+		return false;
+	r.objects = (int)objects;
+	r.textures = (int)textures;
+	r.stereo = (int)stereo;
+	r.frames = (int)frames;
+	// results from before multi-resolution rendering have no such field
+	float multires = 0;
+	json_number(line, "multires", multires);
+	r.multires = (int)multires;
+	// nor do those from before the job system, they ran on one thread
+	float threads = 1, animate = 0;
+	json_number(line, "threads", threads);
+	json_number(line, "animate", animate);
+	r.threads = (int)threads;
+	r.animate = (int)animate;
+	return true;
+}
+
+static void format_result(const BenchResult& r, char* line, size_t size)
+{
+	snprintf(line, size, "{\"objects\":%d,\"textures\":%d,\"scale\":%.2f,\"stereo\":%d,\"multires\":%d,"
+		"\"threads\":%d,\"animate\":%d,\"frames\":%d,"
+		"\"cpu_ms_p50\":%.4f,\"cpu_ms_p95\":%.4f,\"gpu_ms_p50\":%.4f,\"gpu_ms_p95\":%.4f,"
+		"\"draw_calls\":%.0f,\"state_changes\":%.0f}",
+		r.objects, r.textures, r.scale, r.stereo, r.multires, r.threads, r.animate, r.frames,
+		r.cpu_p50, r.cpu_p95, r.gpu_p50, r.gpu_p95, r.draw_calls, r.state_changes);
+}
+
+static bool same_case(const BenchResult& a, const BenchResult& b)
+{
+	return a.objects == b.objects && a.textures == b.textures && a.stereo == b.stereo && a.multires == b.multires &&
+		a.threads == b.threads && a.animate == b.animate &&
+		(int)(a.scale * 100 + 0.5f) == (int)(b.scale * 100 + 0.5f);
+}
+
+static std::vector<float> parse_list(const char* s)
+{
+	std::vector<float> v;
+	while (*s)
+	{
+		v.push_back((float)atof(s));
+		const char *comma = strchr(s, ',');
+		if (!comma)
+			break;
+		s = comma + 1;
+	}
+	return v;
+}
+
+static bool run_case(const std::string& exe, int frames, const BenchResult& c, BenchResult& out)
+{
+	char cmd[1024];
+	snprintf(cmd, sizeof(cmd), "\"%s\" --bench --mirror off --objects %d --textures %d --scale %.2f --threads %d %s%s%s%d",
+		exe.c_str(), c.objects, c.textures, c.scale, c.threads, c.stereo ? "--stereo " : "", c.multires ? "--multires " : "",
+		c.animate ? "--animate " : "", frames);
+	FILE *pipe = popen(cmd, "r");
+	if (!pipe)
+		return false;
+	char line[4096];
+	bool found = false;
+	while (fgets(line, sizeof(line), pipe))
+	{
+		if (!strncmp(line, "bench ", 6))
+			found = parse_result(line + 6, out);
+	}
+	int status = pclose(pipe);
+	return found && status == 0;
+}
+
+// true if value grew past baseline by more than threshold (a fraction); tiny
+// baselines get an absolute floor so timer noise alone does not trip it
+static bool regressed(float value, float baseline, float threshold, float floor)
+{
+	float limit = baseline * (1.0f + threshold);
+	if (limit < baseline + floor)
+		limit = baseline + floor;
+	return value > limit;
+}
+
+static std::string default_exe(const char* argv0)
+{
+	std::string dir = argv0;
+	size_t slash = dir.find_last_of("/\\");
+	dir = slash == std::string::npos ? "." : dir.substr(0, slash);
+	return dir + "/" + BENCH_DEFAULT_EXE;
+}
+
+int main(int argc, char **argv)
+{
+	std::string exe = default_exe(argv[0]);
+	int frames = 300;
+	std::vector<float> objects = parse_list("100,1000,10000,100000");
+	std::vector<float> textures = parse_list("0,16");
+	std::vector<float> scales = parse_list("0.5,1.0");
+	std::vector<float> stereo = parse_list("0,1");
+	std::vector<float> multires = parse_list("0");
+	std::vector<float> threads = parse_list("0"); // 0: one per hardware thread
+	bool animate = false;
+	const char *out_path = NULL, *baseline_path = NULL;
+	float threshold = 10.0f;
+
+	for (int i = 1; i < argc; ++i)
+	{
+		bool more = i + 1 < argc;
+		if (!strcmp(argv[i], "--exe") && more)
+			exe = argv[++i];
+		else if (!strcmp(argv[i], "--frames") && more)
+			frames = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--objects") && more)
+			objects = parse_list(argv[++i]);
+		else if (!strcmp(argv[i], "--textures") && more)
+			textures = parse_list(argv[++i]);
+		else if (!strcmp(argv[i], "--scales") && more)
+			scales = parse_list(argv[++i]);
+		else if (!strcmp(argv[i], "--stereo") && more)
+			stereo = parse_list(argv[++i]);
+		else if (!strcmp(argv[i], "--multires") && more)
+			multires = parse_list(argv[++i]);
+		else if (!strcmp(argv[i], "--threads") && more)
+			threads = parse_list(argv[++i]);
+		else if (!strcmp(argv[i], "--animate"))
+			animate = true;
+		else if (!strcmp(argv[i], "--out") && more)
+			out_path = argv[++i];
+		else if (!strcmp(argv[i], "--baseline") && more)
+			baseline_path = argv[++i];
+		else if (!strcmp(argv[i], "--threshold") && more)
+			threshold = (float)atof(argv[++i]);
+		else
+		{
+			fprintf(stderr, "o4bench: unknown argument %s\n", argv[i]);
+			return 2;
+		}
+	}
+	if (frames < 20)
+		frames = 20;
+
+	std::vector<BenchResult> baseline;
+	if (baseline_path)
+	{
+		FILE *fp = fopen(baseline_path, "r");
+		if (!fp)
+		{
+			fprintf(stderr, "o4bench: cannot open baseline %s\n", baseline_path);
+			return 2;
+		}
+		char line[4096];
+		BenchResult r;
+		while (fgets(line, sizeof(line), fp))
+		{
+			if (parse_result(line, r))
+				baseline.push_back(r);
+		}
+		fclose(fp);
+	}
+
+	FILE *out = out_path ? fopen(out_path, "w") : NULL;
+	if (out_path && !out)
+	{
+		fprintf(stderr, "o4bench: cannot write %s\n", out_path);
+		return 2;
+	}
+
+	int failures = 0, regressions = 0;
+	for (size_t o = 0; o < objects.size(); ++o)
+	for (size_t t = 0; t < textures.size(); ++t)
+	for (size_t s = 0; s < scales.size(); ++s)
+	for (size_t m = 0; m < stereo.size(); ++m)
+	for (size_t x = 0; x < multires.size(); ++x)
+	for (size_t j = 0; j < threads.size(); ++j)
+	{
+		BenchResult c, r;
+		memset(&c, 0, sizeof(c));
+		c.objects = (int)objects[o];
+		c.textures = (int)textures[t];
+		c.scale = scales[s];
+		c.stereo = stereo[m] != 0;
+		c.multires = multires[x] != 0;
+		c.threads = (int)threads[j];
+		c.animate = animate;
+		if (!run_case(exe, frames, c, r))
+		{
+			fprintf(stderr, "o4bench: run failed: %d objects, %d textures, scale %.2f, stereo %d, multires %d, threads %d\n",
+				c.objects, c.textures, c.scale, c.stereo, c.multires, c.threads);
+			++failures;
+			continue;
+		}
+
+		char line[1024];
+		format_result(r, line, sizeof(line));
+		printf("%s\n", line);
+		if (out)
+			fprintf(out, "%s\n", line);
+
+		for (size_t b = 0; b < baseline.size(); ++b)
+		{
+			const BenchResult& base = baseline[b];
+			if (!same_case(base, r))
+				continue;
+			float th = threshold * 0.01f;
+			const char *what = NULL;
+			if (regressed(r.cpu_p50, base.cpu_p50, th, 0.05f))
+				what = "cpu";
+			else if (regressed(r.gpu_p50, base.gpu_p50, th, 0.05f))
+				what = "gpu";
+			else if (regressed(r.draw_calls, base.draw_calls, th, 0))
+				what = "draw calls";
+			else if (regressed(r.state_changes, base.state_changes, th, 0))
+				what = "state changes";
+			if (what)
+			{
+				fprintf(stderr, "o4bench: REGRESSION (%s) %d objects, %d textures, scale %.2f, stereo %d, multires %d, threads %d: "
+					"cpu %.3f/%.3f ms, gpu %.3f/%.3f ms, draws %.0f/%.0f, state %.0f/%.0f (now/baseline)\n",
+					what, r.objects, r.textures, r.scale, r.stereo, r.multires, r.threads, r.cpu_p50, base.cpu_p50, r.gpu_p50, base.gpu_p50,
+					r.draw_calls, base.draw_calls, r.state_changes, base.state_changes);
+				++regressions;
+			}
+			break;
+		}
+	}
+	if (out)
+		fclose(out);
+
+	if (failures || regressions)
+		fprintf(stderr, "o4bench: %d failed runs, %d regressions over %.0f%%\n", failures, regressions, threshold);
+	return failures || regressions ? 1 : 0;
+}
@@ -0,0 +1,356 @@
+// CPU-side checks of the per-frame scene code, no GL context or headset
+// needed: parallel BVH culling and the per-buffer lists against a serial and
+// a brute-force cull over animated, refitted boxes, the render queue's radix
+// sort, and job_parallel_for coverage. Links cull, animation, job_system,
+// render_queue and pose_math; the GL side of InstanceBuffer and the
+// instancing program are stubbed below.
+//
+// usage: o4check [objects] [threads]
+//
+// Prints the first failure and exits 1.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <algorithm>
+#include <atomic>
+#include <vector>
+#include "../oculus4/cull.h"
+#include "../oculus4/animation.h"
+#include "../oculus4/job_system.h"
+#include "../oculus4/render_queue.h"
+
+InstanceBuffer::InstanceBuffer(const StaticMesh* mesh, int capacity) :
+	mesh(mesh), vao(0), buffer(0), mapped(nullptr), texture(0), capacity(capacity), count(0), copy(0), divisor(1)
+{
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+}
+
+void InstanceBuffer::Update(const InstanceData* instances, int instanceCount)
+{
+	count = instanceCount;
+}
+
+void InstanceBuffer::Draw(DrawState& state)
+{
+}
+
+void instanced_end_draws(DrawState& state)
+{
+}
+
+GLuint instanced_program()
+{
+	return 1;
+}
+
+// frustum_combined_eyes is not checked here, the frusta come from
+// frustum_from_matrix
+extern "C" ovrMatrix4f ovrMatrix4f_Projection(ovrFovPort fov, float znear, float zfar, unsigned int projectionModFlags)
+{
+	ovrMatrix4f m;
+	memset(&m, 0, sizeof(m));
+	return m;
+}
+
+static unsigned int rng = 12345;
+
+static unsigned int next_random()
+{
+	rng = rng * 1664525u + 1013904223u;
+	return rng >> 8;
+}
+
+// 90 degree frustum from (0, 1, 0) along -z, turned by yaw
+static void view_proj(float yaw, float* out)
+{
+	float n = 0.5f, f = 500.0f, c = cosf(yaw), s = sinf(yaw);
+	float view[16] = { c, 0, s, 0, 0, 1, 0, 0, -s, 0, c, 0, 0, -1, 0, 1 };
+	float proj[16] = { 1, 0, 0, 0, 0, 1, 0, 0, 0, 0, -(f + n) / (f - n), -1, 0, 0, -2 * f * n / (f - n), 0 };
+	for (int col = 0; col < 4; ++col)
+		for (int r = 0; r < 4; ++r)
+		{
+			float v = 0;
+			for (int k = 0; k < 4; ++k)
+				v += proj[k * 4 + r] * view[col * 4 + k];
+			out[col * 4 + r] = v;
+		}
+}
+
+static bool outside(const Frustum& frustum, const Aabb& box)
+{
+	for (int p = 0; p < 6; ++p)
+	{
+		const float *pl = frustum.planes[p];
+		float d = pl[3];
+		for (int k = 0; k < 3; ++k)
+			d += pl[k] * (pl[k] >= 0 ? box.max[k] : box.min[k]);
+		if (d < 0)
+			return true;
+	}
+	return false;
+}
+
+// a grid of boxes of different heights, spread over batches buffers
+static void build_boxes(CulledInstances& set, std::vector<InstanceBuffer*>& buffers, int objects, int batches)
+{
+	int side = (int)ceil(sqrt((double)objects));
+	Aabb unit = { { -1, -1, -1 }, { 1, 1, 1 } };
+	for (int b = 0; b < batches; ++b)
+	{
+		buffers.push_back(new InstanceBuffer(nullptr, 1));
+		set.AddBuffer(buffers.back());
+	}
+	for (int i = 0; i < objects; ++i)
+	{
+		float h = 0.25f * (1 + i % 7);
+		InstanceData d;
+		memset(&d, 0, sizeof(d));
+		d.transform[0] = 0.2f;
+		d.transform[5] = h * 0.5f;
+		d.transform[10] = 0.2f;
+		d.transform[12] = i % side - side * 0.5f;
+		d.transform[13] = h * 0.5f;
+		d.transform[14] = i / side - side * 0.5f;
+		d.transform[15] = 1;
+		d.color[0] = d.color[1] = d.color[2] = d.color[3] = 1;
+		set.Add(i % batches, d, unit);
+	}
+	set.Build();
+}
+
+static bool check_cull(int objects)
+{
+	CulledInstances set;
+	std::vector<InstanceBuffer*> buffers;
+	build_boxes(set, buffers, objects, 16);
+	InstanceAnimation anim;
+	Aabb unit = { { -1, -1, -1 }, { 1, 1, 1 } };
+	anim.Init(&set, unit);
+
+	bool ok = true;
+	for (int frame = 0; frame < 50 && ok; ++frame)
+	{
+		anim.Wait();
+		Frustum frustum;
+		float vp[16];
+		view_proj(frame * 0.13f, vp);
+		frustum_from_matrix(vp, frustum);
+
+		std::vector<int> serial, brute;
+		set.bvh.Cull(frustum, serial);
+		for (size_t i = 0; i < set.bounds.size(); ++i)
+			if (!outside(frustum, set.bounds[i]))
+				brute.push_back((int)i);
+		set.Cull(&frustum);
+
+		std::vector<int> got = set.lastVisible;
+		std::sort(got.begin(), got.end());
+		std::sort(serial.begin(), serial.end());
+		size_t listed = 0;
+		for (size_t b = 0; b < set.lists.size(); ++b)
+			listed += set.lists[b].size();
+		if (got != serial)
+		{
+			printf("cull: frame %d, parallel cull kept %d, serial %d\n", frame, (int)got.size(), (int)serial.size());
+			ok = false;
+		}
+		// the refitted tree may keep more than the boxes themselves, never less
+		else if (!std::includes(got.begin(), got.end(), brute.begin(), brute.end()))
+		{
+			printf("cull: frame %d, refitted tree lost visible boxes\n", frame);
+			ok = false;
+		}
+		else if (listed != got.size())
+		{
+			printf("cull: frame %d, %d instances listed for %d visible\n", frame, (int)listed, (int)got.size());
+			ok = false;
+		}
+		else
+		{
+			// every list holds its buffer's visible instances in visible order
+			std::vector<int> pos(set.buffers.size(), 0);
+			for (size_t i = 0; i < set.lastVisible.size() && ok; ++i)
+			{
+				int v = set.lastVisible[i], b = set.owner[v];
+				if (memcmp(&set.lists[b][pos[b]++], &set.instances[v], sizeof(InstanceData)))
+				{
+					printf("cull: frame %d, list %d differs from its instances\n", frame, b);
+					ok = false;
+				}
+			}
+			for (size_t b = 0; b < set.buffers.size() && ok; ++b)
+				if (set.buffers[b]->count != (int)set.lists[b].size())
+				{
+					printf("cull: frame %d, buffer %d got %d of %d instances\n", frame, (int)b, set.buffers[b]->count, (int)set.lists[b].size());
+					ok = false;
+				}
+		}
+		anim.Kick(frame * 0.011);
+	}
+	anim.Wait();
+
+	if (ok && set.Cull(NULL) != objects)
+	{
+		printf("cull: no frustum kept %d of %d\n", (int)set.lastVisible.size(), objects);
+		ok = false;
+	}
+	for (size_t b = 0; b < buffers.size(); ++b)
+		delete buffers[b];
+	return ok;
+}
+
+static bool check_sort()
+{
+	static const int sizes[] = { 0, 1, 2, 7, 300, 5000 };
+	InstanceBuffer buffers[3] = { InstanceBuffer(nullptr, 1), InstanceBuffer(nullptr, 1), InstanceBuffer(nullptr, 1) };
+	for (int s = 0; s < (int)(sizeof(sizes) / sizeof(sizes[0])); ++s)
+		for (int variant = 0; variant < 3; ++variant)
+		{
+			// random keys; then a single program, so the digits all keys
+			// share are skipped; then a single texture too, only depths differ
+			RenderQueue queue;
+			for (int i = 0; i < sizes[s]; ++i)
+			{
+				RenderItem item;
+				GLuint program = variant == 0 ? next_random() % 4 : 1;
+				GLuint texture = variant == 2 ? 7 : next_random() % 1000;
+				float depth = (next_random() % 100000) * 0.01f;
+				item.key = render_key(program, texture, depth);
+				item.buffer = &buffers[i % 3];
+				queue.items.push_back(item);
+			}
+			std::vector<RenderItem> before = queue.items;
+			queue.Sort();
+
+			for (size_t i = 1; i < queue.items.size(); ++i)
+				if (queue.items[i - 1].key > queue.items[i].key)
+				{
+					printf("sort: %d items, variant %d, out of order at %d\n", sizes[s], variant, (int)i);
+					return false;
+				}
+			// a permutation of what went in, keys still with their buffers
+			std::vector<std::pair<uint64_t, InstanceBuffer*> > a, b;
+			for (size_t i = 0; i < before.size(); ++i)
+				a.push_back(std::make_pair(before[i].key, before[i].buffer));
+			for (size_t i = 0; i < queue.items.size(); ++i)
+				b.push_back(std::make_pair(queue.items[i].key, queue.items[i].buffer));
+			std::sort(a.begin(), a.end());
+			std::sort(b.begin(), b.end());
+			if (a != b)
+			{
+				printf("sort: %d items, variant %d, not a permutation of the input\n", sizes[s], variant);
+				return false;
+			}
+		}
+
+	// nearer draws of one program and texture go first
+	if (!(render_key(1, 2, 0.5f) < render_key(1, 2, 3.0f) && render_key(1, 2, 1000.0f) < render_key(1, 3, 0.0f)))
+	{
+		printf("sort: keys do not order by texture, then depth\n");
+		return false;
+	}
+	return true;
+}
+
+struct CoverData
+{
+	std::vector<std::atomic<int> >* hits;
+	int grain;
+	std::atomic<int> oversized;
+};
+
+static void cover(void* data, int begin, int end)
+{
+	CoverData& c = *(CoverData*)data;
+	if (end - begin > c.grain)
+		++c.oversized;
+	for (int i = begin; i < end; ++i)
+		++(*c.hits)[i];
+}
+
+// every index of the outer loop runs a small loop of its own
+static void cover_nested(void* data, int begin, int end)
+{
+	CoverData& c = *(CoverData*)data;
+	for (int i = begin; i < end; ++i)
+	{
+		JobGroup inner;
+		job_parallel_for(inner, 4, 1, cover, data);
+		job_wait(inner);
+		++(*c.hits)[4 + i];
+	}
+}
+
+static bool check_jobs()
+{
+	static const int counts[] = { 0, 1, 63, 1000, 100000 };
+	static const int grains[] = { 1, 7, 256 };
+	for (int n = 0; n < (int)(sizeof(counts) / sizeof(counts[0])); ++n)
+		for (int g = 0; g < (int)(sizeof(grains) / sizeof(grains[0])); ++g)
+		{
+			std::vector<std::atomic<int> > hits(counts[n]);
+			for (int i = 0; i < counts[n]; ++i)
+				hits[i] = 0;
+			CoverData c;
+			c.hits = &hits;
+			c.grain = grains[g];
+			c.oversized = 0;
+			JobGroup group;
+			job_parallel_for(group, counts[n], grains[g], cover, &c);
+			job_wait(group);
+			for (int i = 0; i < counts[n]; ++i)
+				if (hits[i] != 1)
+				{
+					printf("jobs: %d items, grain %d, index %d ran %d times\n", counts[n], grains[g], i, (int)hits[i]);
+					return false;
+				}
+			if (c.oversized)
+			{
+				printf("jobs: %d items, grain %d, %d ranges above the grain\n", counts[n], grains[g], (int)c.oversized);
+				return false;
+			}
+			if (group.pending != 0)
+			{
+				printf("jobs: %d items, grain %d, %d jobs pending after the wait\n", counts[n], grains[g], (int)group.pending);
+				return false;
+			}
+		}
+
+	// jobs that wait for jobs of their own; hits[0..3] count the inner loops
+	const int outer = 200;
+	std::vector<std::atomic<int> > hits(4 + outer);
+	for (int i = 0; i < 4 + outer; ++i)
+		hits[i] = 0;
+	CoverData c;
+	c.hits = &hits;
+	c.grain = 1;
+	c.oversized = 0;
+	JobGroup group;
+	job_parallel_for(group, outer, 3, cover_nested, &c);
+	job_wait(group);
+	for (int i = 0; i < 4 + outer; ++i)
+		if (hits[i] != (i < 4 ? outer : 1))
+		{
+			printf("jobs: nested, index %d ran %d times\n", i, (int)hits[i]);
+			return false;
+		}
+	return true;
+}
+
+int main(int argc, char **argv)
+{
+	int objects = argc > 1 ? atoi(argv[1]) : 20000;
+	int threads = argc > 2 ? atoi(argv[2]) : 4;
+
+	job_system_init(threads);
+	bool ok = check_jobs() && check_sort() && check_cull(objects);
+	if (ok)
+		printf("o4check: passed (%d objects, %d threads)\n", objects, job_system_threads());
+	job_system_shutdown();
+	return ok ? 0 : 1;
+}
@@ -0,0 +1,415 @@
+// Offline converter from Wavefront OBJ (+ MTL) to the binary .o4s scene
+// format the runtime maps at startup (see oculus4/scene_format.h).
+//
+// usage: o4conv input.obj output.o4s [--scale s]
+//
+// Every material of the OBJ becomes one mesh (split further when it passes
+// 65535 vertices) with one instance. Texture paths are stored as written in
+// the MTL file, so keep the .o4s next to the .obj.
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <math.h>
+#include <map>
+#include <string>
+#include <vector>
+#include "../oculus4/scene_format.h"
+
+struct Vertex
+{
+	float pos[3];
+	float normal[3];
+	float uv[2];
+};
+
+// resolved position/uv/normal indices of a face corner, -1 when absent;
+// relative (negative) indices in the file name different vertices depending
+// on where they appear, so the raw "v/t/n" text can't be the key
+struct VertexKey
+{
+	int v, t, n;
+	bool operator<(const VertexKey& o) const
+	{
+		if (v != o.v) return v < o.v;
+		if (t != o.t) return t < o.t;
+		return n < o.n;
+	}
+};
+
+struct MeshData
+{
+	std::vector<Vertex>   vertices;
+	std::vector<uint16_t> indices;
+	std::vector<bool>     needsNormal; // no vn in the file, smoothed from the faces
+	std::map<VertexKey, uint16_t> lookup;
+	uint32_t material;
+};
+
+struct MaterialData
+{
+	std::string name;
+	float       color[4];
+	std::string texture;
+};
+
+static std::vector<float> positions, normals, uvs;
+static std::vector<MaterialData> materials;
+static std::vector<MeshData*> meshes;
+static std::string base_dir;
+
+static int find_material(const std::string& name)
+{
+	for (size_t i = 0; i < materials.size(); ++i)
+		if (materials[i].name == name)
+			return (int)i;
+	MaterialData m;
+	m.name = name;
+	m.color[0] = m.color[1] = m.color[2] = 0.8f;
+	m.color[3] = 1.0f;
+	materials.push_back(m);
+	return (int)materials.size() - 1;
+}
+
+static void load_mtl(const std::string& path)
+{
+	FILE *fp = fopen(path.c_str(), "r");
+	if (!fp)
+	{
+		fprintf(stderr, "o4conv: cannot open material library %s\n", path.c_str());
+		return;
+	}
+	char line[1024], name[1024];
+	int current = -1;
+	while (fgets(line, sizeof(line), fp))
+	{
+		float r, g, b;
+		if (sscanf(line, " newmtl %1023s", name) == 1)
+			current = find_material(name);
+		else if (current >= 0 && sscanf(line, " Kd %f %f %f", &r, &g, &b) == 3)
+		{
+			materials[current].color[0] = r;
+			materials[current].color[1] = g;
+			materials[current].color[2] = b;
+		}
+		else if (current >= 0 && sscanf(line, " d %f", &r) == 1)
+			materials[current].color[3] = r;
+		else if (current >= 0 && sscanf(line, " map_Kd %1023s", name) == 1)
+			materials[current].texture = name;
+	}
+	fclose(fp);
+}
+
+// resolve a 1-based or negative OBJ index, -1 when absent
+static int resolve(const char* s, size_t count)
+{
+	if (!*s)
+		return -1;
+	int i = atoi(s);
+	if (i < 0)
+		i += (int)count;
+	else
+		--i;
+	return i >= 0 && (size_t)i < count ? i : -1;
+}
+
+static MeshData* new_mesh(uint32_t material)
+{
+	MeshData *m = new MeshData;
+	m->material = material;
+	meshes.push_back(m);
+	return m;
+}
+
+static uint16_t add_vertex(MeshData* m, const std::string& corner)
+{
+	char buf[64];
+	strncpy(buf, corner.c_str(), sizeof(buf) - 1);
+	buf[sizeof(buf) - 1] = 0;
+	char *parts[3] = { buf, (char*)"", (char*)"" };
+	char *slash = strchr(buf, '/');
+	if (slash)
+	{
+		*slash = 0;
+		parts[1] = slash + 1;
+		slash = strchr(parts[1], '/');
+		if (slash)
+		{
+			*slash = 0;
+			parts[2] = slash + 1;
+		}
+	}
+	int vi = resolve(parts[0], positions.size() / 3);
+	int ti = resolve(parts[1], uvs.size() / 2);
+	int ni = resolve(parts[2], normals.size() / 3);
+
+	VertexKey key = { vi, ti, ni };
+	std::map<VertexKey, uint16_t>::iterator it = m->lookup.find(key);
+	if (it != m->lookup.end())
+		return it->second;
+
+	Vertex v;
+	memset(&v, 0, sizeof(v));
+	if (vi >= 0)
+		memcpy(v.pos, &positions[vi * 3], sizeof(v.pos));
+	if (ti >= 0)
+		memcpy(v.uv, &uvs[ti * 2], sizeof(v.uv));
+	if (ni >= 0)
+		memcpy(v.normal, &normals[ni * 3], sizeof(v.normal));
+	m->vertices.push_back(v);
+	m->needsNormal.push_back(ni < 0);
+	uint16_t index = (uint16_t)(m->vertices.size() - 1);
+	m->lookup[key] = index;
+	return index;
+}
+
+static void add_face(MeshData*& m, const std::vector<std::string>& corners)
+{
+	// a polygon adds at most corners.size() vertices, start a new mesh before 16 bit indices run out
+	if (m->vertices.size() + corners.size() > SCENE_MAX_MESH_VERTICES)
+		m = new_mesh(m->material);
+
+	std::vector<uint16_t> idx;
+	for (size_t i = 0; i < corners.size(); ++i)
+		idx.push_back(add_vertex(m, corners[i]));
+	for (size_t i = 1; i + 1 < idx.size(); ++i)
+	{
+		uint16_t tri[3] = { idx[0], idx[i], idx[i + 1] };
+		m->indices.insert(m->indices.end(), tri, tri + 3);
+
+		// face normal for corners without one, weighted by area
+		const float *a = m->vertices[tri[0]].pos, *b = m->vertices[tri[1]].pos, *c = m->vertices[tri[2]].pos;
+		float e0[3] = { b[0] - a[0], b[1] - a[1], b[2] - a[2] };
+		float e1[3] = { c[0] - a[0], c[1] - a[1], c[2] - a[2] };
+		float n[3] = { e0[1] * e1[2] - e0[2] * e1[1], e0[2] * e1[0] - e0[0] * e1[2], e0[0] * e1[1] - e0[1] * e1[0] };
+		for (int k = 0; k < 3; ++k)
+		{
+			if (!m->needsNormal[tri[k]])
+				continue;
+			for (int j = 0; j < 3; ++j)
+				m->vertices[tri[k]].normal[j] += n[j];
+		}
+	}
+}
+
+static bool load_obj(const char* path)
+{
+	FILE *fp = fopen(path, "r");
+	if (!fp)
+	{
+		fprintf(stderr, "o4conv: cannot open %s\n", path);
+		return false;
+	}
+	std::map<uint32_t, MeshData*> current_for_material;
+	MeshData *current = nullptr;
+	uint32_t material = (uint32_t)find_material("default");
+	char line[4096], name[1024];
+	while (fgets(line, sizeof(line), fp))
+	{
+		float x, y, z;
+		if (sscanf(line, " v %f %f %f", &x, &y, &z) == 3)
+		{
+			positions.push_back(x);
+			positions.push_back(y);
+			positions.push_back(z);
+		}
+		else if (sscanf(line, " vn %f %f %f", &x, &y, &z) == 3)
+		{
+			normals.push_back(x);
+			normals.push_back(y);
+			normals.push_back(z);
+		}
+		else if (sscanf(line, " vt %f %f", &x, &y) == 2)
+		{
+			uvs.push_back(x);
+			uvs.push_back(y);
+		}
+		else if (sscanf(line, " mtllib %1023s", name) == 1)
+			load_mtl(base_dir + name);
+		else if (sscanf(line, " usemtl %1023s", name) == 1)
+		{
+			if (current)
+				current_for_material[material] = current;
+			material = (uint32_t)find_material(name);
+			current = current_for_material.count(material) ? current_for_material[material] : nullptr;
+		}
+		else if (line[0] == 'f' && (line[1] == ' ' || line[1] == '\t'))
+		{
+			std::vector<std::string> corners;
+			for (char *tok = strtok(line + 1, " \t\r\n"); tok; tok = strtok(NULL, " \t\r\n"))
+				corners.push_back(tok);
+			if (corners.size() < 3)
+				continue;
+			if (!current)
+				current = new_mesh(material);
+			add_face(current, corners);
+			current_for_material[material] = current;
+		}
+	}
+	fclose(fp);
+	return true;
+}
+
+static void finish_mesh(MeshData* m, SceneMesh& out)
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		out.boundsMin[k] = 1e30f;
+		out.boundsMax[k] = -1e30f;
+	}
+	for (size_t i = 0; i < m->vertices.size(); ++i)
+	{
+		Vertex& v = m->vertices[i];
+		if (m->needsNormal[i])
+		{
+			float len = sqrtf(v.normal[0] * v.normal[0] + v.normal[1] * v.normal[1] + v.normal[2] * v.normal[2]);
+			for (int k = 0; k < 3; ++k)
+				v.normal[k] = len > 0 ? v.normal[k] / len : (k == 1 ? 1.0f : 0.0f);
+		}
+		for (int k = 0; k < 3; ++k)
+		{
+			if (v.pos[k] < out.boundsMin[k]) out.boundsMin[k] = v.pos[k];
+			if (v.pos[k] > out.boundsMax[k]) out.boundsMax[k] = v.pos[k];
+		}
+	}
+	out.vertexCount = (uint32_t)m->vertices.size();
+	out.indexCount = (uint32_t)m->indices.size();
+}
+
+static uint64_t align(uint64_t offset)
+{
+	return (offset + SCENE_ALIGN - 1) & ~(uint64_t)(SCENE_ALIGN - 1);
+}
+
+static void write_at(FILE* fp, uint64_t offset, const void* data, size_t bytes)
+{
+	// sections are written in order, pad up to the aligned start
+	static const char zero[SCENE_ALIGN] = { 0 };
+	long pos = ftell(fp);
+	if ((uint64_t)pos < offset)
+		fwrite(zero, 1, (size_t)(offset - pos), fp);
+	if (bytes)
+		fwrite(data, 1, bytes, fp);
+}
+
+static bool write_scene(const char* path, float scale)
+{
+	std::vector<SceneMesh> out_meshes;
+	std::vector<SceneInstance> instances;
+	uint64_t vertex_bytes = 0, index_bytes = 0;
+	for (size_t i = 0; i < meshes.size(); ++i)
+	{
+		SceneMesh sm;
+		memset(&sm, 0, sizeof(sm));
+		finish_mesh(meshes[i], sm);
+		sm.vertexOffset = vertex_bytes;
+		sm.indexOffset = index_bytes;
+		vertex_bytes = align(vertex_bytes + sm.vertexCount * (uint64_t)SCENE_VERTEX_SIZE);
+		index_bytes = align(index_bytes + sm.indexCount * (uint64_t)sizeof(uint16_t));
+		out_meshes.push_back(sm);
+
+		SceneInstance inst;
+		memset(&inst, 0, sizeof(inst));
+		inst.transform[0] = inst.transform[5] = inst.transform[10] = scale;
+		inst.transform[15] = 1.0f;
+		inst.mesh = (uint32_t)i;
+		inst.material = meshes[i]->material;
+		instances.push_back(inst);
+	}
+
+	std::vector<SceneMaterial> out_materials;
+	std::vector<SceneTexture> textures;
+	for (size_t i = 0; i < materials.size(); ++i)
+	{
+		SceneMaterial mat;
+		memset(&mat, 0, sizeof(mat));
+		memcpy(mat.color, materials[i].color, sizeof(mat.color));
+		mat.texture = -1;
+		if (!materials[i].texture.empty())
+		{
+			SceneTexture tex;
+			memset(&tex, 0, sizeof(tex));
+			if (materials[i].texture.size() >= sizeof(tex.path))
+				fprintf(stderr, "o4conv: texture path %s is too long, dropped\n", materials[i].texture.c_str());
+			else
+			{
+				strcpy(tex.path, materials[i].texture.c_str());
+				mat.texture = (int32_t)textures.size();
+				textures.push_back(tex);
+			}
+		}
+		out_materials.push_back(mat);
+	}
+
+	SceneFileHeader h;
+	memset(&h, 0, sizeof(h));
+	h.magic = SCENE_MAGIC;
+	h.version = SCENE_VERSION;
+	h.meshCount = (uint32_t)out_meshes.size();
+	h.materialCount = (uint32_t)out_materials.size();
+	h.textureCount = (uint32_t)textures.size();
+	h.instanceCount = (uint32_t)instances.size();
+	h.meshOffset = align(sizeof(h));
+	h.materialOffset = align(h.meshOffset + h.meshCount * sizeof(SceneMesh));
+	h.textureOffset = align(h.materialOffset + h.materialCount * sizeof(SceneMaterial));
+	h.instanceOffset = align(h.textureOffset + h.textureCount * sizeof(SceneTexture));
+	h.vertexOffset = align(h.instanceOffset + h.instanceCount * sizeof(SceneInstance));
+	h.vertexBytes = vertex_bytes;
+	h.indexOffset = align(h.vertexOffset + vertex_bytes);
+	h.indexBytes = index_bytes;
+
+	FILE *fp = fopen(path, "wb");
+	if (!fp)
+	{
+		fprintf(stderr, "o4conv: cannot write %s\n", path);
+		return false;
+	}
+	write_at(fp, 0, &h, sizeof(h));
+	write_at(fp, h.meshOffset, out_meshes.empty() ? NULL : &out_meshes[0], out_meshes.size() * sizeof(SceneMesh));
+	write_at(fp, h.materialOffset, out_materials.empty() ? NULL : &out_materials[0], out_materials.size() * sizeof(SceneMaterial));
+	write_at(fp, h.textureOffset, textures.empty() ? NULL : &textures[0], textures.size() * sizeof(SceneTexture));
+	write_at(fp, h.instanceOffset, instances.empty() ? NULL : &instances[0], instances.size() * sizeof(SceneInstance));
+	for (size_t i = 0; i < meshes.size(); ++i)
+		write_at(fp, h.vertexOffset + out_meshes[i].vertexOffset, &meshes[i]->vertices[0], meshes[i]->vertices.size() * sizeof(Vertex));
+	for (size_t i = 0; i < meshes.size(); ++i)
+		write_at(fp, h.indexOffset + out_meshes[i].indexOffset, &meshes[i]->indices[0], meshes[i]->indices.size() * sizeof(uint16_t));
+	write_at(fp, h.indexOffset + index_bytes, NULL, 0);
+	bool ok = !ferror(fp);
+	fclose(fp);
+
+	printf("%s: %d meshes, %d materials, %d textures, %.1f KB vertices, %.1f KB indices\n", path,
+		(int)h.meshCount, (int)h.materialCount, (int)h.textureCount, vertex_bytes / 1024.0, index_bytes / 1024.0);
+	return ok;
+}
+
+int main(int argc, char **argv)
+{
+	if (argc < 3)
+	{
+		fprintf(stderr, "usage: o4conv input.obj output.o4s [--scale s]\n");
+		return EXIT_FAILURE;
+	}
+	float scale = 1.0f;
+	for (int i = 3; i < argc; ++i)
+		if (!strcmp(argv[i], "--scale") && i + 1 < argc)
+			scale = (float)atof(argv[++i]);
+
+	const char *ext = strrchr(argv[1], '.');
+	if (ext && (!strcmp(ext, ".gltf") || !strcmp(ext, ".glb")))
+	{
+		fprintf(stderr, "o4conv: glTF input is not supported, export the scene as OBJ\n");
+		return EXIT_FAILURE;
+	}
+
+	base_dir = argv[1];
+	size_t slash = base_dir.find_last_of("/\\");
+	base_dir = slash == std::string::npos ? std::string() : base_dir.substr(0, slash + 1);
+	if (!load_obj(argv[1]))
+		return EXIT_FAILURE;
+	if (meshes.empty())
+	{
+		fprintf(stderr, "o4conv: %s has no faces\n", argv[1]);
+		return EXIT_FAILURE;
+	}
+	return write_scene(argv[2], scale) ? 0 : EXIT_FAILURE;
+}
@@ -0,0 +1,103 @@
+#include "animation.h"
+#include <math.h>
+#include "pose_math.h"
+
+#define ANIM_GRAIN 2048  // instances per update job
+#define ANIM_BOB   0.05f // metres up and down
+
+// cheap per-instance variation, the same on every run
+static float hash01(unsigned int i)
+{
+	i = (i ^ 61) ^ (i >> 16);
+	i *= 9;
+	i ^= i >> 4;
+	i *= 0x27d4eb2d;
+	i ^= i >> 15;
+	return (i & 0xffff) / 65535.0f;
+}
+
+void InstanceAnimation::Init(CulledInstances* target, const Aabb& localBounds)
+{
+	set = target;
+	local = localBounds;
+	size_t n = set->instances.size();
+	qx.assign(n, 0.0f);
+	qy.assign(n, 0.0f);
+	qz.assign(n, 0.0f);
+	qw.assign(n, 1.0f);
+	px.resize(n);
+	py.resize(n);
+	pz.resize(n);
+	baseY.resize(n);
+	spin.resize(n);
+	phase.resize(n);
+	scale.resize(n);
+	for (size_t i = 0; i < n; ++i)
+	{
+		const float *m = set->instances[i].transform;
+		scale[i].x = sqrtf(m[0] * m[0] + m[1] * m[1] + m[2] * m[2]);
+		scale[i].y = sqrtf(m[4] * m[4] + m[5] * m[5] + m[6] * m[6]);
+		scale[i].z = sqrtf(m[8] * m[8] + m[9] * m[9] + m[10] * m[10]);
+		px[i] = m[12];
+		py[i] = baseY[i] = m[13];
+		pz[i] = m[14];
+		// in turns: a twentieth to a quarter of a turn a second, either way
+		float rate = 0.05f + 0.2f * hash01((unsigned int)i * 2);
+		spin[i] = i & 1 ? rate : -rate;
+		phase[i] = hash01((unsigned int)i * 2 + 1);
+	}
+}
+
+static void update_range(void* data, int begin, int end)
+{
+	InstanceAnimation& anim = *(InstanceAnimation*)data;
+	CulledInstances& set = *anim.set;
+	for (int i = begin; i < end; ++i)
+	{
+		double turns = anim.phase[i] + anim.spin[i] * anim.time;
+		float angle = (float)(6.283185307 * (turns - floor(turns)));
+		float s = sinf(0.5f * angle), c = cosf(0.5f * angle);
+		anim.qy[i] = s;
+		anim.qw[i] = c;
+		// sin(2 angle) from the half angle: 4 s c (c^2 - s^2)
+		anim.py[i] = anim.baseY[i] + ANIM_BOB * 4.0f * s * c * (c * c - s * s);
+	}
+	PoseSoA poses = {
+		&anim.qx[begin], &anim.qy[begin], &anim.qz[begin], &anim.qw[begin],
+		&anim.px[begin], &anim.py[begin], &anim.pz[begin]
+	};
+	pose_model_matrices_soa(poses, &anim.scale[begin], end - begin, set.instances[begin].transform,
+		sizeof(InstanceData) / sizeof(float));
+	for (int i = begin; i < end; ++i)
+		aabb_transform(anim.local, set.instances[i].transform, set.bounds[i]);
+}
+
+// runs as a job of its own: the ranges in parallel, then the refit
+static void update_main(void* data, int, int)
+{
+	InstanceAnimation& anim = *(InstanceAnimation*)data;
+	JobGroup ranges;
+	job_parallel_for(ranges, (int)anim.qx.size(), ANIM_GRAIN, update_range, &anim);
+	job_wait(ranges);
+	if (!anim.set->bounds.empty())
+		anim.set->bvh.Refit(&anim.set->bounds[0]);
+}
+
+void InstanceAnimation::Kick(double t)
+{
+	if (!set || qx.empty())
+		return;
+	Wait();
+	time = t;
+	running = true;
+	job_run(group, update_main, this, 0, 1);
+}
+
+void InstanceAnimation::Wait()
+{
+	if (!running)
+		return;
+	job_wait(group);
+	running = false;
+	set->uploaded = false;
+}
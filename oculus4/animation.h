@@ -0,0 +1,37 @@
+#pragma once
+
+#include <vector>
+#include <OVR_CAPI.h>
+#include "cull.h"
+#include "job_system.h"
+
+// Keeps every instance of a CulledInstances set moving: a spin about its
+// own vertical axis and a small bob, at a rate and phase of its own. The
+// poses are kept as structure of arrays; an update animates a range of
+// them, composes the model matrices straight into the set's instances
+// (pose_model_matrices_soa at the InstanceData stride) and recomputes their
+// world bounds, one job per range, then refits the set's tree.
+//
+// Kick() starts the update for a later display time and returns. It runs on
+// the job threads while the current frame is drawn, which no longer reads
+// the set once its lists are uploaded; Wait() finishes it before the set is
+// culled again and has every list uploaded anew.
+struct InstanceAnimation
+{
+	CulledInstances*         set; // not owned
+	Aabb                     local;
+	std::vector<float>       qx, qy, qz, qw, px, py, pz;
+	std::vector<float>       baseY, spin, phase;
+	std::vector<ovrVector3f> scale;
+	double                   time;
+	JobGroup                 group;
+	bool                     running;
+
+	InstanceAnimation() : set(nullptr), time(0), running(false) {}
+
+	// from the set's transforms as they are (scale and translation only);
+	// localBounds are what every instance was added with
+	void Init(CulledInstances* set, const Aabb& localBounds);
+	void Kick(double time);
+	void Wait();
+};
@@ -0,0 +1,381 @@
+#include "capture.h"
+#include "compat.h"
+#include <stdio.h>
+#include <stdlib.h>
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#define CAPTURE_SLOTS 4 // frames whose readback can be in flight at once
+
+enum SlotState
+{
+	SLOT_FREE,
+	SLOT_READING, // reads queued and fenced
+	SLOT_MAPPED,  // with the worker
+	SLOT_DONE     // worker finished, unmapped on the GL thread
+};
+
+struct CaptureSlot
+{
+	long long            frame;
+	GLsync               fence;
+	GLuint               pbo[CAPTURE_SOURCE_COUNT];
+	GLsizeiptr           size[CAPTURE_SOURCE_COUNT];
+	int                  width[CAPTURE_SOURCE_COUNT], height[CAPTURE_SOURCE_COUNT]; // 0 when not read
+	const unsigned char *pixels[CAPTURE_SOURCE_COUNT];
+	std::atomic<int>     state;
+};
+
+static const char *source_names[CAPTURE_SOURCE_COUNT] = { "left", "right", "stereo", "mirror" };
+
+static bool enabled;
+static CaptureConfig config;
+static CaptureSink sink;
+static void *sink_user;
+static CaptureSlot slots[CAPTURE_SLOTS];
+static int next_slot;  // the next slot to fill, also the oldest one in flight
+static int frame_slot; // slot of the frame being rendered, -1 when it is not captured
+static long long frame, captured, dropped;
+
+static std::thread worker;
+static std::mutex queue_lock;
+static std::condition_variable queue_cv;
+static std::deque<int> queue;
+static bool worker_quit;
+
+const char* capture_source_name(CaptureSource source)
+{
+	return source_names[source];
+}
+
+static void worker_main()
+{
+	for (;;)
+	{
+		int i;
+		{
+			std::unique_lock<std::mutex> lock(queue_lock);
+			while (queue.empty() && !worker_quit)
+				queue_cv.wait(lock);
+			if (queue.empty())
+				break;
+			i = queue.front();
+			queue.pop_front();
+		}
+		CaptureSlot& s = slots[i];
+		for (int src = 0; src < CAPTURE_SOURCE_COUNT; ++src)
+		{
+			if (!s.pixels[src])
+				continue;
+			CaptureImage image = { s.frame, (CaptureSource)src, s.width[src], s.height[src], s.pixels[src] };
+			sink(image, sink_user);
+		}
+		s.state = SLOT_DONE;
+	}
+}
+
+static void map_slot(CaptureSlot& s)
+{
+	for (int src = 0; src < CAPTURE_SOURCE_COUNT; ++src)
+	{
+		if (!s.width[src])
+			continue;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo[src]);
+		s.pixels[src] = (const unsigned char*)glMapBufferRange(GL_PIXEL_PACK_BUFFER, 0,
+			(GLsizeiptr)s.width[src] * s.height[src] * 4, GL_MAP_READ_BIT);
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+static void unmap_slot(CaptureSlot& s)
+{
+	for (int src = 0; src < CAPTURE_SOURCE_COUNT; ++src)
+	{
+		if (!s.pixels[src])
+			continue;
+		glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo[src]);
+		glUnmapBuffer(GL_PIXEL_PACK_BUFFER);
+		s.pixels[src] = NULL;
+	}
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+}
+
+// Oldest first: recycle slots the worker is done with and pass on the ones
+// whose readback finished. Stops at the first unfinished one so the sink
+// sees frames in order. wait blocks on the fences, for shutdown.
+static void collect(bool wait)
+{
+	for (int n = 0; n < CAPTURE_SLOTS; ++n)
+	{
+		int i = (next_slot + n) % CAPTURE_SLOTS;
+		CaptureSlot& s = slots[i];
+		int state = s.state.load();
+		if (state == SLOT_DONE)
+		{
+			unmap_slot(s);
+			s.state = SLOT_FREE;
+		}
+		else if (state == SLOT_READING)
+		{
+			GLenum r = glClientWaitSync(s.fence, wait ? GL_SYNC_FLUSH_COMMANDS_BIT : 0, wait ? 1000000000 : 0);
+			if (r != GL_ALREADY_SIGNALED && r != GL_CONDITION_SATISFIED)
+				break;
+			glDeleteSync(s.fence);
+			s.fence = 0;
+			map_slot(s);
+			s.state = SLOT_MAPPED;
+			{
+				std::lock_guard<std::mutex> lock(queue_lock);
+				queue.push_back(i);
+			}
+			queue_cv.notify_one();
+		}
+	}
+}
+
+// decides whether the frame about to be rendered is captured
+static void select_frame()
+{
+	frame_slot = -1;
+	if (frame < config.first || (frame - config.first) % config.interval)
+		return;
+	if (config.count > 0 && captured >= config.count)
+		return;
+	CaptureSlot& s = slots[next_slot];
+	if (s.state != SLOT_FREE)
+	{
+		// every slot still in flight, rather skip the frame than wait
+		++dropped;
+		return;
+	}
+	frame_slot = next_slot;
+	s.frame = frame;
+	for (int src = 0; src < CAPTURE_SOURCE_COUNT; ++src)
+		s.width[src] = s.height[src] = 0;
+}
+
+void capture_init(const CaptureConfig& cfg, CaptureSink captureSink, void* user)
+{
+	config = cfg;
+	if (config.interval < 1)
+		config.interval = 1;
+	sink = captureSink;
+	sink_user = user;
+	for (int i = 0; i < CAPTURE_SLOTS; ++i)
+	{
+		CaptureSlot& s = slots[i];
+		glGenBuffers(CAPTURE_SOURCE_COUNT, s.pbo);
+		for (int src = 0; src < CAPTURE_SOURCE_COUNT; ++src)
+		{
+			s.size[src] = 0;
+			s.width[src] = s.height[src] = 0;
+			s.pixels[src] = NULL;
+		}
+		s.fence = 0;
+		s.state = SLOT_FREE;
+	}
+	next_slot = 0;
+	frame = captured = dropped = 0;
+	worker_quit = false;
+	worker = std::thread(worker_main);
+	enabled = true;
+	select_frame();
+}
+
+void capture_shutdown()
+{
+	if (!enabled)
+		return;
+	collect(true);
+	{
+		std::lock_guard<std::mutex> lock(queue_lock);
+		worker_quit = true;
+	}
+	queue_cv.notify_one();
+	worker.join();
+	collect(false);
+
+	for (int i = 0; i < CAPTURE_SLOTS; ++i)
+	{
+		CaptureSlot& s = slots[i];
+		if (s.fence)
+			glDeleteSync(s.fence);
+		s.fence = 0;
+		glDeleteBuffers(CAPTURE_SOURCE_COUNT, s.pbo);
+	}
+	enabled = false;
+	printf("capture: %lld frames, %lld dropped\n", captured, dropped);
+}
+
+bool capture_enabled()
+{
+	return enabled;
+}
+
+void capture_read(CaptureSource source, GLuint fbo, int w, int h)
+{
+	if (!enabled || frame_slot < 0 || !(config.sources & (1u << source)) || w <= 0 || h <= 0)
+		return;
+	CaptureSlot& s = slots[frame_slot];
+	GLsizeiptr bytes = (GLsizeiptr)w * h * 4;
+
+	GLint read_fbo;
+	glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &read_fbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, s.pbo[source]);
+	if (s.size[source] < bytes)
+	{
+		glBufferData(GL_PIXEL_PACK_BUFFER, bytes, NULL, GL_STREAM_READ);
+		s.size[source] = bytes;
+	}
+	glReadPixels(0, 0, w, h, GL_RGBA, GL_UNSIGNED_BYTE, 0);
+	glBindBuffer(GL_PIXEL_PACK_BUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, read_fbo);
+	s.width[source] = w;
+	s.height[source] = h;
+}
+
+void capture_end_frame()
+{
+	if (!enabled)
+		return;
+	if (frame_slot >= 0)
+	{
+		CaptureSlot& s = slots[frame_slot];
+		bool read = false;
+		for (int src = 0; src < CAPTURE_SOURCE_COUNT; ++src)
+			read |= s.width[src] > 0;
+		if (read)
+		{
+			s.fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+			s.state = SLOT_READING;
+			next_slot = (next_slot + 1) % CAPTURE_SLOTS;
+			++captured;
+		}
+	}
+	collect(false);
+	++frame;
+	select_frame();
+}
+
+// top row first, RGB
+static void to_rgb(const CaptureImage& image, std::vector<unsigned char>& rgb)
+{
+	rgb.resize((size_t)image.width * image.height * 3);
+	unsigned char *dst = rgb.empty() ? NULL : &rgb[0];
+	bool flip = image.source != CAPTURE_MIRROR;
+	for (int row = 0; row < image.height; ++row)
+	{
+		int y = flip ? image.height - 1 - row : row;
+		const unsigned char *src = image.pixels + (size_t)y * image.width * 4;
+		for (int x = 0; x < image.width; ++x, src += 4)
+		{
+			*dst++ = src[0];
+			*dst++ = src[1];
+			*dst++ = src[2];
+		}
+	}
+}
+
+static void write_ppm(FILE* fp, int w, int h, const std::vector<unsigned char>& rgb)
+{
+	fprintf(fp, "P6\n%d %d\n255\n", w, h);
+	if (!rgb.empty())
+		fwrite(&rgb[0], 1, rgb.size(), fp);
+}
+
+// only what write_ppm() produces: binary, 8 bit, no comments
+static bool read_ppm(const char* path, int& w, int& h, std::vector<unsigned char>& rgb)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+	int maxval;
+	bool ok = fscanf(fp, "P6 %d %d %d", &w, &h, &maxval) == 3 && maxval == 255 && w > 0 && h > 0 && fgetc(fp) != EOF;
+	if (ok)
+	{
+		rgb.resize((size_t)w * h * 3);
+		ok = fread(&rgb[0], 1, rgb.size(), fp) == rgb.size();
+	}
+	fclose(fp);
+	return ok;
+}
+
+void capture_ppm_sink(const CaptureImage& image, void* user)
+{
+	char path[512];
+	snprintf(path, sizeof(path), "%s_%06lld_%s.ppm", (const char*)user, image.frame, source_names[image.source]);
+	FILE *fp = fopen(path, "wb");
+	if (!fp)
+	{
+		fprintf(stderr, "capture: cannot write %s\n", path);
+		return;
+	}
+	std::vector<unsigned char> rgb;
+	to_rgb(image, rgb);
+	write_ppm(fp, image.width, image.height, rgb);
+	fclose(fp);
+}
+
+void capture_stream_sink(const CaptureImage& image, void* user)
+{
+	std::vector<unsigned char> rgb;
+	to_rgb(image, rgb);
+	write_ppm((FILE*)user, image.width, image.height, rgb);
+}
+
+void capture_golden_sink(const CaptureImage& image, void* user)
+{
+	GoldenCompare& golden = *(GoldenCompare*)user;
+	char path[512];
+	snprintf(path, sizeof(path), "%s/%06lld_%s.ppm", golden.dir, image.frame, source_names[image.source]);
+
+	std::vector<unsigned char> rgb, expected;
+	to_rgb(image, rgb);
+	int w, h;
+	if (!read_ppm(path, w, h, expected))
+	{
+		FILE *fp = fopen(path, "wb");
+		if (!fp)
+		{
+			fprintf(stderr, "golden: cannot write %s\n", path);
+			++golden.failed;
+			return;
+		}
+		write_ppm(fp, image.width, image.height, rgb);
+		fclose(fp);
+		++golden.recorded;
+		return;
+	}
+
+	++golden.compared;
+	if (w != image.width || h != image.height)
+	{
+		fprintf(stderr, "golden: %s is %dx%d, the frame %dx%d\n", path, w, h, image.width, image.height);
+		++golden.failed;
+		return;
+	}
+	int bad = 0, worst = 0;
+	for (size_t p = 0; p < rgb.size(); p += 3)
+	{
+		int diff = 0;
+		for (int c = 0; c < 3; ++c)
+		{
+			int d = abs((int)rgb[p + c] - (int)expected[p + c]);
+			if (d > diff)
+				diff = d;
+		}
+		if (diff > golden.tolerance)
+			++bad;
+		if (diff > worst)
+			worst = diff;
+	}
+	if (bad > golden.maxBad)
+	{
+		fprintf(stderr, "golden: %s differs in %d pixels (max %d)\n", path, bad, worst);
+		++golden.failed;
+	}
+}
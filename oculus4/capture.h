@@ -0,0 +1,76 @@
+#pragma once
+
+#include <atomic>
+#include <GL/glew.h>
+
+// Frame capture without stalls. capture_read() only queues a glReadPixels
+// into a pixel pack buffer; capture_end_frame() fences the frame and maps
+// the buffers of earlier frames whose fence has passed, usually two or
+// three frames later, and a worker thread hands the pixels to the sink.
+// When all CAPTURE_SLOTS frames are still in flight a frame is dropped
+// from the capture instead of waiting, so frame pacing is unchanged.
+enum CaptureSource
+{
+	CAPTURE_LEFT,
+	CAPTURE_RIGHT,
+	CAPTURE_STEREO, // the side-by-side target of single-pass stereo
+	CAPTURE_MIRROR,
+	CAPTURE_SOURCE_COUNT
+};
+
+#define CAPTURE_EYES (1 << CAPTURE_LEFT | 1 << CAPTURE_RIGHT | 1 << CAPTURE_STEREO)
+
+struct CaptureImage
+{
+	long long            frame;
+	CaptureSource        source;
+	int                  width, height;
+	const unsigned char *pixels; // RGBA, bottom row first as GL reads it; the mirror
+	                             // texture already holds the top row first
+};
+
+// runs on the capture thread, pixels are only valid during the call
+typedef void (*CaptureSink)(const CaptureImage& image, void* user);
+
+struct CaptureConfig
+{
+	unsigned int sources;  // 1 << CaptureSource bits
+	int          interval; // every interval-th frame
+	int          first;    // frames before this one are not captured
+	int          count;    // frames captured at most, 0 for no limit
+
+	CaptureConfig() : sources(CAPTURE_EYES), interval(1), first(0), count(0) {}
+};
+
+// needs a current GL context
+void capture_init(const CaptureConfig& config, CaptureSink sink, void* user);
+// finishes the readbacks in flight and waits for the sink
+void capture_shutdown();
+bool capture_enabled();
+
+// read w x h of the colour attachment of fbo this frame; a no-op when the
+// frame or the source is not captured. The read framebuffer binding is kept.
+void capture_read(CaptureSource source, GLuint fbo, int w, int h);
+// once per frame on the GL thread, after the last capture_read()
+void capture_end_frame();
+
+const char* capture_source_name(CaptureSource source);
+
+// Sinks. Images go out top row first, without alpha.
+// user: file name prefix, writes <prefix>_<frame>_<source>.ppm
+void capture_ppm_sink(const CaptureImage& image, void* user);
+// user: FILE*, appends binary PPM frames (ffmpeg -f image2pipe -c:v ppm -i file)
+void capture_stream_sink(const CaptureImage& image, void* user);
+
+// user: GoldenCompare*, compares against <dir>/<frame>_<source>.ppm; a
+// missing golden image is written there instead, so the first run records them
+struct GoldenCompare
+{
+	const char       *dir;
+	int               tolerance; // per channel
+	int               maxBad;    // pixels past tolerance before an image fails
+	std::atomic<int>  compared, failed, recorded;
+
+	GoldenCompare() : dir("."), tolerance(2), maxBad(0), compared(0), failed(0), recorded(0) {}
+};
+void capture_golden_sink(const CaptureImage& image, void* user);
@@ -0,0 +1,20 @@
+#pragma once
+
+#include <stdarg.h>
+#include <stdio.h>
+
+// VS2013 (v120) has no snprintf, and its _snprintf leaves a truncated
+// string unterminated.
+#if defined(_MSC_VER) && _MSC_VER < 1900
+inline int o4_snprintf(char* buf, size_t size, const char* format, ...)
+{
+	va_list args;
+	va_start(args, format);
+	int n = _vsnprintf(buf, size, format, args);
+	va_end(args);
+	if (size > 0)
+		buf[size - 1] = 0;
+	return n;
+}
+#define snprintf o4_snprintf
+#endif
@@ -0,0 +1,107 @@
+#include "compositor.h"
+
+#ifndef O4_HEADLESS
+
+struct OvrCompositor : Compositor
+{
+	ovrSession      session;
+	ovrGraphicsLuid luid;
+
+	OvrCompositor() : session(nullptr) {}
+
+	ovrResult Initialize()
+	{
+		ovrResult result = ovr_Initialize(nullptr);
+		if (!OVR_SUCCESS(result))
+			return result;
+
+		//virtual HMD could be enabled through RiftConfigUtil
+		result = ovr_Create(&session, &luid);
+		if (OVR_FAILURE(result))
+			ovr_Shutdown();
+		return result;
+	}
+
+	void Shutdown()
+	{
+		if (session)
+		{
+			ovr_Destroy(session);
+			session = nullptr;
+		}
+		ovr_Shutdown();
+	}
+
+	ovrResult RecreateSession()
+	{
+		if (session)
+		{
+			ovr_Destroy(session);
+			session = nullptr;
+		}
+		return ovr_Create(&session, &luid);
+	}
+
+	ovrHmdDesc GetHmdDesc()
+	{
+		return ovr_GetHmdDesc(session);
+	}
+
+	ovrSizei GetFovTextureSize(ovrEyeType eye, ovrFovPort fov, float pixelsPerDisplayPixel)
+	{
+		return ovr_GetFovTextureSize(session, eye, fov, pixelsPerDisplayPixel);
+	}
+
+	ovrEyeRenderDesc GetRenderDesc(ovrEyeType eye, ovrFovPort fov)
+	{
+		return ovr_GetRenderDesc(session, eye, fov);
+	}
+
+	ovrResult CreateSwapTextureSetGL(GLuint format, int width, int height, ovrSwapTextureSet** outTextureSet)
+	{
+		return ovr_CreateSwapTextureSetGL(session, format, width, height, outTextureSet);
+	}
+
+	void DestroySwapTextureSet(ovrSwapTextureSet* textureSet)
+	{
+		ovr_DestroySwapTextureSet(session, textureSet);
+	}
+
+	ovrResult CreateMirrorTextureGL(GLuint format, int width, int height, ovrTexture** outMirrorTexture)
+	{
+		return ovr_CreateMirrorTextureGL(session, format, width, height, outMirrorTexture);
+	}
+
+	void DestroyMirrorTexture(ovrTexture* mirrorTexture)
+	{
+		ovr_DestroyMirrorTexture(session, mirrorTexture);
+	}
+
+	double GetPredictedDisplayTime(long long frameIndex)
+	{
+		return ovr_GetPredictedDisplayTime(session, frameIndex);
+	}
+
+	ovrTrackingState GetTrackingState(double absTime)
+	{
+		return ovr_GetTrackingState(session, absTime, ovrTrue);
+	}
+
+	ovrResult SubmitFrame(long long frameIndex, const ovrViewScaleDesc* viewScaleDesc,
+		ovrLayerHeader const * const * layerPtrList, unsigned int layerCount)
+	{
+		return ovr_SubmitFrame(session, frameIndex, viewScaleDesc, layerPtrList, layerCount);
+	}
+
+	float GetFloat(const char* propertyName, float defaultVal)
+	{
+		return ovr_GetFloat(session, propertyName, defaultVal);
+	}
+};
+
+Compositor* create_ovr_compositor()
+{
+	return new OvrCompositor();
+}
+
+#endif
@@ -0,0 +1,67 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <OVR_CAPI.h>
+#include <OVR_CAPI_GL.h>
+
+// Everything init() and rendering_loop() need from the libOVR session.
+// OvrCompositor forwards to the real runtime, HeadlessCompositor fakes it
+// on top of plain GL textures so the render path runs without a headset.
+struct Compositor
+{
+	virtual ~Compositor() {}
+
+	// ovr_Initialize + ovr_Create
+	virtual ovrResult Initialize() = 0;
+	// ovr_Destroy + ovr_Shutdown
+	virtual void Shutdown() = 0;
+	// ovr_Destroy + ovr_Create after ovrError_DisplayLost; every swap texture
+	// set and mirror texture of the old session must be destroyed first
+	virtual ovrResult RecreateSession() = 0;
+
+	virtual ovrHmdDesc GetHmdDesc() = 0;
+	virtual ovrSizei GetFovTextureSize(ovrEyeType eye, ovrFovPort fov, float pixelsPerDisplayPixel) = 0;
+	virtual ovrEyeRenderDesc GetRenderDesc(ovrEyeType eye, ovrFovPort fov) = 0;
+
+	virtual ovrResult CreateSwapTextureSetGL(GLuint format, int width, int height, ovrSwapTextureSet** outTextureSet) = 0;
+	virtual void DestroySwapTextureSet(ovrSwapTextureSet* textureSet) = 0;
+	virtual ovrResult CreateMirrorTextureGL(GLuint format, int width, int height, ovrTexture** outMirrorTexture) = 0;
+	virtual void DestroyMirrorTexture(ovrTexture* mirrorTexture) = 0;
+
+	virtual double GetPredictedDisplayTime(long long frameIndex) = 0;
+	virtual ovrTrackingState GetTrackingState(double absTime) = 0;
+	virtual ovrResult SubmitFrame(long long frameIndex, const ovrViewScaleDesc* viewScaleDesc,
+		ovrLayerHeader const * const * layerPtrList, unsigned int layerCount) = 0;
+
+	virtual float GetFloat(const char* propertyName, float defaultVal) = 0;
+
+	// Triangle list in NDC of the eye viewport covering what the lens hides,
+	// returns the vertex count or 0 if the runtime has no such mesh (0.8 does
+	// not) and it should be derived from the FOV.
+	virtual int GetHiddenAreaMesh(ovrEyeType eye, ovrVector2f* vertices, int maxVertices) { return 0; }
+};
+
+struct HeadlessConfig
+{
+	ovrSizei  resolution;       // fake panel size, eye buffers are derived from it
+	float     refreshRate;      // display rate used for predicted display times
+	bool      throttle;         // SubmitFrame blocks until the next fake vsync like the runtime does
+	int       swapChainLength;  // textures per swap texture set
+	long long loseSessionFrame; // SubmitFrame of this frame fails with ovrError_DisplayLost, -1 never
+
+	HeadlessConfig()
+	{
+		resolution.w = 2160;
+		resolution.h = 1200;
+		refreshRate = 90.0f;
+		throttle = false;
+		swapChainLength = 3;
+		loseSessionFrame = -1;
+	}
+};
+
+#ifdef O4_HEADLESS
+Compositor* create_headless_compositor(const HeadlessConfig& config);
+#else
+Compositor* create_ovr_compositor();
+#endif
@@ -0,0 +1,493 @@
+#include "compositor.h"
+#include "compat.h"
+
+#ifdef O4_HEADLESS
+
+#include <stdio.h>
+#include <math.h>
+#include <algorithm>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+// libOVR is not linked in the headless build, so the few utility exports the
+// render path calls directly (clock, eye poses, projection) are provided here.
+
+extern "C" double ovr_GetTimeInSeconds()
+{
+	using namespace std::chrono;
+	return duration_cast<duration<double>>(steady_clock::now().time_since_epoch()).count();
+}
+
+extern "C" void ovr_CalcEyePoses(ovrPosef headPose, const ovrVector3f hmdToEyeViewOffset[2], ovrPosef outEyePoses[2])
+{
+	const ovrQuatf& q = headPose.Orientation;
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		// rotate the offset by the head orientation: v + 2w(u x v) + 2u x (u x v)
+		const ovrVector3f& v = hmdToEyeViewOffset[eye];
+		float tx = 2.0f * (q.y * v.z - q.z * v.y);
+		float ty = 2.0f * (q.z * v.x - q.x * v.z);
+		float tz = 2.0f * (q.x * v.y - q.y * v.x);
+		outEyePoses[eye].Orientation = q;
+		outEyePoses[eye].Position.x = headPose.Position.x + v.x + q.w * tx + (q.y * tz - q.z * ty);
+		outEyePoses[eye].Position.y = headPose.Position.y + v.y + q.w * ty + (q.z * tx - q.x * tz);
+		outEyePoses[eye].Position.z = headPose.Position.z + v.z + q.w * tz + (q.x * ty - q.y * tx);
+	}
+}
+
+extern "C" ovrMatrix4f ovrMatrix4f_Projection(ovrFovPort fov, float znear, float zfar, unsigned int projectionModFlags)
+{
+	bool rightHanded = (projectionModFlags & ovrProjection_RightHanded) != 0;
+	bool clipRangeOpenGL = (projectionModFlags & ovrProjection_ClipRangeOpenGL) != 0;
+	float handednessScale = rightHanded ? -1.0f : 1.0f;
+
+	float projXScale = 2.0f / (fov.LeftTan + fov.RightTan);
+	float projXOffset = (fov.LeftTan - fov.RightTan) * projXScale * 0.5f;
+	float projYScale = 2.0f / (fov.UpTan + fov.DownTan);
+	float projYOffset = (fov.UpTan - fov.DownTan) * projYScale * 0.5f;
+
+	ovrMatrix4f m = {};
+	m.M[0][0] = projXScale;
+	m.M[0][2] = handednessScale * projXOffset;
+	m.M[1][1] = projYScale;
+	m.M[1][2] = -handednessScale * projYOffset;
+	if (clipRangeOpenGL)
+	{
+		m.M[2][2] = -handednessScale * (zfar + znear) / (znear - zfar);
+		m.M[2][3] = 2.0f * zfar * znear / (znear - zfar);
+	}
+	else
+	{
+		m.M[2][2] = -handednessScale * zfar / (znear - zfar);
+		m.M[2][3] = zfar * znear / (znear - zfar);
+	}
+	m.M[3][2] = handednessScale;
+	return m;
+}
+
+struct HeadlessCompositor : Compositor
+{
+	HeadlessConfig config;
+	ovrHmdDesc     desc;
+	double         startTime;
+	GLuint         compositeFBO[2];
+	ovrGLTexture*  mirror;
+	long long      lastIndex;   // newest frame index submitted, 0 before any
+	double         lastDisplay; // and when it is displayed
+	std::vector<ovrSwapTextureSet*> liveSets; // handed out by this session and not destroyed
+
+	HeadlessCompositor(const HeadlessConfig& config) :
+		config(config),
+		desc(),
+		startTime(0),
+		mirror(nullptr),
+		lastIndex(0),
+		lastDisplay(0)
+	{
+		compositeFBO[0] = compositeFBO[1] = 0;
+	}
+
+	ovrResult Initialize()
+	{
+		// CV1-like panel and lenses
+		desc.Type = ovrHmd_CV1;
+		snprintf(desc.ProductName, sizeof(desc.ProductName), "Headless HMD");
+		snprintf(desc.Manufacturer, sizeof(desc.Manufacturer), "oculus4");
+		desc.CameraFrustumHFovInRadians = 1.29f;
+		desc.Resolution = config.resolution;
+		desc.DisplayRefreshRate = config.refreshRate;
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			ovrFovPort fov;
+			fov.UpTan = 1.33f;
+			fov.DownTan = 1.33f;
+			fov.LeftTan = eye == 0 ? 1.06f : 1.09f;
+			fov.RightTan = eye == 0 ? 1.09f : 1.06f;
+			desc.DefaultEyeFov[eye] = desc.MaxEyeFov[eye] = fov;
+		}
+		startTime = ovr_GetTimeInSeconds();
+		return ovrSuccess;
+	}
+
+	void Shutdown()
+	{
+		if (compositeFBO[0])
+		{
+			glDeleteFramebuffers(2, compositeFBO);
+			compositeFBO[0] = compositeFBO[1] = 0;
+		}
+	}
+
+	// Like the runtime, the sets and mirror of the old session go with it:
+	// the ones still alive are freed here, and a layer still pointing at one
+	// is refused by SubmitFrame.
+	ovrResult RecreateSession()
+	{
+		if (!liveSets.empty())
+			fprintf(stderr, "headless: %d swap texture sets outlived their session\n", (int)liveSets.size());
+		while (!liveSets.empty())
+			DestroySwapTextureSet(liveSets.back());
+		if (mirror)
+		{
+			fprintf(stderr, "headless: the mirror texture outlived its session\n");
+			DestroyMirrorTexture(&mirror->Texture);
+		}
+		return ovrSuccess;
+	}
+
+	bool Live(const ovrSwapTextureSet* set) const
+	{
+		return std::find(liveSets.begin(), liveSets.end(), set) != liveSets.end();
+	}
+
+	ovrHmdDesc GetHmdDesc()
+	{
+		return desc;
+	}
+
+	ovrVector2f PixelsPerTanAngle(ovrFovPort fov)
+	{
+		// the lens magnifies the centre, so eye buffers are ~1.3x the panel half
+		ovrVector2f ppt;
+		ppt.x = 1.3f * (config.resolution.w / 2) / (fov.LeftTan + fov.RightTan);
+		ppt.y = 1.3f * config.resolution.h / (fov.UpTan + fov.DownTan);
+		return ppt;
+	}
+
+	ovrSizei GetFovTextureSize(ovrEyeType eye, ovrFovPort fov, float pixelsPerDisplayPixel)
+	{
+		ovrVector2f ppt = PixelsPerTanAngle(fov);
+		ovrSizei size;
+		size.w = (int)ceilf((fov.LeftTan + fov.RightTan) * ppt.x * pixelsPerDisplayPixel);
+		size.h = (int)ceilf((fov.UpTan + fov.DownTan) * ppt.y * pixelsPerDisplayPixel);
+		return size;
+	}
+
+	ovrEyeRenderDesc GetRenderDesc(ovrEyeType eye, ovrFovPort fov)
+	{
+		ovrEyeRenderDesc rd = {};
+		rd.Eye = eye;
+		rd.Fov = fov;
+		rd.DistortedViewport.Pos.x = eye == ovrEye_Left ? 0 : config.resolution.w / 2;
+		rd.DistortedViewport.Size.w = config.resolution.w / 2;
+		rd.DistortedViewport.Size.h = config.resolution.h;
+		rd.PixelsPerTanAngleAtCenter = PixelsPerTanAngle(fov);
+		rd.HmdToEyeViewOffset.x = eye == ovrEye_Left ? 0.032f : -0.032f;
+		return rd;
+	}
+
+	static GLuint CreateTexture(GLuint format, int width, int height)
+	{
+		GLuint texId;
+		glGenTextures(1, &texId);
+		glBindTexture(GL_TEXTURE_2D, texId);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexImage2D(GL_TEXTURE_2D, 0, format, width, height, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+		return texId;
+	}
+
+	ovrResult CreateSwapTextureSetGL(GLuint format, int width, int height, ovrSwapTextureSet** outTextureSet)
+	{
+		ovrGLTexture* textures = new ovrGLTexture[config.swapChainLength];
+		for (int i = 0; i < config.swapChainLength; ++i)
+		{
+			textures[i].OGL.Header.API = ovrRenderAPI_OpenGL;
+			textures[i].OGL.Header.TextureSize.w = width;
+			textures[i].OGL.Header.TextureSize.h = height;
+			textures[i].OGL.TexId = CreateTexture(format, width, height);
+		}
+
+		ovrSwapTextureSet* textureSet = new ovrSwapTextureSet;
+		textureSet->Textures = &textures[0].Texture;
+		textureSet->TextureCount = config.swapChainLength;
+		textureSet->CurrentIndex = 0;
+		liveSets.push_back(textureSet);
+		*outTextureSet = textureSet;
+		return ovrSuccess;
+	}
+
+	void DestroySwapTextureSet(ovrSwapTextureSet* textureSet)
+	{
+		std::vector<ovrSwapTextureSet*>::iterator it = std::find(liveSets.begin(), liveSets.end(), textureSet);
+		if (it == liveSets.end())
+		{
+			fprintf(stderr, "headless: destroying a swap texture set that is not live\n");
+			return;
+		}
+		liveSets.erase(it);
+		ovrGLTexture* textures = reinterpret_cast<ovrGLTexture*>(textureSet->Textures);
+		for (int i = 0; i < textureSet->TextureCount; ++i)
+			glDeleteTextures(1, &textures[i].OGL.TexId);
+		delete[] textures;
+		delete textureSet;
+	}
+
+	ovrResult CreateMirrorTextureGL(GLuint format, int width, int height, ovrTexture** outMirrorTexture)
+	{
+		mirror = new ovrGLTexture;
+		mirror->OGL.Header.API = ovrRenderAPI_OpenGL;
+		mirror->OGL.Header.TextureSize.w = width;
+		mirror->OGL.Header.TextureSize.h = height;
+		mirror->OGL.TexId = CreateTexture(format, width, height);
+		*outMirrorTexture = &mirror->Texture;
+		return ovrSuccess;
+	}
+
+	void DestroyMirrorTexture(ovrTexture* mirrorTexture)
+	{
+		ovrGLTexture* tex = reinterpret_cast<ovrGLTexture*>(mirrorTexture);
+		if (tex == mirror)
+			mirror = nullptr;
+		glDeleteTextures(1, &tex->OGL.TexId);
+		delete tex;
+	}
+
+	double FrameDuration() const
+	{
+		return 1.0 / config.refreshRate;
+	}
+
+	// start of the next vsync interval on the fake display
+	double NextVsync(double now) const
+	{
+		return startTime + ceil((now - startTime) / FrameDuration()) * FrameDuration();
+	}
+
+	double GetPredictedDisplayTime(long long frameIndex)
+	{
+		// a frame started now is submitted for the vsync after next and never
+		// before the frames submitted ahead of it; like the runtime, at most
+		// one frame is queued ahead (unthrottled, the rest would be dropped)
+		// and the time is the middle of its scanout
+		double t = NextVsync(ovr_GetTimeInSeconds()) + 1.5 * FrameDuration();
+		if (frameIndex > lastIndex && lastIndex > 0)
+		{
+			double queued = lastDisplay + (frameIndex - lastIndex) * FrameDuration();
+			if (queued > t + FrameDuration())
+				queued = t + FrameDuration();
+			if (queued > t)
+				t = queued;
+		}
+		return t;
+	}
+
+	ovrTrackingState GetTrackingState(double absTime)
+	{
+		// deterministic head motion: slow look around with a little sway
+		double t = absTime - startTime;
+		float yaw = 0.35f * (float)sin(2.0 * 3.14159265 * 0.2 * t);
+		float pitch = 0.10f * (float)sin(2.0 * 3.14159265 * 0.13 * t);
+		float cy = cosf(yaw * 0.5f), sy = sinf(yaw * 0.5f);
+		float cp = cosf(pitch * 0.5f), sp = sinf(pitch * 0.5f);
+
+		ovrTrackingState ts = {};
+		ovrPosef& pose = ts.HeadPose.ThePose;
+		// yaw about Y followed by pitch about X
+		pose.Orientation.x = cy * sp;
+		pose.Orientation.y = sy * cp;
+		pose.Orientation.z = -sy * sp;
+		pose.Orientation.w = cy * cp;
+		pose.Position.x = 0.05f * (float)sin(2.0 * 3.14159265 * 0.31 * t);
+		pose.Position.y = 0.0f;
+		pose.Position.z = 0.02f * (float)sin(2.0 * 3.14159265 * 0.23 * t);
+		ts.HeadPose.TimeInSeconds = absTime;
+		ts.StatusFlags = ovrStatus_OrientationTracked | ovrStatus_PositionTracked;
+		return ts;
+	}
+
+	// stands in for distortion: copy each eye viewport into one half of the mirror
+	void Composite(const ovrLayerEyeFov* layer)
+	{
+		if (!mirror)
+			return;
+		if (!compositeFBO[0])
+			glGenFramebuffers(2, compositeFBO);
+
+		GLint prevRead, prevDraw;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prevRead);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevDraw);
+
+		GLint mw = mirror->OGL.Header.TextureSize.w;
+		GLint mh = mirror->OGL.Header.TextureSize.h;
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, compositeFBO[1]);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirror->OGL.TexId, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, compositeFBO[0]);
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			ovrSwapTextureSet* set = layer->ColorTexture[eye];
+			if (!set)
+				continue;
+			ovrGLTexture* tex = reinterpret_cast<ovrGLTexture*>(&set->Textures[set->CurrentIndex]);
+			const ovrRecti& vp = layer->Viewport[eye];
+			glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex->OGL.TexId, 0);
+			// the mirror is read back top-down, the eye buffers are bottom-left origin
+			glBlitFramebuffer(vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h,
+				eye * mw / 2, mh, (eye + 1) * mw / 2, 0,
+				GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		}
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, prevRead);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prevDraw);
+	}
+
+	// v rotated by q, or by its inverse
+	static ovrVector3f Rotate(const ovrQuatf& q, const ovrVector3f& v, bool inverse)
+	{
+		float s = inverse ? -1.0f : 1.0f;
+		float qx = s * q.x, qy = s * q.y, qz = s * q.z;
+		float tx = 2.0f * (qy * v.z - qz * v.y);
+		float ty = 2.0f * (qz * v.x - qx * v.z);
+		float tz = 2.0f * (qx * v.y - qy * v.x);
+		ovrVector3f r;
+		r.x = v.x + q.w * tx + (qy * tz - qz * ty);
+		r.y = v.y + q.w * ty + (qz * tx - qx * tz);
+		r.z = v.z + q.w * tz + (qx * ty - qy * tx);
+		return r;
+	}
+
+	// Quads go on top of the eye halves as the screen rectangle around their
+	// projected corners, without rotation or blending; enough for a mirror
+	// preview and captures.
+	void CompositeQuad(const ovrLayerQuad* quad, const ovrLayerEyeFov* eyeLayer)
+	{
+		if (!mirror || !compositeFBO[0] || !quad->ColorTexture)
+			return;
+		GLint prevRead, prevDraw;
+		glGetIntegerv(GL_READ_FRAMEBUFFER_BINDING, &prevRead);
+		glGetIntegerv(GL_DRAW_FRAMEBUFFER_BINDING, &prevDraw);
+
+		GLint mw = mirror->OGL.Header.TextureSize.w;
+		GLint mh = mirror->OGL.Header.TextureSize.h;
+		const ovrSwapTextureSet* set = quad->ColorTexture;
+		const ovrGLTexture* tex = reinterpret_cast<const ovrGLTexture*>(&set->Textures[set->CurrentIndex]);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, compositeFBO[1]);
+		glFramebufferTexture2D(GL_DRAW_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirror->OGL.TexId, 0);
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, compositeFBO[0]);
+		glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex->OGL.TexId, 0);
+
+		bool headLocked = (quad->Header.Flags & ovrLayerFlag_HeadLocked) || !eyeLayer;
+		for (int eye = 0; eye < 2; ++eye)
+		{
+			const ovrFovPort& fov = desc.DefaultEyeFov[eye];
+			float x0 = 1e9f, y0 = 1e9f, x1 = -1e9f, y1 = -1e9f;
+			bool behind = false;
+			for (int c = 0; c < 4; ++c)
+			{
+				ovrVector3f corner;
+				corner.x = (c & 1 ? 0.5f : -0.5f) * quad->QuadSize.x;
+				corner.y = (c & 2 ? 0.5f : -0.5f) * quad->QuadSize.y;
+				corner.z = 0;
+				ovrVector3f p = Rotate(quad->QuadPoseCenter.Orientation, corner, false);
+				p.x += quad->QuadPoseCenter.Position.x;
+				p.y += quad->QuadPoseCenter.Position.y;
+				p.z += quad->QuadPoseCenter.Position.z;
+				if (!headLocked)
+				{
+					const ovrPosef& eyePose = eyeLayer->RenderPose[eye];
+					p.x -= eyePose.Position.x;
+					p.y -= eyePose.Position.y;
+					p.z -= eyePose.Position.z;
+					p = Rotate(eyePose.Orientation, p, true);
+				}
+				if (p.z >= -0.01f)
+				{
+					behind = true;
+					break;
+				}
+				// tangent space to [0,1] across the eye half, y up
+				float u = (p.x / -p.z + fov.LeftTan) / (fov.LeftTan + fov.RightTan);
+				float v = (p.y / -p.z + fov.DownTan) / (fov.UpTan + fov.DownTan);
+				x0 = u < x0 ? u : x0;
+				x1 = u > x1 ? u : x1;
+				y0 = v < y0 ? v : y0;
+				y1 = v > y1 ? v : y1;
+			}
+			if (behind)
+				continue;
+			int half = mw / 2;
+			const ovrRecti& vp = quad->Viewport;
+			// the mirror is top-down
+			glBlitFramebuffer(vp.Pos.x, vp.Pos.y, vp.Pos.x + vp.Size.w, vp.Pos.y + vp.Size.h,
+				eye * half + (int)(x0 * half), (int)((1.0f - y0) * mh), eye * half + (int)(x1 * half), (int)((1.0f - y1) * mh),
+				GL_COLOR_BUFFER_BIT, GL_LINEAR);
+		}
+
+		glBindFramebuffer(GL_READ_FRAMEBUFFER, prevRead);
+		glBindFramebuffer(GL_DRAW_FRAMEBUFFER, prevDraw);
+	}
+
+	ovrResult SubmitFrame(long long frameIndex, const ovrViewScaleDesc* viewScaleDesc,
+		ovrLayerHeader const * const * layerPtrList, unsigned int layerCount)
+	{
+		// a simulated display loss, nothing is shown
+		if (frameIndex == config.loseSessionFrame)
+			return ovrError_DisplayLost;
+
+		// sets of a lost session, or destroyed ones, are an error as with the runtime
+		for (unsigned int i = 0; i < layerCount; ++i)
+		{
+			const ovrLayerHeader* header = layerPtrList[i];
+			bool live = true;
+			if (header && header->Type == ovrLayerType_EyeFov)
+			{
+				const ovrLayerEyeFov* eye = reinterpret_cast<const ovrLayerEyeFov*>(header);
+				live = (!eye->ColorTexture[0] || Live(eye->ColorTexture[0])) && (!eye->ColorTexture[1] || Live(eye->ColorTexture[1]));
+			}
+			else if (header && header->Type == ovrLayerType_Quad)
+			{
+				const ovrLayerQuad* quad = reinterpret_cast<const ovrLayerQuad*>(header);
+				live = !quad->ColorTexture || Live(quad->ColorTexture);
+			}
+			if (!live)
+			{
+				fprintf(stderr, "headless: layer %u of frame %lld uses a swap texture set that is not live\n", i, frameIndex);
+				return ovrError_InvalidParameter;
+			}
+		}
+
+		// in submission order, quads are placed with the poses of the eye layer before them
+		const ovrLayerEyeFov* eyeLayer = nullptr;
+		for (unsigned int i = 0; i < layerCount; ++i)
+		{
+			if (!layerPtrList[i])
+				continue;
+			if (layerPtrList[i]->Type == ovrLayerType_EyeFov)
+			{
+				eyeLayer = reinterpret_cast<const ovrLayerEyeFov*>(layerPtrList[i]);
+				Composite(eyeLayer);
+			}
+			else if (layerPtrList[i]->Type == ovrLayerType_Quad)
+				CompositeQuad(reinterpret_cast<const ovrLayerQuad*>(layerPtrList[i]), eyeLayer);
+		}
+
+		if (frameIndex > 0)
+		{
+			lastDisplay = GetPredictedDisplayTime(frameIndex);
+			lastIndex = frameIndex;
+		}
+
+		if (config.throttle)
+		{
+			// the runtime blocks the app until the compositor has a free slot
+			double wait = NextVsync(ovr_GetTimeInSeconds()) - ovr_GetTimeInSeconds();
+			if (wait > 0)
+				std::this_thread::sleep_for(std::chrono::duration<double>(wait));
+		}
+		return ovrSuccess;
+	}
+
+	float GetFloat(const char* propertyName, float defaultVal)
+	{
+		// no user profile
+		return defaultVal;
+	}
+};
+
+Compositor* create_headless_compositor(const HeadlessConfig& config)
+{
+	return new HeadlessCompositor(config);
+}
+
+#endif
@@ -0,0 +1,399 @@
+#include "cull.h"
+#include <math.h>
+#include <algorithm>
+#include "job_system.h"
+
+#define BVH_LEAF_SIZE 4
+#define CULL_TASKS_PER_THREAD 4
+#define CULL_MIN_TASK 512   // objects, smaller subtrees are not worth a job
+#define CULL_LIST_CHUNK 4096 // visible instances per list building job
+
+void aabb_transform(const Aabb& local, const float* m, Aabb& out)
+{
+	for (int i = 0; i < 3; ++i)
+	{
+		float c = m[12 + i], e = 0;
+		for (int j = 0; j < 3; ++j)
+		{
+			float lc = 0.5f * (local.min[j] + local.max[j]);
+			float le = 0.5f * (local.max[j] - local.min[j]);
+			c += m[j * 4 + i] * lc;
+			e += fabsf(m[j * 4 + i]) * le;
+		}
+		out.min[i] = c - e;
+		out.max[i] = c + e;
+	}
+}
+
+void frustum_from_matrix(const float* m, Frustum& out)
+{
+	for (int p = 0; p < 6; ++p)
+	{
+		int row = p / 2;
+		float sign = p & 1 ? -1.0f : 1.0f;
+		float len = 0;
+		for (int k = 0; k < 4; ++k)
+		{
+			out.planes[p][k] = m[k * 4 + 3] + sign * m[k * 4 + row];
+			if (k < 3)
+				len += out.planes[p][k] * out.planes[p][k];
+		}
+		len = sqrtf(len);
+		for (int k = 0; k < 4; ++k)
+			out.planes[p][k] /= len;
+	}
+}
+
+void frustum_combined_eyes(const ovrFovPort fov[2], const ovrVector3f eyeOffset[2], const float* headView,
+	float zNear, float zFar, float margin, Frustum& out)
+{
+	ovrFovPort both;
+	both.UpTan = (fov[0].UpTan > fov[1].UpTan ? fov[0].UpTan : fov[1].UpTan) * (1.0f + margin);
+	both.DownTan = (fov[0].DownTan > fov[1].DownTan ? fov[0].DownTan : fov[1].DownTan) * (1.0f + margin);
+	both.LeftTan = (fov[0].LeftTan > fov[1].LeftTan ? fov[0].LeftTan : fov[1].LeftTan) * (1.0f + margin);
+	both.RightTan = (fov[0].RightTan > fov[1].RightTan ? fov[0].RightTan : fov[1].RightTan) * (1.0f + margin);
+
+	// the eyes sit half an IPD to either side; back the apex off until the
+	// side planes of the shared frustum clear them
+	float half_ipd = fabsf(eyeOffset[0].x) > fabsf(eyeOffset[1].x) ? fabsf(eyeOffset[0].x) : fabsf(eyeOffset[1].x);
+	float side_tan = both.LeftTan < both.RightTan ? both.LeftTan : both.RightTan;
+	float back = side_tan > 0 ? half_ipd / side_tan : 0;
+
+	// view of the head, moved back
+	float view[16];
+	for (int i = 0; i < 16; ++i)
+		view[i] = headView[i];
+	view[14] -= back;
+
+	ovrMatrix4f proj = ovrMatrix4f_Projection(both, zNear + back, zFar + back, ovrProjection_RightHanded | ovrProjection_ClipRangeOpenGL);
+	float vp[16];
+	for (int c = 0; c < 4; ++c)
+		for (int r = 0; r < 4; ++r)
+			vp[c * 4 + r] = proj.M[r][0] * view[c * 4] + proj.M[r][1] * view[c * 4 + 1] + proj.M[r][2] * view[c * 4 + 2] + proj.M[r][3] * view[c * 4 + 3];
+	frustum_from_matrix(vp, out);
+}
+
+// -1 outside, 0 straddling, 1 inside the planes in mask; straddled planes go to inner_mask
+static int classify(const Frustum& frustum, const Aabb& box, int mask, int& inner_mask)
+{
+	inner_mask = 0;
+	for (int p = 0; p < 6; ++p)
+	{
+		if (!(mask & (1 << p)))
+			continue;
+		const float *pl = frustum.planes[p];
+		// farthest corner along the normal, then the nearest one
+		float far_d = pl[3], near_d = pl[3];
+		for (int k = 0; k < 3; ++k)
+		{
+			far_d += pl[k] * (pl[k] >= 0 ? box.max[k] : box.min[k]);
+			near_d += pl[k] * (pl[k] >= 0 ? box.min[k] : box.max[k]);
+		}
+		if (far_d < 0)
+			return -1;
+		if (near_d < 0)
+			inner_mask |= 1 << p;
+	}
+	return inner_mask ? 0 : 1;
+}
+
+static int build_node(Bvh& bvh, const Aabb* bounds, int first, int count)
+{
+	int index = (int)bvh.nodes.size();
+	bvh.nodes.push_back(Bvh::Node());
+	Bvh::Node node;
+	node.first = first;
+	node.count = count;
+	node.left = node.right = -1;
+
+	Aabb cbox; // box of the centres, decides the split
+	for (int k = 0; k < 3; ++k)
+	{
+		node.box.min[k] = cbox.min[k] = 1e30f;
+		node.box.max[k] = cbox.max[k] = -1e30f;
+	}
+	for (int i = first; i < first + count; ++i)
+	{
+		const Aabb& b = bounds[bvh.items[i]];
+		for (int k = 0; k < 3; ++k)
+		{
+			float c = 0.5f * (b.min[k] + b.max[k]);
+			node.box.min[k] = std::min(node.box.min[k], b.min[k]);
+			node.box.max[k] = std::max(node.box.max[k], b.max[k]);
+			cbox.min[k] = std::min(cbox.min[k], c);
+			cbox.max[k] = std::max(cbox.max[k], c);
+		}
+	}
+
+	if (count > BVH_LEAF_SIZE)
+	{
+		int axis = 0;
+		for (int k = 1; k < 3; ++k)
+			if (cbox.max[k] - cbox.min[k] > cbox.max[axis] - cbox.min[axis])
+				axis = k;
+		int half = count / 2;
+		std::nth_element(bvh.items.begin() + first, bvh.items.begin() + first + half, bvh.items.begin() + first + count,
+			[bounds, axis](int a, int b) { return bounds[a].min[axis] + bounds[a].max[axis] < bounds[b].min[axis] + bounds[b].max[axis]; });
+		node.left = build_node(bvh, bounds, first, half);
+		node.right = build_node(bvh, bounds, first + half, count - half);
+	}
+	bvh.nodes[index] = node;
+	return index;
+}
+
+void Bvh::Build(const Aabb* bounds, int count)
+{
+	nodes.clear();
+	items.resize(count);
+	for (int i = 0; i < count; ++i)
+		items[i] = i;
+	if (count)
+	{
+		nodes.reserve(2 * count / BVH_LEAF_SIZE + 1);
+		build_node(*this, bounds, 0, count);
+	}
+	boxes.resize(count);
+	for (int i = 0; i < count; ++i)
+		boxes[i] = bounds[items[i]];
+}
+
+static void grow(Aabb& box, const Aabb& other)
+{
+	for (int k = 0; k < 3; ++k)
+	{
+		box.min[k] = std::min(box.min[k], other.min[k]);
+		box.max[k] = std::max(box.max[k], other.max[k]);
+	}
+}
+
+void Bvh::Refit(const Aabb* bounds)
+{
+	for (size_t i = 0; i < items.size(); ++i)
+		boxes[i] = bounds[items[i]];
+	// children always come after their parent
+	for (int n = (int)nodes.size() - 1; n >= 0; --n)
+	{
+		Node& node = nodes[n];
+		if (node.left < 0)
+		{
+			node.box = boxes[node.first];
+			for (int i = node.first + 1; i < node.first + node.count; ++i)
+				grow(node.box, boxes[i]);
+		}
+		else
+		{
+			node.box = nodes[node.left].box;
+			grow(node.box, nodes[node.right].box);
+		}
+	}
+}
+
+void Bvh::Cull(const Frustum& frustum, std::vector<int>& visible) const
+{
+	if (!nodes.empty())
+		Cull(frustum, 0, (1 << 6) - 1, visible);
+}
+
+void Bvh::Cull(const Frustum& frustum, int root, int mask, std::vector<int>& visible) const
+{
+	// (node, planes still straddled) pairs
+	int stack[128][2];
+	int top = 0;
+	stack[top][0] = root;
+	stack[top][1] = mask;
+	++top;
+	while (top)
+	{
+		--top;
+		const Node& node = nodes[stack[top][0]];
+		int inner_mask;
+		int side = classify(frustum, node.box, stack[top][1], inner_mask);
+		if (side < 0)
+			continue;
+		if (side > 0)
+		{
+			// the whole subtree is inside
+			visible.insert(visible.end(), items.begin() + node.first, items.begin() + node.first + node.count);
+			continue;
+		}
+		if (node.left < 0)
+		{
+			int unused;
+			for (int i = node.first; i < node.first + node.count; ++i)
+				if (classify(frustum, boxes[i], inner_mask, unused) >= 0)
+					visible.push_back(items[i]);
+			continue;
+		}
+		stack[top][0] = node.left;
+		stack[top][1] = inner_mask;
+		++top;
+		stack[top][0] = node.right;
+		stack[top][1] = inner_mask;
+		++top;
+	}
+}
+
+void Bvh::Split(const Frustum& frustum, int limit, std::vector<BvhTask>& tasks) const
+{
+	if (nodes.empty())
+		return;
+	int stack[128][2];
+	int top = 0;
+	stack[top][0] = 0;
+	stack[top][1] = (1 << 6) - 1;
+	++top;
+	while (top)
+	{
+		--top;
+		BvhTask task = { stack[top][0], stack[top][1] };
+		const Node& node = nodes[task.node];
+		if (node.count <= limit || node.left < 0)
+		{
+			tasks.push_back(task);
+			continue;
+		}
+		int inner_mask;
+		int side = classify(frustum, node.box, task.mask, inner_mask);
+		if (side < 0)
+			continue;
+		if (side > 0)
+		{
+			// no planes left, the task takes the subtree whole
+			task.mask = 0;
+			tasks.push_back(task);
+			continue;
+		}
+		stack[top][0] = node.left;
+		stack[top][1] = inner_mask;
+		++top;
+		stack[top][0] = node.right;
+		stack[top][1] = inner_mask;
+		++top;
+	}
+}
+
+int CulledInstances::AddBuffer(InstanceBuffer* buffer)
+{
+	buffers.push_back(buffer);
+	lists.push_back(std::vector<InstanceData>());
+	return (int)buffers.size() - 1;
+}
+
+void CulledInstances::Add(int buffer, const InstanceData& instance, const Aabb& localBounds)
+{
+	Aabb world;
+	aabb_transform(localBounds, instance.transform, world);
+	instances.push_back(instance);
+	owner.push_back(buffer);
+	bounds.push_back(world);
+}
+
+void CulledInstances::Build()
+{
+	bvh.Build(bounds.empty() ? NULL : &bounds[0], (int)bounds.size());
+	uploaded = false;
+}
+
+struct CullJob
+{
+	CulledInstances* set;
+	const Frustum*   frustum;
+};
+
+static void cull_tasks(void* data, int begin, int end)
+{
+	CullJob& job = *(CullJob*)data;
+	for (int t = begin; t < end; ++t)
+	{
+		std::vector<int>& out = job.set->taskVisible[t];
+		out.clear();
+		job.set->bvh.Cull(*job.frustum, job.set->tasks[t].node, job.set->tasks[t].mask, out);
+	}
+}
+
+// how many visible instances of every buffer each chunk holds
+static void count_chunks(void* data, int begin, int end)
+{
+	CulledInstances& set = *(CulledInstances*)data;
+	int buffers = (int)set.buffers.size();
+	int visible = (int)set.visible.size();
+	for (int c = begin; c < end; ++c)
+	{
+		int *counts = &set.chunkOffsets[c * buffers];
+		for (int b = 0; b < buffers; ++b)
+			counts[b] = 0;
+		int last = std::min((c + 1) * CULL_LIST_CHUNK, visible);
+		for (int i = c * CULL_LIST_CHUNK; i < last; ++i)
+			++counts[set.owner[set.visible[i]]];
+	}
+}
+
+// copies each chunk's instances to where the counts put them
+static void fill_chunks(void* data, int begin, int end)
+{
+	CulledInstances& set = *(CulledInstances*)data;
+	int buffers = (int)set.buffers.size();
+	int visible = (int)set.visible.size();
+	for (int c = begin; c < end; ++c)
+	{
+		int *offsets = &set.chunkOffsets[c * buffers];
+		int last = std::min((c + 1) * CULL_LIST_CHUNK, visible);
+		for (int i = c * CULL_LIST_CHUNK; i < last; ++i)
+		{
+			int v = set.visible[i];
+			int b = set.owner[v];
+			set.lists[b][offsets[b]++] = set.instances[v];
+		}
+	}
+}
+
+int CulledInstances::Cull(const Frustum* frustum)
+{
+	visible.clear();
+	if (frustum)
+	{
+		int limit = (int)bvh.items.size() / (job_system_threads() * CULL_TASKS_PER_THREAD);
+		tasks.clear();
+		bvh.Split(*frustum, limit > CULL_MIN_TASK ? limit : CULL_MIN_TASK, tasks);
+		if (taskVisible.size() < tasks.size())
+			taskVisible.resize(tasks.size());
+		JobGroup group;
+		CullJob job = { this, frustum };
+		job_parallel_for(group, (int)tasks.size(), 1, cull_tasks, &job);
+		job_wait(group);
+		for (size_t t = 0; t < tasks.size(); ++t)
+			visible.insert(visible.end(), taskVisible[t].begin(), taskVisible[t].end());
+	}
+	else
+		visible = bvh.items;
+	// the tree hands out a stable order, an unchanged view needs no upload
+	if (uploaded && visible == lastVisible)
+		return (int)visible.size();
+
+	// count per chunk, turn the counts into offsets, then fill all chunks at once
+	int chunks = ((int)visible.size() + CULL_LIST_CHUNK - 1) / CULL_LIST_CHUNK;
+	int nbuffers = (int)buffers.size();
+	chunkOffsets.resize(chunks * nbuffers);
+	JobGroup group;
+	job_parallel_for(group, chunks, 1, count_chunks, this);
+	job_wait(group);
+	for (int b = 0; b < nbuffers; ++b)
+	{
+		int offset = 0;
+		for (int c = 0; c < chunks; ++c)
+		{
+			int count = chunkOffsets[c * nbuffers + b];
+			chunkOffsets[c * nbuffers + b] = offset;
+			offset += count;
+		}
+		lists[b].resize(offset);
+	}
+	job_parallel_for(group, chunks, 1, fill_chunks, this);
+	job_wait(group);
+
+	for (size_t b = 0; b < buffers.size(); ++b)
+		buffers[b]->Update(lists[b].empty() ? NULL : &lists[b][0], (int)lists[b].size());
+	lastVisible.swap(visible);
+	uploaded = true;
+	return (int)lastVisible.size();
+}
@@ -0,0 +1,98 @@
+#pragma once
+
+#include <vector>
+#include <OVR_CAPI.h>
+#include "instanced.h"
+
+// FOV tangents are widened by this much, the eyes are latched again after
+// culling and the head may have turned a little in between
+#define CULL_FOV_MARGIN 0.1f
+
+struct Aabb
+{
+	float min[3];
+	float max[3];
+};
+
+// bounds of a local box after a column-major affine transform
+void aabb_transform(const Aabb& local, const float* m, Aabb& out);
+
+// six planes (left, right, bottom, top, near, far), inside where n.x + d >= 0
+struct Frustum
+{
+	float planes[6][4];
+};
+
+// from a column-major view-projection matrix with GL clip range
+void frustum_from_matrix(const float* viewProj, Frustum& out);
+
+// One frustum that holds both eye frusta: the union of the two FOVs, with
+// its apex moved back behind the eyes far enough that the outer planes
+// still pass outside each eye. headView is the view matrix of the head
+// (centre eye) pose, the eyes sit at eyeOffset from it.
+// margin widens the FOV to cover the pose being latched again after culling.
+void frustum_combined_eyes(const ovrFovPort fov[2], const ovrVector3f eyeOffset[2], const float* headView,
+	float zNear, float zFar, float margin, Frustum& out);
+
+// a subtree left to a job: its root and the planes it still straddles
+struct BvhTask
+{
+	int node, mask;
+};
+
+// Bounding volume hierarchy over object bounds, median split on the longest
+// axis. Culling walks it with a plane mask: subtrees entirely inside the
+// frustum are taken whole, so the cost follows what is visible.
+struct Bvh
+{
+	struct Node
+	{
+		Aabb box;
+		int  first, count; // range in items covered by this subtree
+		int  left, right;  // children, -1 for a leaf
+	};
+	std::vector<Node> nodes;
+	std::vector<int>  items; // object indices, grouped by node
+	std::vector<Aabb> boxes; // bounds of items[i], for leaves that straddle a plane
+
+	void Build(const Aabb* bounds, int count);
+	// the objects moved: boxes follow their new bounds, the tree keeps its shape
+	void Refit(const Aabb* bounds);
+	// appends the visible object indices
+	void Cull(const Frustum& frustum, std::vector<int>& visible) const;
+	// the same below node, for the planes in mask
+	void Cull(const Frustum& frustum, int node, int mask, std::vector<int>& visible) const;
+	// Classifies the top of the tree and hands out what is not rejected as
+	// subtrees of at most limit objects (or of any size when entirely
+	// inside), to be culled independently. Their results concatenated in
+	// task order are what Cull would have returned, order aside.
+	void Split(const Frustum& frustum, int limit, std::vector<BvhTask>& tasks) const;
+};
+
+// Objects spread over several InstanceBuffers, culled together once a frame.
+// Every buffer is refilled with its visible instances, so both eyes (or the
+// single stereo pass) draw the same surviving list. Culling and building the
+// per-buffer lists run as jobs on the job system, the calling thread helps
+// and then only uploads the finished lists.
+struct CulledInstances
+{
+	std::vector<InstanceBuffer*> buffers; // not owned
+	std::vector<InstanceData>    instances;
+	std::vector<int>             owner;   // buffer of every instance
+	std::vector<Aabb>            bounds;  // world space
+	Bvh                          bvh;
+	std::vector<int>             visible, lastVisible;
+	std::vector<std::vector<InstanceData> > lists;
+	bool                         uploaded; // buffers hold lastVisible as it is in instances
+	std::vector<BvhTask>         tasks;
+	std::vector<std::vector<int> > taskVisible;
+	std::vector<int>             chunkOffsets; // per list chunk and buffer
+
+	CulledInstances() : uploaded(false) {}
+
+	int AddBuffer(InstanceBuffer* buffer);
+	void Add(int buffer, const InstanceData& instance, const Aabb& localBounds);
+	void Build();
+	// frustum null keeps everything; returns the number of visible instances
+	int Cull(const Frustum* frustum);
+};
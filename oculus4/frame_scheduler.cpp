@@ -0,0 +1,112 @@
+#include "frame_scheduler.h"
+#include <algorithm>
+#include <chrono>
+#include <thread>
+
+FrameScheduler::FrameScheduler() :
+	enabled(true),
+	compositorMs(1.5f),
+	marginMs(1.0f),
+	frameSeconds(1.0 / 90.0),
+	frameIndex(0),
+	frameStart(0),
+	displayTime(0),
+	costCount(0),
+	missed(0),
+	delayTotal(0),
+	latencyTotal(0),
+	sleepSlack(0.001)
+{
+}
+
+void FrameScheduler::SetRefreshRate(float hz)
+{
+	if (hz > 0)
+		frameSeconds = 1.0 / hz;
+}
+
+float FrameScheduler::CostPercentile(float p) const
+{
+	int n = costCount < SCHEDULER_HISTORY ? costCount : SCHEDULER_HISTORY;
+	if (n == 0)
+		return 0;
+	float sorted[SCHEDULER_HISTORY];
+	std::copy(cost, cost + n, sorted);
+	int i = (int)(p * (n - 1) + 0.5f);
+	std::nth_element(sorted, sorted + i, sorted + n);
+	return sorted[i];
+}
+
+double FrameScheduler::Deadline() const
+{
+	return displayTime - 0.5 * frameSeconds - compositorMs * 0.001;
+}
+
+long long FrameScheduler::WaitForFrame(Compositor* compositor)
+{
+	++frameIndex;
+	double arrived = ovr_GetTimeInSeconds();
+	displayTime = compositor->GetPredictedDisplayTime(frameIndex);
+
+	if (enabled && costCount > 0)
+	{
+		double start = Deadline() - (CostPercentile(0.9f) + marginMs) * 0.001;
+		// never more than two intervals, whatever the prediction says
+		if (start > arrived + 2 * frameSeconds)
+			start = arrived + 2 * frameSeconds;
+		// sleep 1 ms at a time while more than a sleep's recent worst lateness
+		// is left, yield through the rest; one late wakeup (a preemption, at
+		// most a frame's worth) only costs yields for the frames it takes to
+		// decay
+		sleepSlack *= 0.95;
+		double now;
+		while ((now = ovr_GetTimeInSeconds()) < start)
+		{
+			if (start - now > sleepSlack + 0.001)
+			{
+				std::this_thread::sleep_for(std::chrono::milliseconds(1));
+				double late = ovr_GetTimeInSeconds() - now - 0.001;
+				if (late > frameSeconds)
+					late = frameSeconds;
+				if (late > sleepSlack)
+					sleepSlack = late;
+			}
+			else
+				std::this_thread::yield();
+		}
+	}
+
+	frameStart = ovr_GetTimeInSeconds();
+	delayTotal += frameStart - arrived;
+	latencyTotal += displayTime - frameStart;
+	return frameIndex;
+}
+
+bool FrameScheduler::PredictMiss() const
+{
+	if (costCount == 0)
+		return false;
+	// the cost is measured from frameStart, work already done this frame is
+	// part of it
+	return frameStart + CostPercentile(0.9f) * 0.001 > Deadline();
+}
+
+void FrameScheduler::Submitting(float gpuMs, bool rendered)
+{
+	double now = ovr_GetTimeInSeconds();
+	float cpuMs = (float)((now - frameStart) * 1000.0);
+	if (rendered)
+		cost[costCount++ % SCHEDULER_HISTORY] = gpuMs > cpuMs ? gpuMs : cpuMs;
+	if (now > Deadline())
+		++missed;
+}
+
+void FrameScheduler::GetStats(FramePacingStats& stats) const
+{
+	stats.frames = frameIndex;
+	stats.missed = missed;
+	stats.delayMs = frameIndex ? delayTotal * 1000.0 / frameIndex : 0;
+	stats.latencyMs = frameIndex ? latencyTotal * 1000.0 / frameIndex : 0;
+	stats.costP50Ms = CostPercentile(0.5f);
+	stats.costP90Ms = CostPercentile(0.9f);
+}
@@ -0,0 +1,63 @@
+#pragma once
+
+#include "compositor.h"
+
+#define SCHEDULER_HISTORY 32 // frames the render cost is estimated from
+
+struct FramePacingStats
+{
+	long long frames;
+	long long missed;     // SubmitFrame called after the deadline
+	double    delayMs;    // average sleep before a frame started
+	double    latencyMs;  // average frame start to predicted display
+	float     costP50Ms;  // render cost over the history window
+	float     costP90Ms;
+};
+
+// Frame pacing. Every frame gets the next frame index, used for both
+// GetPredictedDisplayTime and SubmitFrame so the runtime can pair its
+// predictions with submissions. The predicted display time is the middle
+// of scanout, which starts at the vsync the frame is submitted for; the
+// deadline is half a refresh interval before it, less what the compositor
+// needs before that vsync. WaitForFrame() sleeps until the deadline less
+// the estimated render cost and a margin, so the pose is sampled as late as
+// the frame allows. Sleeps are only trusted to the oversleep seen lately
+// (15.6 ms on Windows without timeBeginPeriod), the rest is yielded away.
+//
+// The render cost is the p90 of the last SCHEDULER_HISTORY frames, each the
+// larger of the CPU time from frame start to SubmitFrame and the measured
+// GPU time of eye rendering.
+struct FrameScheduler
+{
+	bool   enabled;      // off: frames start immediately, indices and stats are still kept
+	float  compositorMs; // the compositor's share of the interval before vsync
+	float  marginMs;     // safety on top of the estimated cost
+	double frameSeconds;
+
+	long long frameIndex;
+	double    frameStart;
+	double    displayTime;
+
+	FrameScheduler();
+
+	void SetRefreshRate(float hz);
+	// sleeps until the frame should start and returns its index
+	long long WaitForFrame(Compositor* compositor);
+	// whether the estimated render cost, counted from the frame's start, no
+	// longer fits before the deadline
+	bool PredictMiss() const;
+	// call right before SubmitFrame; gpuMs < 0 when no GPU time is known.
+	// Frames that were not rendered in full keep out of the estimate.
+	void Submitting(float gpuMs, bool rendered = true);
+	void GetStats(FramePacingStats& stats) const;
+
+private:
+	float  cost[SCHEDULER_HISTORY];
+	int    costCount;
+	long long missed;
+	double delayTotal, latencyTotal;
+	double sleepSlack; // how late a sleep has been returning, decays every frame
+
+	float CostPercentile(float p) const;
+	double Deadline() const;
+};
@@ -0,0 +1,347 @@
+#include "frame_stats.h"
+#include "ring_buffer.h"
+#include <stdio.h>
+#include <string.h>
+#include <algorithm>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+#include <GL/glew.h>
+#include <OVR_CAPI.h>
+
+#define STATS_QUERY_FRAMES 4     // frames in flight before GPU timestamps are read back
+#define STATS_RING_SIZE    256
+#define STATS_TRACE_FRAMES 20000 // oldest frames are dropped from the trace after this
+
+static const char *stage_names[STAGE_COUNT] = {
+	"pose", "stream", "cull", "eye_left", "eye_right", "stereo", "reproject", "layers", "submit", "mirror", "swap"
+};
+
+static bool gpu_timers;
+static GLuint queries[STATS_QUERY_FRAMES][STAGE_COUNT][2];
+static bool issued[STATS_QUERY_FRAMES][STAGE_COUNT];
+static FrameRecord pending[STATS_QUERY_FRAMES];
+static long long frame_index = -1;
+static double gpu_to_cpu; // add to GPU seconds to get CPU seconds
+
+static SpscRing<FrameRecord, STATS_RING_SIZE> ring;
+static std::thread reporter;
+static std::atomic<bool> reporter_quit;
+static double report_interval;
+static std::vector<FrameRecord> trace;
+static size_t trace_next;
+static std::atomic<unsigned int> dropped;
+static float render_gpu_ms = -1.0f; // eye rendering GPU time of the newest retired frame, render thread only
+
+const char* stats_stage_name(FrameStage stage)
+{
+	return stage_names[stage];
+}
+
+static float percentile(std::vector<float>& v, float p)
+{
+	size_t i = (size_t)(p * (v.size() - 1) + 0.5f);
+	std::nth_element(v.begin(), v.begin() + i, v.end());
+	return v[i];
+}
+
+static void print_summary(const std::vector<FrameRecord>& frames)
+{
+	if (frames.empty())
+		return;
+
+	std::vector<float> v;
+	v.reserve(frames.size());
+	for (size_t i = 0; i < frames.size(); ++i)
+		v.push_back(frames[i].frame_ms);
+	printf("frames %d  frame cpu p50 %.2f p95 %.2f p99 %.2f ms\n", (int)frames.size(),
+		percentile(v, 0.5f), percentile(v, 0.95f), percentile(v, 0.99f));
+
+	std::vector<float> draws, changes;
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		draws.push_back((float)frames[i].draw_calls);
+		changes.push_back((float)frames[i].state_changes);
+	}
+	printf("  per frame draws p50 %.0f, state changes p50 %.0f p95 %.0f\n",
+		percentile(draws, 0.5f), percentile(changes, 0.5f), percentile(changes, 0.95f));
+
+	for (int s = 0; s < STAGE_COUNT; ++s)
+	{
+		std::vector<float> cpu, gpu;
+		for (size_t i = 0; i < frames.size(); ++i)
+		{
+			if (frames[i].cpu_begin[s] > 0)
+				cpu.push_back(frames[i].cpu_ms[s]);
+			if (frames[i].gpu_ms[s] >= 0)
+				gpu.push_back(frames[i].gpu_ms[s]);
+		}
+		if (cpu.empty())
+			continue;
+		printf("  %-9s cpu p50 %6.3f p95 %6.3f p99 %6.3f", stage_names[s],
+			percentile(cpu, 0.5f), percentile(cpu, 0.95f), percentile(cpu, 0.99f));
+		if (!gpu.empty())
+			printf("  gpu p50 %6.3f p95 %6.3f p99 %6.3f",
+				percentile(gpu, 0.5f), percentile(gpu, 0.95f), percentile(gpu, 0.99f));
+		printf("\n");
+	}
+}
+
+// drains the ring, never touched by the render thread
+static void drain(std::vector<FrameRecord>& window)
+{
+	FrameRecord rec;
+	while (ring.Pop(rec))
+	{
+		window.push_back(rec);
+		if (trace.size() < STATS_TRACE_FRAMES)
+			trace.push_back(rec);
+		else
+			trace[trace_next++ % STATS_TRACE_FRAMES] = rec;
+	}
+}
+
+static void reporter_main()
+{
+	std::vector<FrameRecord> window;
+	double last = ovr_GetTimeInSeconds();
+	while (!reporter_quit.load())
+	{
+		std::this_thread::sleep_for(std::chrono::milliseconds(100));
+		drain(window);
+
+		double now = ovr_GetTimeInSeconds();
+		if (report_interval > 0 && now - last >= report_interval)
+		{
+			print_summary(window);
+			if (dropped)
+				printf("  (%u frames dropped from stats)\n", dropped.load());
+			window.clear();
+			last = now;
+		}
+		else if (report_interval <= 0)
+			window.clear();
+	}
+	drain(window);
+}
+
+void stats_init(double reportInterval)
+{
+	report_interval = reportInterval;
+	gpu_timers = GLEW_ARB_timer_query != 0;
+	if (gpu_timers)
+	{
+		glGenQueries(STATS_QUERY_FRAMES * STAGE_COUNT * 2, &queries[0][0][0]);
+
+		// one blocking read at startup to line the GPU clock up with the CPU one
+		GLint64 gpu_now;
+		glGetInteger64v(GL_TIMESTAMP, &gpu_now);
+		gpu_to_cpu = ovr_GetTimeInSeconds() - gpu_now * 1e-9;
+	}
+
+	trace.reserve(STATS_TRACE_FRAMES);
+	reporter_quit = false;
+	reporter = std::thread(reporter_main);
+}
+
+// read the GPU timestamps of a frame issued STATS_QUERY_FRAMES ago and hand it to the reporter
+static void retire(int slot)
+{
+	FrameRecord& rec = pending[slot];
+	for (int s = 0; s < STAGE_COUNT; ++s)
+	{
+		if (!issued[slot][s])
+			continue;
+		issued[slot][s] = false;
+
+		GLint available = 0;
+		glGetQueryObjectiv(queries[slot][s][1], GL_QUERY_RESULT_AVAILABLE, &available);
+		if (!available)
+			continue; // never wait, the sample is just lost
+		GLuint64 t0, t1;
+		glGetQueryObjectui64v(queries[slot][s][0], GL_QUERY_RESULT, &t0);
+		glGetQueryObjectui64v(queries[slot][s][1], GL_QUERY_RESULT, &t1);
+		rec.gpu_begin[s] = t0 * 1e-9 + gpu_to_cpu;
+		rec.gpu_ms[s] = (float)((t1 - t0) * 1e-6);
+	}
+
+	float render_ms = 0;
+	bool measured = false;
+	FrameStage render_stages[] = { STAGE_EYE_LEFT, STAGE_EYE_RIGHT, STAGE_STEREO };
+	for (int i = 0; i < 3; ++i)
+	{
+		if (rec.gpu_ms[render_stages[i]] >= 0)
+		{
+			render_ms += rec.gpu_ms[render_stages[i]];
+			measured = true;
+		}
+	}
+	if (measured)
+		render_gpu_ms = render_ms;
+	if (!ring.Push(rec))
+		++dropped;
+}
+
+bool stats_render_gpu_ms(float& ms)
+{
+	if (render_gpu_ms < 0)
+		return false;
+	ms = render_gpu_ms;
+	render_gpu_ms = -1.0f;
+	return true;
+}
+
+void stats_begin_frame()
+{
+	++frame_index;
+	int slot = (int)(frame_index % STATS_QUERY_FRAMES);
+	if (frame_index >= STATS_QUERY_FRAMES)
+		retire(slot);
+
+	FrameRecord& rec = pending[slot];
+	memset(&rec, 0, sizeof(rec));
+	for (int s = 0; s < STAGE_COUNT; ++s)
+		rec.gpu_ms[s] = -1.0f;
+	rec.index = frame_index;
+	rec.start = ovr_GetTimeInSeconds();
+}
+
+void stats_end_frame()
+{
+	if (frame_index < 0)
+		return;
+	FrameRecord& rec = pending[frame_index % STATS_QUERY_FRAMES];
+	rec.frame_ms = (float)((ovr_GetTimeInSeconds() - rec.start) * 1000.0);
+}
+
+void stats_begin(FrameStage stage)
+{
+	if (frame_index < 0)
+		return;
+	int slot = (int)(frame_index % STATS_QUERY_FRAMES);
+	pending[slot].cpu_begin[stage] = ovr_GetTimeInSeconds();
+	if (gpu_timers)
+		glQueryCounter(queries[slot][stage][0], GL_TIMESTAMP);
+}
+
+void stats_end(FrameStage stage)
+{
+	if (frame_index < 0)
+		return;
+	int slot = (int)(frame_index % STATS_QUERY_FRAMES);
+	FrameRecord& rec = pending[slot];
+	rec.cpu_ms[stage] = (float)((ovr_GetTimeInSeconds() - rec.cpu_begin[stage]) * 1000.0);
+	if (gpu_timers)
+	{
+		glQueryCounter(queries[slot][stage][1], GL_TIMESTAMP);
+		issued[slot][stage] = true;
+	}
+}
+
+void stats_count_draw()
+{
+	if (frame_index >= 0)
+		++pending[frame_index % STATS_QUERY_FRAMES].draw_calls;
+}
+
+void stats_count_state(int changes)
+{
+	if (frame_index >= 0)
+		pending[frame_index % STATS_QUERY_FRAMES].state_changes += changes;
+}
+
+static void write_trace(const char* path)
+{
+	FILE *fp = fopen(path, "w");
+	if (!fp)
+	{
+		fprintf(stderr, "Failed to open trace file %s\n", path);
+		return;
+	}
+
+	// oldest first when the trace wrapped around
+	size_t oldest = trace.size() == STATS_TRACE_FRAMES ? trace_next % STATS_TRACE_FRAMES : 0;
+	std::vector<FrameRecord> frames(trace.begin() + oldest, trace.end());
+	frames.insert(frames.end(), trace.begin(), trace.begin() + oldest);
+	double origin = frames.empty() ? 0 : frames[0].start;
+
+	fprintf(fp, "{\"traceEvents\":[\n");
+	bool first = true;
+	for (size_t i = 0; i < frames.size(); ++i)
+	{
+		const FrameRecord& rec = frames[i];
+		fprintf(fp, "%s{\"name\":\"frame %lld\",\"cat\":\"frame\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.1f,\"dur\":%.1f,"
+			"\"args\":{\"draws\":%d,\"state\":%d}}",
+			first ? "" : ",\n", rec.index, (rec.start - origin) * 1e6, rec.frame_ms * 1e3, rec.draw_calls, rec.state_changes);
+		first = false;
+		for (int s = 0; s < STAGE_COUNT; ++s)
+		{
+			if (rec.cpu_begin[s] > 0)
+				fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"cpu\",\"ph\":\"X\",\"pid\":0,\"tid\":0,\"ts\":%.1f,\"dur\":%.1f}",
+					stage_names[s], (rec.cpu_begin[s] - origin) * 1e6, rec.cpu_ms[s] * 1e3);
+			if (rec.gpu_ms[s] >= 0)
+				fprintf(fp, ",\n{\"name\":\"%s\",\"cat\":\"gpu\",\"ph\":\"X\",\"pid\":0,\"tid\":1,\"ts\":%.1f,\"dur\":%.1f}",
+					stage_names[s], (rec.gpu_begin[s] - origin) * 1e6, rec.gpu_ms[s] * 1e3);
+		}
+	}
+	fprintf(fp, "\n],\n\"metadata\":{\"frames\":%d,\"dropped\":%u}}\n", (int)frames.size(), dropped.load());
+	fclose(fp);
+	printf("wrote %d frames of trace to %s\n", (int)frames.size(), path);
+}
+
+void stats_shutdown(const char* tracePath)
+{
+	// hand over the frames still waiting for their queries
+	glFinish();
+	for (long long f = frame_index - STATS_QUERY_FRAMES + 1; f <= frame_index; ++f)
+	{
+		if (f >= 0)
+			retire((int)(f % STATS_QUERY_FRAMES));
+	}
+	frame_index = -1;
+
+	if (reporter.joinable())
+	{
+		reporter_quit = true;
+		reporter.join();
+	}
+	if (tracePath)
+		write_trace(tracePath);
+	if (gpu_timers)
+	{
+		glDeleteQueries(STATS_QUERY_FRAMES * STAGE_COUNT * 2, &queries[0][0][0]);
+		gpu_timers = false;
+	}
+}
+
+bool stats_summarize(int skipFrames, FrameSummary& out)
+{
+	size_t oldest = trace.size() == STATS_TRACE_FRAMES ? trace_next % STATS_TRACE_FRAMES : 0;
+	std::vector<float> cpu, gpu, draws, state;
+	for (size_t n = 0; n < trace.size(); ++n)
+	{
+		const FrameRecord& rec = trace[(oldest + n) % trace.size()];
+		if (rec.index < skipFrames)
+			continue;
+		cpu.push_back(rec.frame_ms);
+		float gpu_ms = 0;
+		for (int s = 0; s < STAGE_COUNT; ++s)
+			if (rec.gpu_ms[s] > 0)
+				gpu_ms += rec.gpu_ms[s];
+		gpu.push_back(gpu_ms);
+		draws.push_back((float)rec.draw_calls);
+		state.push_back((float)rec.state_changes);
+	}
+	memset(&out, 0, sizeof(out));
+	if (cpu.empty())
+		return false;
+	out.frames = (int)cpu.size();
+	out.cpu_p50 = percentile(cpu, 0.5f);
+	out.cpu_p95 = percentile(cpu, 0.95f);
+	out.gpu_p50 = percentile(gpu, 0.5f);
+	out.gpu_p95 = percentile(gpu, 0.95f);
+	out.draw_calls = percentile(draws, 0.5f);
+	out.state_changes = percentile(state, 0.5f);
+	return true;
+}
@@ -0,0 +1,69 @@
+#pragma once
+
+// Per-stage frame timing. CPU times come from ovr_GetTimeInSeconds(), GPU
+// times from GL_TIMESTAMP queries that are read back a few frames later
+// without waiting. Finished frames go through a lock-free ring to a reporter
+// thread that prints p50/p95/p99 per stage and keeps a Chrome trace
+// (chrome://tracing, about:tracing) that is written out by stats_shutdown().
+
+enum FrameStage
+{
+	STAGE_POSE,      // predicted display time and tracking state
+	STAGE_STREAM,    // texture streaming uploads
+	STAGE_CULL,      // frustum culling of the scene, once for both eyes
+	STAGE_EYE_LEFT,
+	STAGE_EYE_RIGHT,
+	STAGE_STEREO,    // both eyes in one pass
+	STAGE_REPROJECT, // the previous images warped to the newest pose instead of rendering
+	STAGE_LAYERS,    // quad layers that were due for a redraw
+	STAGE_SUBMIT,    // SubmitFrame
+	STAGE_MIRROR,    // mirror blit to the desktop window
+	STAGE_SWAP,      // glfwSwapBuffers
+	STAGE_COUNT
+};
+
+struct FrameRecord
+{
+	long long index;
+	double    start;                  // seconds
+	float     frame_ms;               // CPU time from stats_begin_frame to stats_end_frame
+	double    cpu_begin[STAGE_COUNT]; // seconds, 0 when the stage did not run
+	float     cpu_ms[STAGE_COUNT];
+	double    gpu_begin[STAGE_COUNT]; // seconds, mapped to the CPU clock
+	float     gpu_ms[STAGE_COUNT];    // < 0 when not measured
+	int       draw_calls;
+	int       state_changes;          // program, VAO, texture, uniform and capability changes
+};
+
+// medians and p95 over the frames kept for the trace
+struct FrameSummary
+{
+	int   frames;
+	float cpu_p50, cpu_p95;   // frame CPU ms
+	float gpu_p50, gpu_p95;   // sum of the measured stage GPU ms, 0 without timer queries
+	float draw_calls;         // p50 per frame
+	float state_changes;
+};
+
+// needs a current GL context; reportInterval in seconds, 0 disables the printout
+void stats_init(double reportInterval);
+// flushes the reporter and writes the trace if tracePath is not null
+void stats_shutdown(const char* tracePath);
+
+void stats_begin_frame();
+void stats_end_frame();
+void stats_begin(FrameStage stage);
+void stats_end(FrameStage stage);
+
+// render thread only, added to the current frame
+void stats_count_draw();
+void stats_count_state(int changes);
+
+const char* stats_stage_name(FrameStage stage);
+
+// after stats_shutdown(), skipping the first skipFrames; false if none are left
+bool stats_summarize(int skipFrames, FrameSummary& out);
+
+// GPU time of the eye stages of the newest frame whose queries came back,
+// false if no new frame has been measured since the last call
+bool stats_render_gpu_ms(float& ms);
@@ -0,0 +1,242 @@
+#include "gpu_resources.h"
+#include <stdio.h>
+#include <algorithm>
+
+#define GPU_IDLE_DEPTH_MAX        8  // idle depth textures kept, for the way back after a resize (eyes and multires)
+#define GPU_IDLE_FRAMEBUFFERS_MAX 32
+
+static Compositor *gpu_compositor;
+static std::vector<DepthBuffer*> depth_pool;    // in use and idle, least recently released idle first
+static std::vector<GLuint> idle_framebuffers;
+static std::vector<TextureBuffer*> live_buffers; // every TextureBuffer, for session recreation
+static GpuResourceStats stats;
+
+DepthBuffer::DepthBuffer(ovrSizei sz, GLenum fmt) :
+	texId(0),
+	size(sz),
+	format(fmt),
+	users(0),
+	shared(false)
+{
+	glGenTextures(1, &texId);
+	glBindTexture(GL_TEXTURE_2D, texId);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	GLenum type = format == GL_DEPTH_COMPONENT32F ? GL_FLOAT : GL_UNSIGNED_INT;
+	glTexImage2D(GL_TEXTURE_2D, 0, format, size.w, size.h, 0, GL_DEPTH_COMPONENT, type, NULL);
+}
+
+DepthBuffer::~DepthBuffer()
+{
+	if (texId)
+	{
+		glDeleteTextures(1, &texId);
+		texId = 0;
+	}
+}
+
+TextureBuffer::TextureBuffer(ovrSizei size, GLenum format, bool share) :
+	TextureSet(nullptr),
+	texSize(size),
+	depth(nullptr),
+	generation(0),
+	depthFormat(format),
+	shareDepth(share)
+{
+	live_buffers.push_back(this);
+	if (depthFormat)
+		depth = gpu_depth_acquire(texSize, depthFormat, shareDepth);
+	CreateSet();
+}
+
+TextureBuffer::~TextureBuffer()
+{
+	ReleaseSet();
+	fbos.Release();
+	gpu_depth_release(depth);
+	depth = nullptr;
+	live_buffers.erase(std::find(live_buffers.begin(), live_buffers.end(), this));
+}
+
+bool TextureBuffer::CreateSet()
+{
+	if (gpu_compositor->CreateSwapTextureSetGL(GL_SRGB8_ALPHA8, texSize.w, texSize.h, &TextureSet) != ovrSuccess)
+	{
+		fprintf(stderr, "Failed to create a %dx%d swap texture set.\n", texSize.w, texSize.h);
+		TextureSet = nullptr;
+		return false;
+	}
+	++stats.swapSetsCreated;
+	++generation;
+	for (int i = 0; i < TextureSet->TextureCount; ++i)
+	{
+		const ovrGLTexture *tex = (const ovrGLTexture*)&TextureSet->Textures[i];
+		glBindTexture(GL_TEXTURE_2D, tex->OGL.TexId);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	}
+	return fbos.Build(TextureSet, DepthTexture());
+}
+
+void TextureBuffer::ReleaseSet()
+{
+	if (TextureSet)
+	{
+		gpu_compositor->DestroySwapTextureSet(TextureSet);
+		TextureSet = nullptr;
+	}
+}
+
+bool TextureBuffer::Resize(ovrSizei size)
+{
+	if (TextureSet && size.w == texSize.w && size.h == texSize.h)
+		return true;
+	ReleaseSet();
+	texSize = size;
+	if (depthFormat)
+	{
+		// released first, so an idle one of the new size or one to share is found
+		gpu_depth_release(depth);
+		depth = gpu_depth_acquire(texSize, depthFormat, shareDepth);
+	}
+	return CreateSet();
+}
+
+void TextureBuffer::ShareDepth(bool share)
+{
+	if (share == shareDepth || !depthFormat)
+		return;
+	shareDepth = share;
+	gpu_depth_release(depth);
+	depth = gpu_depth_acquire(texSize, depthFormat, shareDepth);
+	if (TextureSet)
+		fbos.Build(TextureSet, DepthTexture());
+}
+
+void gpu_resources_init(Compositor* compositor)
+{
+	gpu_compositor = compositor;
+}
+
+void gpu_resources_shutdown()
+{
+	if (!live_buffers.empty())
+		fprintf(stderr, "gpu resources: %d texture buffers still alive\n", (int)live_buffers.size());
+	for (size_t i = 0; i < depth_pool.size(); ++i)
+		delete depth_pool[i];
+	depth_pool.clear();
+	if (!idle_framebuffers.empty())
+		glDeleteFramebuffers((GLsizei)idle_framebuffers.size(), &idle_framebuffers[0]);
+	idle_framebuffers.clear();
+	gpu_compositor = nullptr;
+}
+
+DepthBuffer* gpu_depth_acquire(ovrSizei size, GLenum format, bool shared)
+{
+	DepthBuffer *idle = nullptr;
+	for (size_t i = 0; i < depth_pool.size(); ++i)
+	{
+		DepthBuffer *d = depth_pool[i];
+		if (d->size.w != size.w || d->size.h != size.h || d->format != format)
+			continue;
+		if (shared && d->users && d->shared)
+		{
+			++d->users;
+			++stats.depthReused;
+			return d;
+		}
+		if (!d->users && !idle)
+			idle = d;
+	}
+	if (!idle)
+	{
+		idle = new DepthBuffer(size, format);
+		depth_pool.push_back(idle);
+		++stats.depthAllocated;
+	}
+	else
+		++stats.depthReused;
+	idle->users = 1;
+	idle->shared = shared;
+	return idle;
+}
+
+void gpu_depth_release(DepthBuffer* depth)
+{
+	if (!depth || --depth->users > 0)
+		return;
+	// idle now: to the back, and the longest idle ones go once there are too many
+	depth_pool.erase(std::find(depth_pool.begin(), depth_pool.end(), depth));
+	depth_pool.push_back(depth);
+	int idle = 0;
+	for (size_t i = 0; i < depth_pool.size(); ++i)
+		idle += !depth_pool[i]->users;
+	for (size_t i = 0; i < depth_pool.size() && idle > GPU_IDLE_DEPTH_MAX;)
+	{
+		if (depth_pool[i]->users)
+		{
+			++i;
+			continue;
+		}
+		delete depth_pool[i];
+		depth_pool.erase(depth_pool.begin() + i);
+		--idle;
+	}
+}
+
+void gpu_framebuffers_acquire(int count, GLuint* names)
+{
+	int reused = std::min(count, (int)idle_framebuffers.size());
+	for (int i = 0; i < reused; ++i)
+	{
+		names[i] = idle_framebuffers.back();
+		idle_framebuffers.pop_back();
+	}
+	if (count > reused)
+		glGenFramebuffers(count - reused, names + reused);
+	stats.framebuffersReused += reused;
+	stats.framebuffersAllocated += count - reused;
+}
+
+void gpu_framebuffers_release(int count, const GLuint* names)
+{
+	for (int i = 0; i < count; ++i)
+	{
+		if (idle_framebuffers.size() >= GPU_IDLE_FRAMEBUFFERS_MAX)
+		{
+			glDeleteFramebuffers(1, &names[i]);
+			continue;
+		}
+		// an attachment would keep its texture alive
+		glBindFramebuffer(GL_FRAMEBUFFER, names[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+		idle_framebuffers.push_back(names[i]);
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+bool gpu_resources_recreate_session()
+{
+	double start = ovr_GetTimeInSeconds();
+	for (size_t i = 0; i < live_buffers.size(); ++i)
+		live_buffers[i]->ReleaseSet();
+	ovrResult result = gpu_compositor->RecreateSession();
+	if (OVR_FAILURE(result))
+		return false;
+	bool complete = true;
+	for (size_t i = 0; i < live_buffers.size(); ++i)
+		complete = live_buffers[i]->CreateSet() && complete;
+	++stats.sessionsRecreated;
+	stats.lastRecreateMs = (ovr_GetTimeInSeconds() - start) * 1000.0;
+	return complete;
+}
+
+void gpu_resources_get_stats(GpuResourceStats& out)
+{
+	out = stats;
+}
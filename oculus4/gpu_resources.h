@@ -0,0 +1,102 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+#include <OVR_CAPI_GL.h>
+#include "compositor.h"
+#include "swap_fbo.h"
+
+// GPU render targets with owners. Depth textures are pooled by size and
+// format: a target that changes size hands its depth texture back and takes
+// one of the new size, reusing an idle one when there is. Targets that
+// allow it share a single depth texture when their sizes match (the eyes
+// are drawn one after the other and clear depth first). Framebuffer names
+// are recycled the same way.
+//
+// Every TextureBuffer is known to the pool, so after a lost session all
+// their swap texture sets can be destroyed and created again on the new
+// session in place: same objects, same framebuffer names and depth
+// textures, only the color attachments change.
+
+struct DepthBuffer
+{
+	GLuint   texId;
+	ovrSizei size;
+	GLenum   format;
+	int      users;  // TextureBuffers attached to it, 0 while idle in the pool
+	bool     shared; // its users accept others of the same size
+
+	DepthBuffer(ovrSizei size, GLenum format);
+	~DepthBuffer();
+
+private:
+	DepthBuffer(const DepthBuffer&);
+	DepthBuffer& operator=(const DepthBuffer&);
+};
+
+// A swap texture set of the session, with a framebuffer per texture and
+// an optional pooled depth texture.
+struct TextureBuffer
+{
+	ovrSwapTextureSet* TextureSet; // null when it could not be created
+	ovrSizei           texSize;
+	DepthBuffer*       depth;      // null without depth
+	SwapFramebuffers   fbos;
+	int                generation; // bumped whenever TextureSet is replaced
+
+	// depthFormat 0 for color only; shareDepth lets another buffer of the same size use the same depth
+	TextureBuffer(ovrSizei size, GLenum depthFormat, bool shareDepth);
+	~TextureBuffer();
+
+	bool Valid() const { return TextureSet != nullptr; }
+	// framebuffer of the set's current texture
+	GLuint Framebuffer() const { return fbos.Current(TextureSet); }
+	GLuint DepthTexture() const { return depth ? depth->texId : 0; }
+
+	// a new swap set of size, the depth texture swapped through the pool;
+	// nothing happens if the size is unchanged
+	bool Resize(ovrSizei size);
+	// give up or take a shared depth texture
+	void ShareDepth(bool share);
+
+	// for gpu_resources_recreate_session()
+	void ReleaseSet();
+	bool CreateSet();
+
+private:
+	GLenum depthFormat;
+	bool   shareDepth;
+
+	TextureBuffer(const TextureBuffer&);
+	TextureBuffer& operator=(const TextureBuffer&);
+};
+
+struct GpuResourceStats
+{
+	int    depthAllocated;        // depth textures created
+	int    depthReused;           // acquisitions served by an idle or shared one
+	int    framebuffersAllocated;
+	int    framebuffersReused;
+	int    swapSetsCreated;
+	int    sessionsRecreated;
+	double lastRecreateMs;        // the last gpu_resources_recreate_session()
+};
+
+// swap sets are created through compositor; needs a current GL context
+void gpu_resources_init(Compositor* compositor);
+// deletes what is idle in the pools, every TextureBuffer must be gone
+void gpu_resources_shutdown();
+
+// a depth texture of exactly size and format; with shared, possibly one
+// another shared user already holds
+DepthBuffer* gpu_depth_acquire(ovrSizei size, GLenum format, bool shared);
+void gpu_depth_release(DepthBuffer* depth);
+void gpu_framebuffers_acquire(int count, GLuint* names);
+// detached and kept for reuse
+void gpu_framebuffers_release(int count, const GLuint* names);
+
+// After ovrError_DisplayLost: destroys the swap set of every TextureBuffer,
+// recreates the session, then gives each a new set of its size. Returns
+// false if there is no session yet; call again later.
+bool gpu_resources_recreate_session();
+void gpu_resources_get_stats(GpuResourceStats& stats);
@@ -0,0 +1,150 @@
+#include "hidden_area.h"
+#include "mesh.h"
+#include "shader.h"
+#include <stdio.h>
+#include <math.h>
+#include <vector>
+
+static StaticMesh *masks[2], *unit_quad;
+static GLuint mask_prog;
+static GLint loc_rect;
+static bool enabled = true;
+
+static const char *mask_vs =
+	"#version 330 compatibility\n"
+	"layout(location = 0) in vec3 in_pos;\n"
+	"uniform vec4 rect;\n" // xy scale, zw offset
+	"void main(){\n"
+	"	gl_Position = vec4(in_pos.xy * rect.xy + rect.zw, in_pos.z, 1.0);\n"
+	"}\n";
+
+static const char *mask_fs =
+	"#version 330 compatibility\n"
+	"void main(){\n"
+	"}\n";
+
+// Ring between the visible circle and a polygon well outside the viewport,
+// in NDC; the clipper trims it to the viewport. The inner polygon is
+// circumscribed about the circle so its chords never cut into what is seen.
+static void mesh_from_fov(const ovrFovPort& fov, std::vector<MeshVertex>& vertices, std::vector<GLushort>& indices)
+{
+	// same mapping as ovrMatrix4f_Projection: tan angle -> NDC
+	float sx = 2.0f / (fov.LeftTan + fov.RightTan);
+	float ox = (fov.LeftTan - fov.RightTan) * sx * 0.5f;
+	float sy = 2.0f / (fov.UpTan + fov.DownTan);
+	float oy = (fov.DownTan - fov.UpTan) * sy * 0.5f;
+	float widest = fmaxf(fmaxf(fov.LeftTan, fov.RightTan), fmaxf(fov.UpTan, fov.DownTan));
+	float r = HIDDEN_AREA_TAN_SCALE * widest / cosf(3.14159265f / HIDDEN_AREA_SEGMENTS);
+	float far_r = 8.0f * widest;
+
+	for (int i = 0; i < HIDDEN_AREA_SEGMENTS; ++i)
+	{
+		float a = 2.0f * 3.14159265f * i / HIDDEN_AREA_SEGMENTS;
+		float dx = cosf(a) * sx, dy = sinf(a) * sy;
+		MeshVertex inner = {}, outer = {};
+		inner.pos[0] = ox + dx * r;
+		inner.pos[1] = oy + dy * r;
+		outer.pos[0] = ox + dx * far_r;
+		outer.pos[1] = oy + dy * far_r;
+		inner.pos[2] = outer.pos[2] = -1.0f;
+		vertices.push_back(inner);
+		vertices.push_back(outer);
+
+		int j = (i + 1) % HIDDEN_AREA_SEGMENTS;
+		GLushort in0 = (GLushort)(2 * i), out0 = in0 + 1, in1 = (GLushort)(2 * j), out1 = in1 + 1;
+		GLushort quad[6] = { in0, out0, out1, in0, out1, in1 };
+		indices.insert(indices.end(), quad, quad + 6);
+	}
+}
+
+void hidden_area_init(Compositor* compositor, const ovrFovPort fov[2])
+{
+	mask_prog = shader_program(mask_vs, mask_fs, "hidden area");
+	loc_rect = glGetUniformLocation(mask_prog, "rect");
+
+	MeshVertex quad[4] = {};
+	GLushort quad_indices[6] = { 0, 1, 2, 0, 2, 3 };
+	for (int i = 0; i < 4; ++i)
+	{
+		quad[i].pos[0] = i == 1 || i == 2 ? 1.0f : -1.0f;
+		quad[i].pos[1] = i >= 2 ? 1.0f : -1.0f;
+		quad[i].pos[2] = -1.0f;
+	}
+	unit_quad = new StaticMesh(quad, 4, quad_indices, 6);
+
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		std::vector<MeshVertex> vertices;
+		std::vector<GLushort> indices;
+		std::vector<ovrVector2f> supplied(1024);
+		int n = compositor->GetHiddenAreaMesh(ovrEyeType(eye), &supplied[0], (int)supplied.size());
+		if (n > 0 && n % 3 == 0)
+		{
+			for (int i = 0; i < n; ++i)
+			{
+				MeshVertex v = {};
+				v.pos[0] = supplied[i].x;
+				v.pos[1] = supplied[i].y;
+				v.pos[2] = -1.0f;
+				vertices.push_back(v);
+				indices.push_back((GLushort)i);
+			}
+		}
+		else
+			mesh_from_fov(fov[eye], vertices, indices);
+		masks[eye] = new StaticMesh(&vertices[0], (int)vertices.size(), &indices[0], (int)indices.size());
+	}
+}
+
+void hidden_area_shutdown()
+{
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		delete masks[eye];
+		masks[eye] = nullptr;
+	}
+	delete unit_quad;
+	unit_quad = nullptr;
+	if (mask_prog)
+	{
+		glDeleteProgram(mask_prog);
+		mask_prog = 0;
+	}
+}
+
+// depth only, at the near plane whatever is already there
+static void draw_mask(const StaticMesh* mesh, float sx, float sy, float ox, float oy)
+{
+	glUseProgram(mask_prog);
+	glUniform4f(loc_rect, sx, sy, ox, oy);
+	glColorMask(GL_FALSE, GL_FALSE, GL_FALSE, GL_FALSE);
+	glDepthFunc(GL_ALWAYS);
+	glDisable(GL_CULL_FACE);
+	mesh->Draw();
+	glEnable(GL_CULL_FACE);
+	glDepthFunc(GL_LESS);
+	glColorMask(GL_TRUE, GL_TRUE, GL_TRUE, GL_TRUE);
+	glUseProgram(0);
+}
+
+void hidden_area_draw(int eye)
+{
+	if (enabled && masks[eye])
+		draw_mask(masks[eye], 1, 1, 0, 0);
+}
+
+void hidden_area_draw_rect(float x0, float y0, float x1, float y1)
+{
+	if (unit_quad)
+		draw_mask(unit_quad, 0.5f * (x1 - x0), 0.5f * (y1 - y0), 0.5f * (x1 + x0), 0.5f * (y1 + y0));
+}
+
+void hidden_area_set_enabled(bool on)
+{
+	enabled = on;
+}
+
+bool hidden_area_enabled()
+{
+	return enabled;
+}
@@ -0,0 +1,27 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <OVR_CAPI.h>
+#include "compositor.h"
+
+// Parts of the eye buffers the lenses never show. Right after the clear
+// hidden_area_draw() puts depth at the near plane there, so every later
+// scene fragment in those pixels fails the depth test before shading.
+//
+// The mesh comes from the compositor when it has one; otherwise it is
+// everything outside a circle of radius HIDDEN_AREA_TAN_SCALE * the widest
+// half-FOV tangent around the lens centre, which cuts away the corners.
+#define HIDDEN_AREA_TAN_SCALE 1.0f
+#define HIDDEN_AREA_SEGMENTS  32
+
+// needs a current GL context
+void hidden_area_init(Compositor* compositor, const ovrFovPort fov[2]);
+void hidden_area_shutdown();
+
+// masks the current viewport, which must be that eye's; no-op when disabled
+void hidden_area_draw(int eye);
+// masks an NDC rectangle of the current viewport the same way, whether enabled or not
+void hidden_area_draw_rect(float x0, float y0, float x1, float y1);
+
+void hidden_area_set_enabled(bool enabled);
+bool hidden_area_enabled();
@@ -0,0 +1,430 @@
+#include "instanced.h"
+#include "frame_stats.h"
+#include "shader.h"
+#include <stdio.h>
+#include <stddef.h>
+#include <string.h>
+
+enum
+{
+	ATTR_POS = 0,
+	ATTR_NORMAL = 1,
+	ATTR_UV = 2,
+	ATTR_TRANSFORM = 3, // mat4 takes 3..6
+	ATTR_COLOR = 7
+};
+
+static GLuint instanced_prog;
+static int instanced_views = 1;
+static GLint loc_eye, loc_inset, loc_use_tex;
+
+// std140 image of the Frame uniform block
+struct FrameBlock
+{
+	float view[2][16];
+	float proj[4][16];          // both eyes, then their multi-resolution insets
+	float eyeScaleOffset[2][4]; // xy used
+	float lightPos[2][4];
+	float lightCol[2][4];
+	float ambient[4];
+	float eyeHeight;
+	float pad[3];
+};
+
+static bool persistent; // ARB_buffer_storage, otherwise glBufferSubData into the same slots
+static GLuint frame_ubo;
+static GLsizeiptr frame_stride;
+static unsigned char *frame_map;
+static GLsync frame_fences[INSTANCED_FRAMES];
+static int frame_slot = INSTANCED_FRAMES - 1;
+static FrameBlock frame_data; // lights persist from frame to frame
+
+// Per-vertex version of the fixed-function lighting the scene used: global
+// ambient plus positional diffuse lights, texture modulated. Everything
+// shared by the frame comes from the Frame block; eye < 0 draws every mesh
+// instance twice, odd instances go to the right eye, squeezed into its half
+// of a side-by-side target and clipped against the shared edge.
+// Instance transforms are translation * rotation * scale and the view is
+// rigid, so the inverse transpose of mat3(mv) is mat3(mv) with the normal
+// divided by the squared scale of each axis; no matrix inverse per vertex.
+static const char *instanced_vs =
+	"#version 330 compatibility\n"
+	"layout(location = 0) in vec3 in_pos;\n"
+	"layout(location = 1) in vec3 in_normal;\n"
+	"layout(location = 2) in vec2 in_uv;\n"
+	"layout(location = 3) in mat4 in_transform;\n"
+	"layout(location = 7) in vec4 in_color;\n"
+	"layout(std140) uniform Frame {\n"
+	"	mat4 view[2];\n"
+	"	mat4 proj[4];\n"
+	"	vec4 eye_scale_offset[2];\n"
+	"	vec4 light_pos[2];\n"
+	"	vec4 light_col[2];\n"
+	"	vec4 ambient;\n"
+	"	float eye_height;\n"
+	"};\n"
+	"uniform int eye;\n"
+	"uniform int inset;\n"
+	"out vec4 color;\n"
+	"out vec2 uv;\n"
+	"void main(){\n"
+	"	int e = eye < 0 ? gl_InstanceID & 1 : eye;\n"
+	"	mat4 mv = view[e] * in_transform;\n"
+	"	vec4 pos = mv * vec4(in_pos, 1.0);\n"
+	"	mat3 m = mat3(in_transform);\n"
+	"	vec3 n = normalize(mat3(mv) * (in_normal / vec3(dot(m[0], m[0]), dot(m[1], m[1]), dot(m[2], m[2]))));\n"
+	"	vec4 c = ambient * in_color;\n"
+	"	for (int i = 0; i < 2; ++i){\n"
+	"		vec4 lpos = view[e] * light_pos[i];\n"
+	"		vec3 l = normalize(lpos.xyz - pos.xyz * lpos.w);\n"
+	"		c += in_color * light_col[i] * max(dot(n, l), 0.0);\n"
+	"	}\n"
+	"	color = vec4(clamp(c.rgb, 0.0, 1.0), in_color.a);\n"
+	"	uv = in_uv;\n"
+	"	vec4 clip = proj[e + 2 * inset] * pos;\n"
+	"	if (eye < 0){\n"
+	"		gl_ClipDistance[0] = e == 0 ? clip.w - clip.x : clip.w + clip.x;\n"
+	"		clip.x = clip.x * eye_scale_offset[e].x + clip.w * eye_scale_offset[e].y;\n"
+	"	}\n"
+	"	else\n"
+	"		gl_ClipDistance[0] = 1.0;\n"
+	"	gl_Position = clip;\n"
+	"}\n";
+
+static const char *instanced_fs =
+	"#version 330 compatibility\n"
+	"uniform sampler2D tex;\n"
+	"uniform int use_tex;\n"
+	"in vec4 color;\n"
+	"in vec2 uv;\n"
+	"layout(location = 0) out vec4 frag_color;\n"
+	"void main(){\n"
+	"	frag_color = use_tex != 0 ? color * texture(tex, uv) : color;\n"
+	"}\n";
+
+// wait for the GPU to finish with the frame that last used a ring slot
+static void wait_fence(GLsync& fence)
+{
+	if (!fence)
+		return;
+	while (glClientWaitSync(fence, GL_SYNC_FLUSH_COMMANDS_BIT, 1000000000) == GL_TIMEOUT_EXPIRED)
+		;
+	glDeleteSync(fence);
+	fence = 0;
+}
+
+// size bytes of buffer storage, mapped for good when persistent
+static void* create_storage(GLenum target, GLuint& buffer, GLsizeiptr size)
+{
+	glGenBuffers(1, &buffer);
+	glBindBuffer(target, buffer);
+	if (!persistent)
+	{
+		glBufferData(target, size, NULL, GL_DYNAMIC_DRAW);
+		return NULL;
+	}
+	GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+	glBufferStorage(target, size, NULL, flags);
+	return glMapBufferRange(target, 0, size, flags);
+}
+
+void instanced_init()
+{
+	instanced_prog = shader_program(instanced_vs, instanced_fs, "instancing");
+
+	loc_eye = glGetUniformLocation(instanced_prog, "eye");
+	loc_inset = glGetUniformLocation(instanced_prog, "inset");
+	loc_use_tex = glGetUniformLocation(instanced_prog, "use_tex");
+	glUniformBlockBinding(instanced_prog, glGetUniformBlockIndex(instanced_prog, "Frame"), 0);
+	if (!GLEW_ARB_base_instance)
+		fprintf(stderr, "GL_ARB_base_instance is missing, instanced draws will fail.\n");
+
+	// one slot of the Frame block per frame in flight
+	persistent = GLEW_ARB_buffer_storage != 0;
+	GLint align = 256;
+	glGetIntegerv(GL_UNIFORM_BUFFER_OFFSET_ALIGNMENT, &align);
+	frame_stride = (sizeof(FrameBlock) + align - 1) / align * align;
+	frame_map = (unsigned char*)create_storage(GL_UNIFORM_BUFFER, frame_ubo, frame_stride * INSTANCED_FRAMES);
+	glBindBuffer(GL_UNIFORM_BUFFER, 0);
+}
+
+static void write_frame(size_t offset, size_t size)
+{
+	GLintptr dst = frame_slot * frame_stride + offset;
+	const unsigned char *src = (const unsigned char*)&frame_data + offset;
+	if (frame_map)
+		memcpy(frame_map + dst, src, size);
+	else
+	{
+		glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+		glBufferSubData(GL_UNIFORM_BUFFER, dst, size, src);
+		glBindBuffer(GL_UNIFORM_BUFFER, 0);
+	}
+}
+
+void instanced_begin_frame(const float view[][16], const float proj[][16], const float insetProj[][16],
+	const float eyeScaleOffset[][2], float eyeHeight)
+{
+	frame_slot = (frame_slot + 1) % INSTANCED_FRAMES;
+	wait_fence(frame_fences[frame_slot]);
+
+	memcpy(frame_data.view, view, sizeof(frame_data.view));
+	memcpy(frame_data.proj[0], proj, 2 * sizeof(frame_data.proj[0]));
+	memcpy(frame_data.proj[2], insetProj ? insetProj : proj, 2 * sizeof(frame_data.proj[0]));
+	for (int eye = 0; eye < 2; ++eye)
+	{
+		frame_data.eyeScaleOffset[eye][0] = eyeScaleOffset ? eyeScaleOffset[eye][0] : 1.0f;
+		frame_data.eyeScaleOffset[eye][1] = eyeScaleOffset ? eyeScaleOffset[eye][1] : 0.0f;
+	}
+	frame_data.eyeHeight = eyeHeight;
+	write_frame(0, sizeof(FrameBlock));
+	glBindBufferRange(GL_UNIFORM_BUFFER, 0, frame_ubo, frame_slot * frame_stride, sizeof(FrameBlock));
+}
+
+void instanced_latch_view(int eye, const float* view)
+{
+	memcpy(frame_data.view[eye], view, sizeof(frame_data.view[eye]));
+	write_frame(offsetof(FrameBlock, view) + eye * sizeof(frame_data.view[eye]), sizeof(frame_data.view[eye]));
+}
+
+void instanced_set_eye(int eye, bool inset)
+{
+	instanced_views = eye < 0 ? 2 : 1;
+	glUseProgram(instanced_prog);
+	glUniform1i(loc_eye, eye);
+	glUniform1i(loc_inset, inset);
+	glUseProgram(0);
+}
+
+void instanced_end_frame()
+{
+	frame_fences[frame_slot] = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+}
+
+void instanced_set_lights(const float pos[][4], const float col[][4], const float* ambient)
+{
+	memcpy(frame_data.lightPos, pos, sizeof(frame_data.lightPos));
+	memcpy(frame_data.lightCol, col, sizeof(frame_data.lightCol));
+	memcpy(frame_data.ambient, ambient, sizeof(frame_data.ambient));
+}
+
+void instanced_shutdown()
+{
+	for (int i = 0; i < INSTANCED_FRAMES; ++i)
+		wait_fence(frame_fences[i]);
+	if (frame_ubo)
+	{
+		if (frame_map)
+		{
+			glBindBuffer(GL_UNIFORM_BUFFER, frame_ubo);
+			glUnmapBuffer(GL_UNIFORM_BUFFER);
+			glBindBuffer(GL_UNIFORM_BUFFER, 0);
+			frame_map = nullptr;
+		}
+		glDeleteBuffers(1, &frame_ubo);
+		frame_ubo = 0;
+	}
+	if (instanced_prog)
+	{
+		glDeleteProgram(instanced_prog);
+		instanced_prog = 0;
+	}
+}
+
+InstanceBuffer::InstanceBuffer(const StaticMesh* mesh, int capacity) :
+	mesh(mesh),
+	vao(0),
+	buffer(0),
+	mapped(nullptr),
+	texture(0),
+	capacity(capacity > 0 ? capacity : 1),
+	count(0),
+	copy(0),
+	divisor(1)
+{
+	// the mesh arrays plus the per-instance ones, reading from buffer
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	glBindBuffer(GL_ARRAY_BUFFER, mesh->vbo);
+	glEnableVertexAttribArray(ATTR_POS);
+	glEnableVertexAttribArray(ATTR_NORMAL);
+	glEnableVertexAttribArray(ATTR_UV);
+	glVertexAttribPointer(ATTR_POS, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, pos));
+	glVertexAttribPointer(ATTR_NORMAL, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+	glVertexAttribPointer(ATTR_UV, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, uv));
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, mesh->ibo);
+	glBindVertexArray(0);
+
+	Allocate();
+}
+
+InstanceBuffer::~InstanceBuffer()
+{
+	if (vao)
+	{
+		glDeleteVertexArrays(1, &vao);
+		vao = 0;
+	}
+	Release();
+}
+
+void InstanceBuffer::Allocate()
+{
+	mapped = (InstanceData*)create_storage(GL_ARRAY_BUFFER, buffer, INSTANCED_FRAMES * capacity * sizeof(InstanceData));
+
+	glBindVertexArray(vao);
+	for (int col = 0; col < 4; ++col)
+	{
+		glEnableVertexAttribArray(ATTR_TRANSFORM + col);
+		glVertexAttribPointer(ATTR_TRANSFORM + col, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData),
+			(void*)(offsetof(InstanceData, transform) + col * 4 * sizeof(float)));
+		glVertexAttribDivisor(ATTR_TRANSFORM + col, divisor);
+	}
+	glEnableVertexAttribArray(ATTR_COLOR);
+	glVertexAttribPointer(ATTR_COLOR, 4, GL_FLOAT, GL_FALSE, sizeof(InstanceData), (void*)offsetof(InstanceData, color));
+	glVertexAttribDivisor(ATTR_COLOR, divisor);
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+}
+
+void InstanceBuffer::Release()
+{
+	if (buffer)
+	{
+		// the GL keeps the storage alive until draws still reading it are done
+		if (mapped)
+		{
+			glBindBuffer(GL_ARRAY_BUFFER, buffer);
+			glUnmapBuffer(GL_ARRAY_BUFFER);
+			glBindBuffer(GL_ARRAY_BUFFER, 0);
+			mapped = nullptr;
+		}
+		glDeleteBuffers(1, &buffer);
+		buffer = 0;
+	}
+}
+
+void InstanceBuffer::Update(const InstanceData* instances, int instanceCount)
+{
+	if (instanceCount > capacity)
+	{
+		Release();
+		capacity = instanceCount;
+		Allocate();
+	}
+
+	// the next of the INSTANCED_FRAMES copies; the GPU last read it at least
+	// that many frames ago, and instanced_begin_frame() waited for that frame
+	copy = (copy + 1) % INSTANCED_FRAMES;
+	if (mapped)
+		memcpy(mapped + copy * capacity, instances, instanceCount * sizeof(InstanceData));
+	else
+	{
+		glBindBuffer(GL_ARRAY_BUFFER, buffer);
+		glBufferSubData(GL_ARRAY_BUFFER, copy * capacity * sizeof(InstanceData), instanceCount * sizeof(InstanceData), instances);
+		glBindBuffer(GL_ARRAY_BUFFER, 0);
+	}
+	count = instanceCount;
+}
+
+void InstanceBuffer::Draw()
+{
+	DrawState state;
+	Draw(state);
+	instanced_end_draws(state);
+}
+
+void InstanceBuffer::Draw(DrawState& state)
+{
+	if (!count)
+		return;
+	int changes = 0;
+	if (state.program != instanced_prog)
+	{
+		glUseProgram(instanced_prog);
+		state.program = instanced_prog;
+		++changes;
+	}
+	if (state.vao != vao)
+	{
+		glBindVertexArray(vao);
+		state.vao = vao;
+		++changes;
+	}
+	if (divisor != instanced_views)
+	{
+		// every view reads the same instance record
+		divisor = instanced_views;
+		for (int col = 0; col < 4; ++col)
+			glVertexAttribDivisor(ATTR_TRANSFORM + col, divisor);
+		glVertexAttribDivisor(ATTR_COLOR, divisor);
+		changes += 5;
+	}
+	int useTex = texture != 0;
+	if (state.useTex != useTex)
+	{
+		glUniform1i(loc_use_tex, useTex);
+		state.useTex = useTex;
+		++changes;
+	}
+	if (texture && state.texture != texture)
+	{
+		glBindTexture(GL_TEXTURE_2D, texture);
+		state.texture = texture;
+		++changes;
+	}
+	bool clip = instanced_views > 1;
+	if (state.clip != clip)
+	{
+		if (clip)
+			glEnable(GL_CLIP_DISTANCE0);
+		else
+			glDisable(GL_CLIP_DISTANCE0);
+		state.clip = clip;
+		++changes;
+	}
+	// the base instance picks this frame's copy of the per-instance records
+	glDrawElementsInstancedBaseInstance(GL_TRIANGLES, mesh->indexCount, GL_UNSIGNED_SHORT, 0, count * instanced_views,
+		copy * capacity);
+	stats_count_draw();
+	stats_count_state(changes);
+}
+
+void instanced_end_draws(DrawState& state)
+{
+	int changes = 0;
+	if (state.clip)
+	{
+		glDisable(GL_CLIP_DISTANCE0);
+		++changes;
+	}
+	if (state.vao)
+	{
+		glBindVertexArray(0);
+		++changes;
+	}
+	if (state.program)
+	{
+		glUseProgram(0);
+		++changes;
+	}
+	stats_count_state(changes);
+	state = DrawState();
+}
+
+GLuint instanced_program()
+{
+	return instanced_prog;
+}
+
+void instance_box(InstanceData& inst, float x, float y, float z, float xsz, float ysz, float zsz, const float* color)
+{
+	float *m = inst.transform;
+	m[0] = xsz * 0.5f; m[4] = 0;          m[8] = 0;           m[12] = x;
+	m[1] = 0;          m[5] = ysz * 0.5f; m[9] = 0;           m[13] = y;
+	m[2] = 0;          m[6] = 0;          m[10] = zsz * 0.5f; m[14] = z;
+	m[3] = 0;          m[7] = 0;          m[11] = 0;          m[15] = 1;
+	for (int i = 0; i < 4; ++i)
+		inst.color[i] = color[i];
+}
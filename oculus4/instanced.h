@@ -0,0 +1,88 @@
+#pragma once
+
+#include <GL/glew.h>
+#include "mesh.h"
+
+#define INSTANCED_FRAMES 3 // frames in flight: slots of the Frame block, copies of every instance list
+
+struct InstanceData
+{
+	float transform[16]; // column-major model matrix
+	float color[4];      // ambient and diffuse material colour
+};
+
+// GL state left bound from one InstanceBuffer draw to the next. A render
+// queue keeps one across its draws so only what differs is changed, and
+// calls instanced_end_draws() after the last one.
+struct DrawState
+{
+	GLuint program, vao, texture;
+	int    useTex; // -1 before the first draw
+	bool   clip;
+
+	DrawState() : program(0), vao(0), texture(0), useTex(-1), clip(false) {}
+};
+
+// Draws N copies of a StaticMesh with one instanced call. Transform and
+// colour are per-instance vertex attributes in a persistently mapped buffer
+// holding INSTANCED_FRAMES copies of the list; the draw's base instance
+// selects the newest one. View, projection and lights come from the Frame
+// uniform block written once per frame.
+struct InstanceBuffer
+{
+	const StaticMesh* mesh;
+	GLuint            vao;
+	GLuint            buffer;
+	InstanceData*     mapped;  // null without GL_ARB_buffer_storage
+	GLuint            texture; // modulates the lit colour when non-zero
+	int               capacity;
+	int               count;
+	int               copy;    // copy the next draw reads
+	int               divisor;
+
+	InstanceBuffer(const StaticMesh* mesh, int capacity);
+	~InstanceBuffer();
+
+	// replace the instance list, grows the buffer if needed; at most once a
+	// frame, after instanced_begin_frame()
+	void Update(const InstanceData* instances, int instanceCount);
+	// binds, draws and unbinds everything
+	void Draw();
+	// changes only the state that differs from state, leaves it bound
+	void Draw(DrawState& state);
+
+private:
+	void Allocate();
+	void Release();
+};
+
+// compile the shared instancing program, needs a current GL context
+void instanced_init();
+void instanced_shutdown();
+
+// Writes the Frame uniform block (column-major view and projection of both
+// eyes, the lights, eye height) into the next slot of its ring, waiting for
+// the GPU to be done with the frame that used the slot before. Once per
+// frame, before any draw or InstanceBuffer::Update. insetProj are the
+// projections of the full rate multi-resolution insets, null when unused.
+// For single-pass stereo eyeScaleOffset[eye] maps the eye's clip space x
+// into its half of the side-by-side target (x' = x * scale + w * offset),
+// null otherwise.
+void instanced_begin_frame(const float view[][16], const float proj[][16], const float insetProj[][16],
+	const float eyeScaleOffset[][2], float eyeHeight);
+// the view of one eye after its pose was latched again, before its draws
+void instanced_latch_view(int eye, const float* view);
+// draw one eye per pass, or both at once (single-pass stereo) with eye < 0;
+// inset picks the eye's multi-resolution inset projection
+void instanced_set_eye(int eye, bool inset);
+// unbinds what draws with state left bound
+void instanced_end_draws(DrawState& state);
+// the program every InstanceBuffer draws with
+GLuint instanced_program();
+// fences the reads of this frame's slot, after the last draw
+void instanced_end_frame();
+// two world space positional lights and the global ambient term, go into every following frame
+void instanced_set_lights(const float pos[][4], const float col[][4], const float* ambient);
+
+// model matrix of an xsz by ysz by zsz box (MESH_BOX) centred at (x, y, z)
+void instance_box(InstanceData& inst, float x, float y, float z, float xsz, float ysz, float zsz, const float* color);
@@ -0,0 +1,195 @@
+#include "job_system.h"
+#include <condition_variable>
+#include <deque>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+#ifdef _MSC_VER
+#define JOB_THREAD_LOCAL __declspec(thread)
+#else
+#define JOB_THREAD_LOCAL __thread
+#endif
+
+struct Job
+{
+	JobFunc   fn;
+	void*     data;
+	int       begin, end, grain;
+	JobGroup* group;
+};
+
+struct JobQueue
+{
+	std::mutex      lock;
+	std::deque<Job> jobs;
+};
+
+static std::vector<JobQueue*> queues; // one per thread, [0] for the thread that called init
+static std::vector<std::thread> workers;
+static std::mutex sleep_lock;
+static std::condition_variable wake;
+static std::atomic<int> queued;   // jobs sitting in any deque
+static std::atomic<int> sleeping; // workers waiting on wake
+static bool workers_quit;
+static JOB_THREAD_LOCAL int thread_index;
+
+static void push(const Job& job)
+{
+	JobQueue& q = *queues[thread_index];
+	{
+		std::lock_guard<std::mutex> lock(q.lock);
+		q.jobs.push_back(job);
+	}
+	// a worker going to sleep counts itself before it looks at queued, so
+	// either it sees this job or we see it and wake it
+	++queued;
+	if (sleeping.load() > 0)
+	{
+		std::lock_guard<std::mutex> lock(sleep_lock);
+		wake.notify_one();
+	}
+}
+
+// own deque from the back, then the others from the front
+static bool take(Job& job)
+{
+	int n = (int)queues.size();
+	for (int k = 0; k < n; ++k)
+	{
+		JobQueue& q = *queues[(thread_index + k) % n];
+		std::lock_guard<std::mutex> lock(q.lock);
+		if (q.jobs.empty())
+			continue;
+		if (k == 0)
+		{
+			job = q.jobs.back();
+			q.jobs.pop_back();
+		}
+		else
+		{
+			job = q.jobs.front();
+			q.jobs.pop_front();
+		}
+		--queued;
+		return true;
+	}
+	return false;
+}
+
+static void run(Job& job)
+{
+	// leave the upper halves for whoever is idle, keep the lowest piece
+	while (job.end - job.begin > job.grain)
+	{
+		Job upper = job;
+		upper.begin = job.begin + (job.end - job.begin) / 2;
+		job.end = upper.begin;
+		++job.group->pending;
+		push(upper);
+	}
+	job.fn(job.data, job.begin, job.end);
+	--job.group->pending;
+}
+
+static void worker_main(int index)
+{
+	thread_index = index;
+	for (;;)
+	{
+		Job job;
+		if (take(job))
+		{
+			run(job);
+			continue;
+		}
+		std::unique_lock<std::mutex> lock(sleep_lock);
+		++sleeping;
+		while (!workers_quit && queued.load() == 0)
+			wake.wait(lock);
+		--sleeping;
+		if (workers_quit)
+			return;
+	}
+}
+
+void job_system_init(int threads)
+{
+	job_system_shutdown();
+	if (threads <= 0)
+		threads = (int)std::thread::hardware_concurrency();
+	if (threads < 1)
+		threads = 1;
+	thread_index = 0;
+	queued = 0;
+	sleeping = 0;
+	workers_quit = false;
+	for (int i = 0; i < threads; ++i)
+		queues.push_back(new JobQueue);
+	for (int i = 1; i < threads; ++i)
+		workers.push_back(std::thread(worker_main, i));
+}
+
+void job_system_shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(sleep_lock);
+		workers_quit = true;
+	}
+	wake.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+	for (size_t i = 0; i < queues.size(); ++i)
+		delete queues[i];
+	queues.clear();
+}
+
+int job_system_threads()
+{
+	return queues.empty() ? 1 : (int)queues.size();
+}
+
+int job_thread_index()
+{
+	return thread_index;
+}
+
+void job_parallel_for(JobGroup& group, int count, int grain, JobFunc fn, void* data)
+{
+	if (count <= 0)
+		return;
+	if (queues.empty())
+	{
+		// not initialised, everything on the caller
+		fn(data, 0, count);
+		return;
+	}
+	Job job = { fn, data, 0, count, grain > 0 ? grain : 1, &group };
+	++group.pending;
+	push(job);
+}
+
+void job_run(JobGroup& group, JobFunc fn, void* data, int begin, int end)
+{
+	if (queues.empty())
+	{
+		fn(data, begin, end);
+		return;
+	}
+	Job job = { fn, data, begin, end, end - begin > 1 ? end - begin : 1, &group };
+	++group.pending;
+	push(job);
+}
+
+void job_wait(JobGroup& group)
+{
+	while (group.pending.load() > 0)
+	{
+		Job job;
+		if (take(job))
+			run(job);
+		else
+			std::this_thread::yield();
+	}
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <atomic>
+
+// Work-stealing job scheduler for per-frame scene work. Every thread taking
+// part (the workers and the thread that called job_system_init) has its own
+// deque: jobs are pushed and popped at its back, so a thread works on what
+// it split off last while the data is still in cache, and idle threads
+// steal from the front of the others, taking the oldest and largest pieces.
+// A parallel_for starts as one job over the whole range; whoever runs it
+// keeps halving it, pushing the upper half, until it is down to the grain.
+//
+// A thread waiting for a group runs jobs instead of blocking. Threads outside
+// the pool may submit and wait too, they share the deque of thread 0.
+
+typedef void (*JobFunc)(void* data, int begin, int end);
+
+struct JobGroup
+{
+	std::atomic<int> pending; // jobs submitted and not finished
+
+	JobGroup() : pending(0) {}
+};
+
+// threads <= 0 uses one per hardware thread; the calling thread counts as one
+void job_system_init(int threads);
+void job_system_shutdown();
+// threads taking part, the caller of job_system_init included
+int job_system_threads();
+// 0 on the thread that called job_system_init, 1.. on the workers
+int job_thread_index();
+
+// fn over [0, count) in ranges of at most grain, added to group
+void job_parallel_for(JobGroup& group, int count, int grain, JobFunc fn, void* data);
+// fn(data, begin, end) once, as a job of its own
+void job_run(JobGroup& group, JobFunc fn, void* data, int begin, int end);
+// runs jobs until everything in group has finished
+void job_wait(JobGroup& group);
@@ -0,0 +1,158 @@
+#include "mesh.h"
+#include "frame_stats.h"
+#include <stddef.h>
+
+static StaticMesh *mesh_cache[MESH_COUNT];
+
+StaticMesh::StaticMesh(const MeshVertex* vertices, int vertexCount, const GLushort* indices, int indexCount) :
+	vao(0),
+	vbo(0),
+	ibo(0),
+	indexCount(indexCount)
+{
+	glGenVertexArrays(1, &vao);
+	glBindVertexArray(vao);
+
+	glGenBuffers(1, &vbo);
+	glBindBuffer(GL_ARRAY_BUFFER, vbo);
+	glBufferData(GL_ARRAY_BUFFER, vertexCount * sizeof(MeshVertex), vertices, GL_STATIC_DRAW);
+
+	glGenBuffers(1, &ibo);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, ibo);
+	glBufferData(GL_ELEMENT_ARRAY_BUFFER, indexCount * sizeof(GLushort), indices, GL_STATIC_DRAW);
+
+	glEnableVertexAttribArray(0);
+	glEnableVertexAttribArray(1);
+	glEnableVertexAttribArray(2);
+	glVertexAttribPointer(0, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, pos));
+	glVertexAttribPointer(1, 3, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, normal));
+	glVertexAttribPointer(2, 2, GL_FLOAT, GL_FALSE, sizeof(MeshVertex), (void*)offsetof(MeshVertex, uv));
+
+	glBindVertexArray(0);
+	glBindBuffer(GL_ARRAY_BUFFER, 0);
+	glBindBuffer(GL_ELEMENT_ARRAY_BUFFER, 0);
+}
+
+StaticMesh::~StaticMesh()
+{
+	if (vao)
+	{
+		glDeleteVertexArrays(1, &vao);
+		vao = 0;
+	}
+	if (vbo)
+	{
+		glDeleteBuffers(1, &vbo);
+		vbo = 0;
+	}
+	if (ibo)
+	{
+		glDeleteBuffers(1, &ibo);
+		ibo = 0;
+	}
+}
+
+void StaticMesh::Draw() const
+{
+	glBindVertexArray(vao);
+	glDrawElements(GL_TRIANGLES, indexCount, GL_UNSIGNED_SHORT, 0);
+	glBindVertexArray(0);
+	stats_count_draw();
+	stats_count_state(2);
+}
+
+static void add_triangle(GLushort* indices, int& ni, bool flip, int a, int b, int c)
+{
+	indices[ni++] = (GLushort)a;
+	indices[ni++] = (GLushort)(flip ? c : b);
+	indices[ni++] = (GLushort)(flip ? b : c);
+}
+
+// Same faces as the old immediate mode draw_box(): four textured side quads
+// and a fan around the centre of the top and bottom caps.
+static StaticMesh* build_box(float norm_sign)
+{
+	static const float sides[4][4][3] = {
+		{ { -1, -1, 1 }, { 1, -1, 1 }, { 1, 1, 1 }, { -1, 1, 1 } },
+		{ { 1, -1, 1 }, { 1, -1, -1 }, { 1, 1, -1 }, { 1, 1, 1 } },
+		{ { 1, -1, -1 }, { -1, -1, -1 }, { -1, 1, -1 }, { 1, 1, -1 } },
+		{ { -1, -1, -1 }, { -1, -1, 1 }, { -1, 1, 1 }, { -1, 1, -1 } }
+	};
+	static const float side_normals[4][3] = { { 0, 0, 1 }, { 1, 0, 0 }, { 0, 0, -1 }, { -1, 0, 0 } };
+	static const float caps[2][4][3] = {
+		{ { -1, 1, 1 }, { 1, 1, 1 }, { 1, 1, -1 }, { -1, 1, -1 } },
+		{ { -1, -1, -1 }, { 1, -1, -1 }, { 1, -1, 1 }, { -1, -1, 1 } }
+	};
+	static const float cap_normals[2][3] = { { 0, 1, 0 }, { 0, -1, 0 } };
+	static const float quad_uv[4][2] = { { 0, 0 }, { 1, 0 }, { 1, 1 }, { 0, 1 } };
+
+	MeshVertex vertices[4 * 4 + 2 * 5];
+	GLushort indices[4 * 6 + 2 * 12];
+	int nv = 0, ni = 0;
+
+	// inside-out boxes used glFrontFace(GL_CW), bake the flipped winding instead
+	bool flip = norm_sign < 0.0f;
+
+	for (int f = 0; f < 4; ++f)
+	{
+		int base = nv;
+		for (int v = 0; v < 4; ++v, ++nv)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				vertices[nv].pos[k] = sides[f][v][k];
+				vertices[nv].normal[k] = side_normals[f][k] * norm_sign;
+			}
+			vertices[nv].uv[0] = quad_uv[v][0];
+			vertices[nv].uv[1] = quad_uv[v][1];
+		}
+		add_triangle(indices, ni, flip, base, base + 1, base + 2);
+		add_triangle(indices, ni, flip, base, base + 2, base + 3);
+	}
+
+	for (int c = 0; c < 2; ++c)
+	{
+		int centre = nv;
+		for (int k = 0; k < 3; ++k)
+		{
+			vertices[nv].pos[k] = k == 1 ? cap_normals[c][1] : 0.0f;
+			vertices[nv].normal[k] = cap_normals[c][k] * norm_sign;
+		}
+		vertices[nv].uv[0] = vertices[nv].uv[1] = 0.5f;
+		++nv;
+		for (int v = 0; v < 4; ++v, ++nv)
+		{
+			for (int k = 0; k < 3; ++k)
+			{
+				vertices[nv].pos[k] = caps[c][v][k];
+				vertices[nv].normal[k] = cap_normals[c][k] * norm_sign;
+			}
+			vertices[nv].uv[0] = quad_uv[v][0];
+			vertices[nv].uv[1] = quad_uv[v][1];
+		}
+		for (int v = 0; v < 4; ++v)
+			add_triangle(indices, ni, flip, centre, centre + 1 + v, centre + 1 + (v + 1) % 4);
+	}
+
+	return new StaticMesh(vertices, nv, indices, ni);
+}
+
+void mesh_init()
+{
+	mesh_cache[MESH_BOX] = build_box(1.0f);
+	mesh_cache[MESH_BOX_INSIDE] = build_box(-1.0f);
+}
+
+void mesh_shutdown()
+{
+	for (int i = 0; i < MESH_COUNT; ++i)
+	{
+		delete mesh_cache[i];
+		mesh_cache[i] = nullptr;
+	}
+}
+
+const StaticMesh* mesh_get(MeshId id)
+{
+	return mesh_cache[id];
+}
@@ -0,0 +1,38 @@
+#pragma once
+
+#include <GL/glew.h>
+
+struct MeshVertex
+{
+	float pos[3];
+	float normal[3];
+	float uv[2];
+};
+
+// Geometry uploaded once into a VAO/VBO/IBO and drawn with one indexed call.
+// Position, normal and uv are generic attributes 0, 1 and 2, the locations
+// the instancing shaders read them from.
+struct StaticMesh
+{
+	GLuint  vao;
+	GLuint  vbo;
+	GLuint  ibo;
+	GLsizei indexCount;
+
+	StaticMesh(const MeshVertex* vertices, int vertexCount, const GLushort* indices, int indexCount);
+	~StaticMesh();
+
+	void Draw() const;
+};
+
+enum MeshId
+{
+	MESH_BOX,        // unit box, normals pointing out
+	MESH_BOX_INSIDE, // unit box seen from inside, the room
+	MESH_COUNT
+};
+
+// build every static mesh, needs a current GL context
+void mesh_init();
+void mesh_shutdown();
+const StaticMesh* mesh_get(MeshId id);
@@ -0,0 +1,258 @@
+#include "mirror.h"
+#include "frame_stats.h"
+#include <stdio.h>
+#include <condition_variable>
+#include <mutex>
+#include <thread>
+#ifndef O4_HEADLESS
+#include <GLFW/glfw3.h>
+#endif
+
+static const char *mode_names[MIRROR_MODE_COUNT] = {
+	"off", "every frame", "every nth frame", "reduced resolution", "separate thread"
+};
+
+static Compositor *mirror_compositor;
+static GLFWwindow *mirror_window;
+static MirrorConfig config;
+static int window_w, window_h;
+static ovrGLTexture *mirrorTexture;
+static GLuint mirrorFBO;
+static long long frame_count;
+
+// MIRROR_THREAD
+static std::thread presenter;
+static std::mutex present_lock;
+static std::condition_variable present_cv;
+static GLsync present_fence;
+static bool presenter_quit;
+static long long presented, skipped;
+static double present_ms;
+
+static void create_texture(int w, int h)
+{
+	if (mirrorTexture)
+	{
+		mirror_compositor->DestroyMirrorTexture(&mirrorTexture->Texture);
+		mirrorTexture = nullptr;
+	}
+	ovrResult result = mirror_compositor->CreateMirrorTextureGL(GL_SRGB8_ALPHA8, w, h, reinterpret_cast<ovrTexture**>(&mirrorTexture));
+	if (!OVR_SUCCESS(result)){
+		fprintf(stderr, "Failed to create mirror texture.");
+		mirrorTexture = nullptr;
+	}
+}
+
+// read framebuffer for the mirror texture in the current context
+static void attach_texture(GLuint fbo)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTexture ? mirrorTexture->OGL.TexId : 0, 0);
+	glFramebufferRenderbuffer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+static void blit(GLuint fbo)
+{
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, fbo);
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
+	GLint w = mirrorTexture->OGL.Header.TextureSize.w;
+	GLint h = mirrorTexture->OGL.Header.TextureSize.h;
+	glBlitFramebuffer(0, h, w, 0,
+		0, 0, window_w, window_h,
+		GL_COLOR_BUFFER_BIT, w == window_w && h == window_h ? GL_NEAREST : GL_LINEAR);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+}
+
+#ifndef O4_HEADLESS
+static void presenter_main()
+{
+	glfwMakeContextCurrent(mirror_window);
+	glfwSwapInterval(1); // vsync only ever blocks this thread
+	GLuint fbo;
+	glGenFramebuffers(1, &fbo); // framebuffers are not shared between contexts
+	attach_texture(fbo);
+
+	for (;;)
+	{
+		GLsync fence;
+		{
+			std::unique_lock<std::mutex> lock(present_lock);
+			while (!present_fence && !presenter_quit)
+				present_cv.wait(lock);
+			if (presenter_quit)
+				break;
+			fence = present_fence;
+			present_fence = 0;
+		}
+
+		double t0 = ovr_GetTimeInSeconds();
+		glWaitSync(fence, 0, GL_TIMEOUT_IGNORED); // GPU side wait for the submitted frame
+		glDeleteSync(fence);
+		blit(fbo);
+		glfwSwapBuffers(mirror_window);
+		present_ms += (ovr_GetTimeInSeconds() - t0) * 1000.0;
+		++presented;
+	}
+
+	glDeleteFramebuffers(1, &fbo);
+	glfwMakeContextCurrent(NULL);
+}
+#endif
+
+void mirror_init(Compositor* compositor, GLFWwindow* window, int w, int h, const MirrorConfig& cfg)
+{
+	mirror_compositor = compositor;
+	mirror_window = window;
+	config = cfg;
+	window_w = w;
+	window_h = h;
+	frame_count = 0;
+
+#ifdef O4_HEADLESS
+	if (config.mode == MIRROR_THREAD)
+		config.mode = MIRROR_EVERY_FRAME;
+#else
+	if (config.mode == MIRROR_THREAD && !window)
+		config.mode = MIRROR_EVERY_FRAME;
+#endif
+
+	if (config.mode == MIRROR_REDUCED)
+		create_texture((int)(w * config.scale), (int)(h * config.scale));
+	else if (config.mode != MIRROR_OFF)
+		create_texture(w, h);
+
+	// Configure the mirror read buffer
+	glGenFramebuffers(1, &mirrorFBO);
+	attach_texture(mirrorFBO);
+
+#ifndef O4_HEADLESS
+	if (config.mode == MIRROR_THREAD)
+	{
+		// the shared texture must exist before the other context uses it
+		glFinish();
+		presenter_quit = false;
+		presenter = std::thread(presenter_main);
+	}
+#endif
+	printf("mirror: %s\n", mode_names[config.mode]);
+}
+
+void mirror_shutdown()
+{
+	if (presenter.joinable())
+	{
+		{
+			std::lock_guard<std::mutex> lock(present_lock);
+			presenter_quit = true;
+		}
+		present_cv.notify_one();
+		presenter.join();
+		if (present_fence)
+		{
+			glDeleteSync(present_fence);
+			present_fence = 0;
+		}
+		printf("mirror thread: %lld frames presented, %lld skipped, %.3f ms avg\n",
+			presented, skipped, presented ? present_ms / presented : 0.0);
+	}
+	if (mirrorFBO)
+	{
+		glDeleteFramebuffers(1, &mirrorFBO);
+		mirrorFBO = 0;
+	}
+	if (mirrorTexture)
+	{
+		mirror_compositor->DestroyMirrorTexture(&mirrorTexture->Texture);
+		mirrorTexture = nullptr;
+	}
+}
+
+void mirror_present()
+{
+	++frame_count;
+	switch (config.mode)
+	{
+	case MIRROR_OFF:
+		return;
+	case MIRROR_EVERY_NTH:
+		if (frame_count % config.interval)
+			return;
+		break;
+	case MIRROR_THREAD:
+	{
+		// hand the frame over; if the presenter is still busy the older one is dropped
+		stats_begin(STAGE_MIRROR);
+		GLsync fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		glFlush();
+		{
+			std::lock_guard<std::mutex> lock(present_lock);
+			if (present_fence)
+			{
+				glDeleteSync(present_fence);
+				++skipped;
+			}
+			present_fence = fence;
+		}
+		present_cv.notify_one();
+		stats_end(STAGE_MIRROR);
+		return;
+	}
+	default:
+		break;
+	}
+
+	if (!mirrorTexture)
+		return;
+
+	// Blit mirror texture to back buffer
+	stats_begin(STAGE_MIRROR);
+	blit(mirrorFBO);
+	stats_end(STAGE_MIRROR);
+
+#ifndef O4_HEADLESS
+	stats_begin(STAGE_SWAP);
+	glfwSwapBuffers(mirror_window);
+	stats_end(STAGE_SWAP);
+#endif
+}
+
+void mirror_set_mode(MirrorMode mode)
+{
+	if (mode == config.mode || mode == MIRROR_THREAD || config.mode == MIRROR_THREAD)
+		return;
+
+	config.mode = mode;
+	if (mode != MIRROR_OFF)
+	{
+		// only reallocate when the size actually changes
+		int w = mode == MIRROR_REDUCED ? (int)(window_w * config.scale) : window_w;
+		int h = mode == MIRROR_REDUCED ? (int)(window_h * config.scale) : window_h;
+		if (!mirrorTexture || mirrorTexture->OGL.Header.TextureSize.w != w || mirrorTexture->OGL.Header.TextureSize.h != h)
+		{
+			create_texture(w, h);
+			attach_texture(mirrorFBO);
+		}
+	}
+	printf("mirror: %s\n", mode_names[config.mode]);
+}
+
+MirrorMode mirror_mode()
+{
+	return config.mode;
+}
+
+const char* mirror_mode_name(MirrorMode mode)
+{
+	return mode_names[mode];
+}
+
+const ovrGLTexture* mirror_texture()
+{
+	return mirrorTexture;
+}
+
+GLuint mirror_framebuffer()
+{
+	return mirrorTexture ? mirrorFBO : 0;
+}
@@ -0,0 +1,49 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <OVR_CAPI_GL.h>
+#include "compositor.h"
+
+struct GLFWwindow;
+
+// How the desktop window shows what the HMD sees. Everything except
+// MIRROR_THREAD runs on the render thread and its cost shows up in the
+// mirror/swap stages of frame_stats.
+enum MirrorMode
+{
+	MIRROR_OFF,         // no blit, no swap
+	MIRROR_EVERY_FRAME, // blit and swap after every SubmitFrame
+	MIRROR_EVERY_NTH,   // only every interval-th frame
+	MIRROR_REDUCED,     // mirror texture at scale of the window, stretched on blit
+	MIRROR_THREAD,      // a second thread owning the window context blits and swaps
+	MIRROR_MODE_COUNT
+};
+
+struct MirrorConfig
+{
+	MirrorMode mode;
+	int        interval; // MIRROR_EVERY_NTH
+	float      scale;    // MIRROR_REDUCED
+
+	MirrorConfig() : mode(MIRROR_EVERY_FRAME), interval(4), scale(0.5f) {}
+};
+
+// Creates the mirror texture for a window of w x h. For MIRROR_THREAD the
+// window's context must not be current on the calling thread any more; the
+// caller renders from a second context that shares objects with it.
+// window may be null (headless), MIRROR_THREAD then falls back to every frame.
+void mirror_init(Compositor* compositor, GLFWwindow* window, int w, int h, const MirrorConfig& config);
+void mirror_shutdown();
+
+// call after SubmitFrame on the render thread
+void mirror_present();
+
+// switch between the render thread modes; MIRROR_THREAD is startup only
+void mirror_set_mode(MirrorMode mode);
+MirrorMode mirror_mode();
+const char* mirror_mode_name(MirrorMode mode);
+
+// the texture the compositor mirrors into, null when off
+const ovrGLTexture* mirror_texture();
+// read framebuffer of that texture on the render thread, 0 when off
+GLuint mirror_framebuffer();
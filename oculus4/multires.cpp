@@ -0,0 +1,177 @@
+#include "multires.h"
+#include "hidden_area.h"
+#include "gpu_resources.h"
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+
+enum { TARGET_PERIPHERY, TARGET_INSET };
+
+struct MultiResEye
+{
+	GLuint fbo[2], color[2];
+	DepthBuffer *depth[2];    // from the gpu_resources pool, as are the framebuffers
+	float  lensX, lensY;      // lens centre in NDC
+	int    viewW, viewH;      // eye viewport this frame
+	int    lowW, lowH;        // periphery target area in use
+	int    insetX, insetY, insetW, insetH; // inset, pixels of the eye viewport
+};
+
+static MultiResConfig cfg;
+static MultiResEye eyes[2];
+
+// the depth texture and framebuffer come from the pools, so a resize picks
+// up the ones the previous size handed back
+static void create_target(int w, int h, GLuint& fbo, GLuint& color, DepthBuffer*& depth)
+{
+	glGenTextures(1, &color);
+	glBindTexture(GL_TEXTURE_2D, color);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
+	glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, w, h, 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+
+	ovrSizei size = { w, h };
+	depth = gpu_depth_acquire(size, GL_DEPTH_COMPONENT24, false);
+
+	gpu_framebuffers_acquire(1, &fbo);
+	glBindFramebuffer(GL_FRAMEBUFFER, fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, color, 0);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depth->texId, 0);
+	GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+	if (status != GL_FRAMEBUFFER_COMPLETE)
+		fprintf(stderr, "Multi-resolution framebuffer incomplete: 0x%x\n", status);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+static float clampf(float v, float lo, float hi)
+{
+	return v < lo ? lo : v > hi ? hi : v;
+}
+
+void multires_init(const ovrSizei size[2], const ovrFovPort fov[2], const MultiResConfig& config)
+{
+	cfg = config;
+	cfg.centre = clampf(cfg.centre, 0.1f, 1.0f);
+	cfg.periphery = clampf(cfg.periphery, 0.1f, 1.0f);
+	for (int e = 0; e < 2; ++e)
+	{
+		MultiResEye& m = eyes[e];
+		memset(&m, 0, sizeof(m));
+		// where the eye's forward direction lands, as in ovrMatrix4f_Projection
+		float sx = 2.0f / (fov[e].LeftTan + fov[e].RightTan);
+		float sy = 2.0f / (fov[e].UpTan + fov[e].DownTan);
+		m.lensX = (fov[e].LeftTan - fov[e].RightTan) * sx * 0.5f;
+		m.lensY = (fov[e].DownTan - fov[e].UpTan) * sy * 0.5f;
+
+		create_target((int)ceilf(size[e].w * cfg.periphery), (int)ceilf(size[e].h * cfg.periphery),
+			m.fbo[TARGET_PERIPHERY], m.color[TARGET_PERIPHERY], m.depth[TARGET_PERIPHERY]);
+		create_target((int)ceilf(size[e].w * cfg.centre) + 1, (int)ceilf(size[e].h * cfg.centre) + 1,
+			m.fbo[TARGET_INSET], m.color[TARGET_INSET], m.depth[TARGET_INSET]);
+	}
+}
+
+void multires_shutdown()
+{
+	for (int e = 0; e < 2; ++e)
+	{
+		MultiResEye& m = eyes[e];
+		if (!m.fbo[0])
+			continue;
+		gpu_framebuffers_release(2, m.fbo);
+		glDeleteTextures(2, m.color);
+		gpu_depth_release(m.depth[0]);
+		gpu_depth_release(m.depth[1]);
+		memset(&m, 0, sizeof(m));
+	}
+}
+
+void multires_begin_frame(const ovrSizei viewport[2], const float proj[][16], float insetProj[][16])
+{
+	for (int e = 0; e < 2; ++e)
+	{
+		MultiResEye& m = eyes[e];
+		m.viewW = viewport[e].w;
+		m.viewH = viewport[e].h;
+		m.lowW = (int)(m.viewW * cfg.periphery + 0.5f);
+		m.lowH = (int)(m.viewH * cfg.periphery + 0.5f);
+		if (m.lowW < 1) m.lowW = 1;
+		if (m.lowH < 1) m.lowH = 1;
+
+		// whole pixels around the lens centre, inside the viewport
+		m.insetW = (int)(m.viewW * cfg.centre + 0.5f);
+		m.insetH = (int)(m.viewH * cfg.centre + 0.5f);
+		float cx = (m.lensX + 1.0f) * 0.5f * m.viewW;
+		float cy = (m.lensY + 1.0f) * 0.5f * m.viewH;
+		m.insetX = (int)clampf(floorf(cx - m.insetW * 0.5f + 0.5f), 0.0f, (float)(m.viewW - m.insetW));
+		m.insetY = (int)clampf(floorf(cy - m.insetH * 0.5f + 0.5f), 0.0f, (float)(m.viewH - m.insetH));
+
+		// narrow the projection to the inset: x' = (2x - (x0 + x1)) / (x1 - x0) in NDC
+		float x0 = 2.0f * m.insetX / m.viewW - 1.0f, x1 = 2.0f * (m.insetX + m.insetW) / m.viewW - 1.0f;
+		float y0 = 2.0f * m.insetY / m.viewH - 1.0f, y1 = 2.0f * (m.insetY + m.insetH) / m.viewH - 1.0f;
+		float ax = 2.0f / (x1 - x0), bx = -(x1 + x0) / (x1 - x0);
+		float ay = 2.0f / (y1 - y0), by = -(y1 + y0) / (y1 - y0);
+		for (int c = 0; c < 4; ++c)
+		{
+			const float *col = proj[e] + c * 4;
+			float *out = insetProj[e] + c * 4;
+			out[0] = ax * col[0] + bx * col[3];
+			out[1] = ay * col[1] + by * col[3];
+			out[2] = col[2];
+			out[3] = col[3];
+		}
+	}
+}
+
+void multires_begin_periphery(int eye)
+{
+	const MultiResEye& m = eyes[eye];
+	glBindFramebuffer(GL_FRAMEBUFFER, m.fbo[TARGET_PERIPHERY]);
+	glViewport(0, 0, m.lowW, m.lowH);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	hidden_area_draw(eye);
+	// the inset covers this part, do not shade it twice; the mask stops two
+	// periphery texels short of the inset edge, so the linear upscale of the
+	// periphery does not blend the cleared color into the seam
+	float px = 2.0f * 2.0f / m.lowW, py = 2.0f * 2.0f / m.lowH;
+	float x0 = 2.0f * m.insetX / m.viewW - 1.0f + px, y0 = 2.0f * m.insetY / m.viewH - 1.0f + py;
+	float x1 = 2.0f * (m.insetX + m.insetW) / m.viewW - 1.0f - px, y1 = 2.0f * (m.insetY + m.insetH) / m.viewH - 1.0f - py;
+	if (x0 < x1 && y0 < y1)
+		hidden_area_draw_rect(x0, y0, x1, y1);
+}
+
+void multires_begin_inset(int eye)
+{
+	const MultiResEye& m = eyes[eye];
+	glBindFramebuffer(GL_FRAMEBUFFER, m.fbo[TARGET_INSET]);
+	glViewport(0, 0, m.insetW, m.insetH);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+}
+
+void multires_composite(int eye, GLuint eyeFbo)
+{
+	const MultiResEye& m = eyes[eye];
+	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, eyeFbo);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m.fbo[TARGET_PERIPHERY]);
+	glBlitFramebuffer(0, 0, m.lowW, m.lowH, 0, 0, m.viewW, m.viewH, GL_COLOR_BUFFER_BIT, GL_LINEAR);
+	glBindFramebuffer(GL_READ_FRAMEBUFFER, m.fbo[TARGET_INSET]);
+	glBlitFramebuffer(0, 0, m.insetW, m.insetH, m.insetX, m.insetY, m.insetX + m.insetW, m.insetY + m.insetH,
+		GL_COLOR_BUFFER_BIT, GL_NEAREST);
+	glBindFramebuffer(GL_FRAMEBUFFER, eyeFbo);
+}
+
+void multires_set_enabled(bool enabled)
+{
+	cfg.enabled = enabled;
+}
+
+bool multires_enabled()
+{
+	return cfg.enabled;
+}
+
+const MultiResConfig& multires_config()
+{
+	return cfg;
+}
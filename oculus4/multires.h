@@ -0,0 +1,38 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <OVR_CAPI.h>
+
+// Multi-resolution eye rendering. Each eye is drawn twice: the whole FOV
+// into a target at periphery scale, with the inset masked out in depth, and
+// an inset around the lens centre at full rate through an off-centre
+// projection. multires_composite() stretches the first over the eye
+// viewport and copies the inset on top, so the periphery is shaded at
+// periphery^2 of the pixel rate. Two-pass rendering only.
+struct MultiResConfig
+{
+	bool  enabled;
+	float centre;    // fraction of the eye viewport width and height kept at full rate
+	float periphery; // resolution scale of everything else
+
+	MultiResConfig() : enabled(false), centre(0.5f), periphery(0.5f) {}
+};
+
+// targets for eye buffers of up to size[eye], needs a current GL context and
+// gpu_resources_init(); multires_shutdown() before gpu_resources_shutdown()
+void multires_init(const ovrSizei size[2], const ovrFovPort fov[2], const MultiResConfig& config);
+void multires_shutdown();
+
+// Lays the regions out in this frame's eye viewports and builds the inset
+// projections from the eye projections (column-major).
+void multires_begin_frame(const ovrSizei viewport[2], const float proj[][16], float insetProj[][16]);
+// bind, clear and mask the periphery target of an eye; draw with the eye projection
+void multires_begin_periphery(int eye);
+// bind and clear the inset target of an eye; draw with the inset projection
+void multires_begin_inset(int eye);
+// both into the eye's framebuffer, leaves it bound
+void multires_composite(int eye, GLuint eyeFbo);
+
+void multires_set_enabled(bool enabled);
+bool multires_enabled();
+const MultiResConfig& multires_config();
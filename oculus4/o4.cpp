@@ -1,35 +1,202 @@
 #include "o4.h"
 
-void main(int argc, char **argv){
-	init();
+#ifdef O4_HEADLESS
+// Headless build: render a fixed number of frames offscreen and report frame times.
+int main(int argc, char **argv){
+	int frames = 1000;
+	frame_sched.enabled = false; // as fast as possible unless asked
+	reproject_cfg.enabled = false; // every frame rendered, for comparable timings
+	for (int i = 1; i < argc; ++i){
+		if (!strcmp(argv[i], "--throttle"))
+			headless.throttle = true;
+		else if (!strcmp(argv[i], "--pace"))
+			frame_sched.enabled = true;
+		else if (!strcmp(argv[i], "--hud"))
+			hud_visible = true;
+		else if (!strcmp(argv[i], "--stereo"))
+			single_pass_stereo = true;
+		else if (!strcmp(argv[i], "--fixed-res"))
+			res_ctrl.enabled = false;
+		else if (!strcmp(argv[i], "--pixel-density") && i + 1 < argc)
+			pixel_density = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--lose-session") && i + 1 < argc)
+			headless.loseSessionFrame = atoll(argv[++i]);
+		else if (!strcmp(argv[i], "--no-cull"))
+			frustum_culling = false;
+		else if (!strcmp(argv[i], "--no-sort"))
+			sorted_draws = false;
+		else if (!strcmp(argv[i], "--animate"))
+			animate_scene = true;
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			job_threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--reproject"))
+			reproject_cfg.enabled = true;
+		else if (!strcmp(argv[i], "--no-hidden-area"))
+			hidden_area_set_enabled(false);
+		else if (!strcmp(argv[i], "--multires"))
+			multires_cfg.enabled = true;
+		else if (!strcmp(argv[i], "--multires-centre") && i + 1 < argc)
+			multires_cfg.centre = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--multires-scale") && i + 1 < argc)
+			multires_cfg.periphery = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--objects") && i + 1 < argc)
+			bench_objects = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--textures") && i + 1 < argc)
+			bench_textures = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--scale") && i + 1 < argc){
+			// fixed fraction of the eye buffers, the adaptive controller is off
+			float s = (float)atof(argv[++i]);
+			res_ctrl.enabled = false;
+			res_ctrl.maxScale = s > 0.1f && s < 1.0f ? s : 1.0f;
+		}
+		else if (!strcmp(argv[i], "--bench")){
+			bench_output = true;
+			trace_path = NULL;
+		}
+		else if (!strcmp(argv[i], "--trace") && i + 1 < argc)
+			trace_path = argv[++i];
+		else if (!strcmp(argv[i], "--record-tracking") && i + 1 < argc)
+			tracking_record_path = argv[++i];
+		else if (!strcmp(argv[i], "--replay-tracking") && i + 1 < argc)
+			tracking_replay_path = argv[++i];
+		else if (!strcmp(argv[i], "--pose-math") && i + 1 < argc){
+			++i;
+			for (int p = 0; p < POSE_MATH_PATH_COUNT; ++p)
+				if (!strcmp(argv[i], pose_math_path_name((PoseMathPath)p)))
+					pose_math_set_path((PoseMathPath)p);
+		}
+		else if (!strcmp(argv[i], "--bench-math") && i + 1 < argc){
+			// no rendering, just the kernels
+			int n = atoi(argv[++i]);
+			bench_pose_math(n > 0 ? n : 4096);
+			return 0;
+		}
+		else if (!strcmp(argv[i], "--capture") && i + 1 < argc)
+			capture_prefix = argv[++i];
+		else if (!strcmp(argv[i], "--capture-video") && i + 1 < argc)
+			capture_video_path = argv[++i];
+		else if (!strcmp(argv[i], "--golden") && i + 1 < argc)
+			golden_dir = argv[++i];
+		else if (!strcmp(argv[i], "--capture-every") && i + 1 < argc)
+			capture_cfg.interval = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--capture-mirror"))
+			capture_cfg.sources |= 1 << CAPTURE_MIRROR;
+		else if (!strcmp(argv[i], "--texture") && i + 1 < argc)
+			room_texture_path = argv[++i];
+		else if (!strcmp(argv[i], "--scene") && i + 1 < argc)
+			scene_path = argv[++i];
+		else if (!strcmp(argv[i], "--mirror") && i + 1 < argc){
+			++i;
+			if (!strcmp(argv[i], "off"))
+				mirror_cfg.mode = MIRROR_OFF;
+			else if (!strcmp(argv[i], "nth"))
+				mirror_cfg.mode = MIRROR_EVERY_NTH;
+			else if (!strcmp(argv[i], "reduced"))
+				mirror_cfg.mode = MIRROR_REDUCED;
+			else
+				mirror_cfg.mode = MIRROR_EVERY_FRAME;
+		}
+		else
+			frames = atoi(argv[i]);
+	}
+	if (frames < 1)
+		frames = 1;
+	compositor = create_headless_compositor(headless);
+	if (!init())
+		return EXIT_FAILURE;
+
+	double *frame_ms = (double*)malloc(frames * sizeof(double));
+	double total = 0, worst = 0, best = 1e9;
+	for (int i = 0; i < frames; ++i){
+		frame_index = frame_sched.WaitForFrame(compositor);
+		double t0 = ovr_GetTimeInSeconds();
+		stats_begin_frame();
+		rendering_loop();
+		stats_end_frame();
+		glFinish();
+		frame_ms[i] = (ovr_GetTimeInSeconds() - t0) * 1000.0;
+		total += frame_ms[i];
+		if (frame_ms[i] > worst) worst = frame_ms[i];
+		if (frame_ms[i] < best) best = frame_ms[i];
+		// a replayed trace ends the run
+		if (!tracking_trace_end_frame()){
+			frames = i + 1;
+			break;
+		}
+	}
+	printf("headless: %d frames, avg %.3f ms, min %.3f ms, max %.3f ms\n", frames, total / frames, best, worst);
+	free(frame_ms);
+	int bench_threads = job_system_threads();
+	shutdowm();
+	if (golden_dir)
+		printf("golden: %d images compared, %d failed, %d recorded\n", golden.compared.load(), golden.failed.load(), golden.recorded.load());
+
+	FrameSummary sum;
+	if (bench_output && stats_summarize(frames / 10, sum))
+		printf("bench {\"objects\":%d,\"textures\":%d,\"scale\":%.2f,\"stereo\":%d,\"multires\":%d,\"sorted\":%d,"
+			"\"threads\":%d,\"animate\":%d,\"frames\":%d,"
+			"\"cpu_ms_p50\":%.4f,\"cpu_ms_p95\":%.4f,\"gpu_ms_p50\":%.4f,\"gpu_ms_p95\":%.4f,"
+			"\"draw_calls\":%.0f,\"state_changes\":%.0f}\n",
+			bench_objects, bench_textures, res_ctrl.enabled ? 1.0f : res_ctrl.maxScale, single_pass_stereo ? 1 : 0,
+			multires_enabled() && !single_pass_stereo ? 1 : 0, sorted_draws ? 1 : 0, bench_threads, animate_scene ? 1 : 0, sum.frames,
+			sum.cpu_p50, sum.cpu_p95, sum.gpu_p50, sum.gpu_p95, sum.draw_calls, sum.state_changes);
+	return golden.failed ? EXIT_FAILURE : 0;
+}
+#else
+int main(int argc, char **argv){
+	for (int i = 1; i < argc; ++i){
+		if (!strcmp(argv[i], "--mirror-thread"))
+			mirror_cfg.mode = MIRROR_THREAD;
+		else if (!strcmp(argv[i], "--pixel-density") && i + 1 < argc)
+			pixel_density = (float)atof(argv[++i]);
+		else if (!strcmp(argv[i], "--texture") && i + 1 < argc)
+			room_texture_path = argv[++i];
+		else if (!strcmp(argv[i], "--scene") && i + 1 < argc)
+			scene_path = argv[++i];
+		else if (!strcmp(argv[i], "--record-tracking") && i + 1 < argc)
+			tracking_record_path = argv[++i];
+		else if (!strcmp(argv[i], "--replay-tracking") && i + 1 < argc)
+			tracking_replay_path = argv[++i];
+		else if (!strcmp(argv[i], "--capture") && i + 1 < argc)
+			capture_prefix = argv[++i];
+		else if (!strcmp(argv[i], "--capture-video") && i + 1 < argc)
+			capture_video_path = argv[++i];
+		else if (!strcmp(argv[i], "--threads") && i + 1 < argc)
+			job_threads = atoi(argv[++i]);
+		else if (!strcmp(argv[i], "--animate"))
+			animate_scene = true;
+	}
+	compositor = create_ovr_compositor();
+	if (!init())
+		return EXIT_FAILURE;
 	glfwSetKeyCallback(window, key_callback);
 	while (!glfwWindowShouldClose(window)){
+		frame_index = frame_sched.WaitForFrame(compositor);
+		stats_begin_frame();
 		glfwPollEvents();
 		rendering_loop();
-
-
-		glfwSwapBuffers(window);
+		stats_end_frame();
+		tracking_trace_end_frame();
 	}
 	//system("pause");
+	shutdowm();
+	return 0;
 }
+#endif
 
 int init(){
+#if defined(_WIN32)
+	// 1 ms sleeps for the tracking sampler and frame pacing, not 15.6 ms ones
+	timeBeginPeriod(1);
+#endif
 	//LibOVR needs to be initialized before GLFW
-	result = ovr_Initialize(nullptr);
-	if (!OVR_SUCCESS(result)){
-		fprintf(stderr, "Failed to initialize libOVR.\n");
-		return 0;
-	}
-
-	//virtual HMD could be enabled through RiftConfigUtil
-	result = ovr_Create(&session, &luid);
+	result = compositor->Initialize();
 	if (OVR_FAILURE(result)){
-		fprintf(stderr, "Failed to create the HMD.\n");
-		ovr_Shutdown();
+		fprintf(stderr, "Failed to initialize libOVR and create the HMD.\n");
 		return 0;
 	}
 
-	desc = ovr_GetHmdDesc(session);
+	desc = compositor->GetHmdDesc();
 	resolution = desc.Resolution;
 	printf("Resolution HMD: %d(w) - %d(h)\n", resolution.w, resolution.h);
 	printf("aaaaaaaaaaaaaaaa initialized HMD: %s - %s\n", desc.Manufacturer, desc.ProductName);
@@ -38,13 +205,25 @@ int init(){
 	float frustomHorizontalFOV = desc.CameraFrustumHFovInRadians;
 
 	// Query the HMD for ts current tracking state.
-	ts = ovr_GetTrackingState(session, ovr_GetTimeInSeconds(), ovrTrue);
+	ts = compositor->GetTrackingState(ovr_GetTimeInSeconds());
 
 	//includes full six degrees of freedom (6DoF) head tracking data including orientation, position, and their first and second derivatives.
 	if (ts.StatusFlags & (ovrStatus_OrientationTracked | ovrStatus_PositionTracked)){
 	pose = ts.HeadPose;
 	}	
 	
+#ifdef O4_HEADLESS
+	//offscreen Mesa context stands in for the mirror window
+	osmesa = OSMesaCreateContextExt(OSMESA_RGBA, 24, 8, 0, NULL);
+	osmesa_buffer = (unsigned char*)malloc((resolution.w / 2) * (resolution.h / 2) * 4);
+	if (!osmesa || !OSMesaMakeCurrent(osmesa, osmesa_buffer, GL_UNSIGNED_BYTE, resolution.w / 2, resolution.h / 2)){
+		fprintf(stderr, "Failed to create the OSMesa context.\n");
+		exit(EXIT_FAILURE);
+	}
+	else
+		printf("osmesa context created\n");
+	glewInit();//glew has to be built with GLEW_OSMESA
+#else
 #pragma region glfw
 
 	//create a glfw window
@@ -60,62 +239,45 @@ int init(){
 	}
 	else
 		printf("glfw created window\n");
-	glfwMakeContextCurrent(window);
+	render_window = window;
+	if (mirror_cfg.mode == MIRROR_THREAD){
+		// the mirror thread owns the visible window, we render in a hidden one sharing its objects
+		glfwWindowHint(GLFW_VISIBLE, GL_FALSE);
+		render_window = glfwCreateWindow(16, 16, "Oculus render", NULL, window);
+		glfwWindowHint(GLFW_VISIBLE, GL_TRUE);
+		if (!render_window){
+			fprintf(stderr, "Failed to create the render context, mirroring on the render thread.\n");
+			render_window = window;
+			mirror_cfg.mode = MIRROR_EVERY_FRAME;
+		}
+	}
+	glfwMakeContextCurrent(render_window);
 	glewInit();//donnot forget!!
 	glfwSwapInterval(0);
 
 #pragma endregion initialize glfw
+#endif
 
 	// Configure Stereo settings.
-	recommenedTex0Size = ovr_GetFovTextureSize(session, ovrEye_Left,
-		desc.DefaultEyeFov[0], 1.0f);
-	recommenedTex1Size = ovr_GetFovTextureSize(session, ovrEye_Right,
-		desc.DefaultEyeFov[1], 1.0f);
-	
 	//application should call glEnable(GL_FRAMEBUFFER_SRGB) before rendering into these textures.
+	gpu_resources_init(compositor);
+	create_eye_targets();
 
-	// Make eye render buffers
-	for (int eye = 0; eye < 2; ++eye)
-	{
-		ovrSizei idealTextureSize = ovr_GetFovTextureSize(session, ovrEyeType(eye), desc.DefaultEyeFov[eye], 1);
-		//eyeRenderTexture[eye] = new TextureBuffer(HMD, true, true, idealTextureSize, 1, NULL, 1);
-		if (ovr_CreateSwapTextureSetGL(session, GL_SRGB8_ALPHA8, idealTextureSize.w, idealTextureSize.h, pTextureSet+eye) == ovrSuccess){
-			for (int it = 0; it < pTextureSet[eye]->TextureCount; ++it){
-				tex = (ovrGLTexture*)&pTextureSet[eye]->Textures[it];
-				glBindTexture(GL_TEXTURE_2D, tex->OGL.TexId);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			}
-		}
-		glGenFramebuffers(1, &fbo[eye]);
-		//eyeDepthBuffer[eye] = new DepthBuffer(eyeRenderTexture[eye]->GetSize(), 0);
-		glGenTextures(1, &fb_depth[eye]);
-		glBindTexture(GL_TEXTURE_2D, fb_depth[eye]);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-		glTexImage2D(GL_TEXTURE_2D, 0, GL_DEPTH_COMPONENT24, idealTextureSize.w, idealTextureSize.h, 0, GL_DEPTH_COMPONENT, GL_UNSIGNED_INT, NULL);
-	}
+	// periphery and inset targets, also when off so it can be switched on later
+	ovrSizei eyeSizes[2] = { recommenedTex0Size, recommenedTex1Size };
+	multires_init(eyeSizes, desc.DefaultEyeFov, multires_cfg);
+	reproject_init(reproject_cfg);
 
 	// Create mirror texture and an FBO used to copy mirror texture to back buffer
-	result = ovr_CreateMirrorTextureGL(session, GL_SRGB8_ALPHA8, resolution.w*0.5, resolution.h*0.5, reinterpret_cast<ovrTexture**>(&mirrorTexture));
-	if (!OVR_SUCCESS(result)){		
-		fprintf(stderr, "Failed to create mirror texture.");
-	}
-
-	// Configure the mirror read buffer
-	glGenFramebuffers(1, &mirrorFBO);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFBO);
-	glFramebufferTexture2D(GL_READ_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, mirrorTexture->OGL.TexId, 0);
-	glFramebufferRenderbuffer(GL_READ_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, 0);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+#ifdef O4_HEADLESS
+	mirror_init(compositor, NULL, resolution.w / 2, resolution.h / 2, mirror_cfg);
+#else
+	mirror_init(compositor, window, resolution.w / 2, resolution.h / 2, mirror_cfg);
+#endif
+	start_capture();
 	
-	eyeRenderDesc[0] = ovr_GetRenderDesc(session, ovrEye_Left, desc.DefaultEyeFov[0]);
-	eyeRenderDesc[1] = ovr_GetRenderDesc(session, ovrEye_Right, desc.DefaultEyeFov[1]);
+	eyeRenderDesc[0] = compositor->GetRenderDesc(ovrEye_Left, desc.DefaultEyeFov[0]);
+	eyeRenderDesc[1] = compositor->GetRenderDesc(ovrEye_Right, desc.DefaultEyeFov[1]);
 	hmdToEyeViewOffset[0] = eyeRenderDesc[0].HmdToEyeViewOffset;
 	hmdToEyeViewOffset[1] = eyeRenderDesc[1].HmdToEyeViewOffset;
 
@@ -129,83 +291,422 @@ int init(){
 	
 	glEnable(GL_DEPTH_TEST);
 	glEnable(GL_CULL_FACE);
-	glEnable(GL_LIGHTING);
-	glEnable(GL_LIGHT0);
-	glEnable(GL_LIGHT1);
-	glEnable(GL_NORMALIZE);
-	float V[] = { 1, 1, 1, 1 };
-	glLightModelfv(GL_LIGHT_MODEL_AMBIENT, V);
-	glEnable(GL_COLOR_MATERIAL);
+	// lighting is done by the instancing shaders from the per-frame uniform block
 
 	glClearColor(1, 1, 1, 1);
 	chess_tex = gen_chess_tex(1.0, 0.7, 0.4, 0.4, 0.7, 1.0);
+	mesh_init();
+	instanced_init();
+	hidden_area_init(compositor, desc.DefaultEyeFov);
+	job_system_init(job_threads);
+	build_scene_instances();
+	quad_layers_init(compositor);
+	create_hud();
+	texture_stream_init(TextureStreamConfig(), chess_tex);
+	if (room_texture_path)
+		room_tex = texture_stream_load(room_texture_path);
+	if (scene_path)
+		scene = scene_load(scene_path);
+	stats_init(5.0);
+	res_ctrl.SetRefreshRate(desc.DisplayRefreshRate);
+	frame_sched.SetRefreshRate(desc.DisplayRefreshRate);
+	// a replay needs no sampler thread, its poses come from the trace
+	if (tracking_replay_path && !tracking_trace_open(tracking_replay_path, true))
+		return 0;
+	if (tracking_record_path && !tracking_replay_path)
+		tracking_trace_open(tracking_record_path, false);
+	tracking_start(compositor, tracking_trace_replaying() ? 0.0 : 0.001);
 
+	return 1;
+}
+
+static ovrSizei stereo_size(){
+	ovrSizei size;
+	size.w = recommenedTex0Size.w + recommenedTex1Size.w;
+	size.h = recommenedTex0Size.h > recommenedTex1Size.h ? recommenedTex0Size.h : recommenedTex1Size.h;
+	return size;
+}
+
+// Eye render targets at pixel_density, or the existing ones resized to it.
+// The eyes share one depth texture when their sizes match, unless
+// reprojection has to keep the depth of each. False when a swap set could
+// not be created; targets without one get another try on the next call.
+bool create_eye_targets(){
+	recommenedTex0Size = compositor->GetFovTextureSize(ovrEye_Left, desc.DefaultEyeFov[0], pixel_density);
+	recommenedTex1Size = compositor->GetFovTextureSize(ovrEye_Right, desc.DefaultEyeFov[1], pixel_density);
+	ovrSizei sizes[2] = { recommenedTex0Size, recommenedTex1Size };
+	bool complete = true;
+	for (int eye = 0; eye < 2; ++eye){
+		if (eye_targets[eye])
+			complete = eye_targets[eye]->Resize(sizes[eye]) && complete;
+		else{
+			eye_targets[eye] = new TextureBuffer(sizes[eye], GL_DEPTH_COMPONENT24, !reproject_cfg.enabled);
+			complete = eye_targets[eye]->Valid() && complete;
+		}
+	}
+	if (stereo_target)
+		complete = stereo_target->Resize(stereo_size()) && complete;
+	target_density = pixel_density;
+	return complete;
+}
+
+// A new pixel density, within the frame: new swap sets in place, with the
+// framebuffer names kept and depth textures from the pool. The
+// multi-resolution targets follow the eye size.
+void resize_eye_targets(){
+	double start = ovr_GetTimeInSeconds();
+	float previous = target_density;
+	MultiResConfig mr = multires_config();
+	if (!create_eye_targets()){
+		fprintf(stderr, "No eye buffers at pixel density %.2f, back to %.2f.\n", pixel_density, previous);
+		pixel_density = previous;
+		create_eye_targets();
+	}
+	ovrSizei sizes[2] = { recommenedTex0Size, recommenedTex1Size };
+	multires_shutdown();
+	multires_init(sizes, desc.DefaultEyeFov, mr);
+	reproject_invalidate();
+	printf("eye buffers %dx%d and %dx%d at pixel density %.2f, %.1f ms\n", sizes[0].w, sizes[0].h, sizes[1].w, sizes[1].h,
+		pixel_density, (ovr_GetTimeInSeconds() - start) * 1000.0);
+}
+
+// Side-by-side swap texture set that both eyes render into in one pass.
+void init_stereo_target(){
+	stereo_target = new TextureBuffer(stereo_size(), GL_DEPTH_COMPONENT24, false);
+	if (!stereo_target->Valid()){
+		fprintf(stderr, "Failed to create the stereo texture set, staying in two-pass mode.\n");
+		delete stereo_target;
+		stereo_target = nullptr;
+		single_pass_stereo = false;
+	}
+}
+
+// The runtime lost the display (HMD unplugged, service restarted) and every
+// swap texture set went with the session. Tracking and the mirror stop
+// until recover_session() has a new one.
+void lose_session(){
+	fprintf(stderr, "Display lost, waiting for a new session.\n");
+	tracking_stop();
+	mirror_shutdown();
+	session_lost = true;
+	session_retry = 0;
+}
+
+// Eye, stereo and quad layer targets get new swap sets on the new session
+// in place, with their framebuffers and depth textures kept; the scene,
+// shaders and textures stay as they are. Tried at most once a second.
+bool recover_session(){
+	double now = ovr_GetTimeInSeconds();
+	if (now < session_retry)
+		return false;
+	session_retry = now + 1.0;
+	if (!gpu_resources_recreate_session())
+		return false;
+	MirrorConfig mirror_now = mirror_cfg;
+	mirror_now.mode = mirror_mode();
+#ifdef O4_HEADLESS
+	mirror_init(compositor, NULL, resolution.w / 2, resolution.h / 2, mirror_now);
+#else
+	mirror_init(compositor, window, resolution.w / 2, resolution.h / 2, mirror_now);
+#endif
+	tracking_start(compositor, tracking_trace_replaying() ? 0.0 : 0.001);
+	reproject_invalidate();
+	session_lost = false;
+	isVisible = true;
+	GpuResourceStats gpu;
+	gpu_resources_get_stats(gpu);
+	printf("session recreated, swap sets replaced in %.1f ms\n", gpu.lastRecreateMs);
+	return true;
+}
+
+// one bar per recent frame interval, green within the refresh interval and
+// red past it; the line across the middle is the interval
+static void draw_hud(int w, int h, void* user){
+	float budget = 1000.0f / desc.DisplayRefreshRate;
+	float bar_w = (float)w / HUD_FRAMES;
+	glClearColor(0.02f, 0.02f, 0.03f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glEnable(GL_SCISSOR_TEST);
+	for (int i = 0; i < HUD_FRAMES; ++i){
+		float ms = hud_ms[(hud_next + i) % HUD_FRAMES];
+		int bar_h = (int)(ms / (2.0f * budget) * h);
+		if (bar_h > h) bar_h = h;
+		if (bar_h < 1) continue;
+		glScissor((int)(i * bar_w), 0, bar_w > 2 ? (int)bar_w - 1 : 1, bar_h);
+		if (ms > budget) glClearColor(0.8f, 0.1f, 0.1f, 1.0f);
+		else glClearColor(0.1f, 0.7f, 0.2f, 1.0f);
+		glClear(GL_COLOR_BUFFER_BIT);
+	}
+	glScissor(0, h / 2, w, 2);
+	glClearColor(0.8f, 0.8f, 0.8f, 1.0f);
+	glClear(GL_COLOR_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+	glClearColor(1, 1, 1, 1);
+}
+
+void create_hud(){
+	QuadLayerDesc hud;
+	hud.width = 512;
+	hud.height = 128;
+	hud.headLocked = true;
+	hud.pose.Position.y = -0.3f;
+	hud.pose.Position.z = -1.0f;
+	hud.size.x = 0.4f;
+	hud.size.y = 0.1f;
+	hud.interval = 9;
+	hud.draw = draw_hud;
+	hud_layer = quad_layer_create(hud);
+	quad_layer_set_visible(hud_layer, hud_visible);
+}
+
+// Readback of the eye buffers and the mirror, to one sink: golden image
+// comparison, a PPM stream or a PPM file per image.
+void start_capture(){
+	if (golden_dir){
+		golden.dir = golden_dir;
+		capture_init(capture_cfg, capture_golden_sink, &golden);
+	}
+	else if (capture_video_path){
+		capture_video = fopen(capture_video_path, "wb");
+		if (!capture_video){
+			fprintf(stderr, "Failed to open %s for capture.\n", capture_video_path);
+			return;
+		}
+		// a video has one image size: the mirror, or the eye buffer(s) holding the left eye
+		capture_cfg.sources = mirror_texture() ? 1 << CAPTURE_MIRROR : 1 << CAPTURE_LEFT | 1 << CAPTURE_STEREO;
+		capture_init(capture_cfg, capture_stream_sink, capture_video);
+	}
+	else if (capture_prefix)
+		capture_init(capture_cfg, capture_ppm_sink, (void*)capture_prefix);
+}
+
+// Re-read the newest predicted head pose and rebuild the view matrix of one
+// eye, or of both when eye < 0. Called as late as possible before drawing.
+void latch_eye_poses(int eye, float eye_height, float view_mat[][16]){
+	TrackedPose latest;
+	ovrPosef eyePoses[2];
+	tracking_latest(latest);
+	tracking_trace_pose(latest);
+	latched_head = latest.state.HeadPose.ThePose;
+	ovr_CalcEyePoses(latched_head, hmdToEyeViewOffset, eyePoses);
+	// view = translate(eye offset) * rotation * translate(-eye position - eye height)
+	int first = eye < 0 ? 0 : eye, count = eye < 0 ? 2 : 1;
+	ovrVector3f height = { 0, eye_height, 0 };
+	pose_view_matrices(eyePoses + first, count, hmdToEyeViewOffset + first, height, NULL, view_mat + first, NULL);
+	for (int e = first; e < first + count; ++e)
+		layer.RenderPose[e] = eyePoses[e];
+	// the layer has a single sample time, keep the one of the left (older) eye
+	if (eye <= 0)
+		layer.SensorSampleTime = latest.sampleTime;
 }
 
 void rendering_loop(){
 
 	ovrMatrix4f proj;
-	float rot_mat[16];
+	float view_mat[2][16], proj_mat[2][16];
+
+	// nothing to render into until there is a session again
+	if (session_lost && !recover_session())
+		return;
+	if (target_density != pixel_density)
+		resize_eye_targets();
+	// a target left without a swap set has nothing to draw into or submit;
+	// the eyes wait for one, single-pass falls back to two passes
+	if (stereo_target && !stereo_target->Valid()){
+		fprintf(stderr, "Lost the stereo texture set, staying in two-pass mode.\n");
+		delete stereo_target;
+		stereo_target = nullptr;
+		single_pass_stereo = false;
+	}
+	if ((!eye_targets[0]->Valid() || !eye_targets[1]->Valid()) && !create_eye_targets())
+		return;
 	
 	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
 	glClearColor(1, 1, 1, 1);
 	glEnable(GL_FRAMEBUFFER_SRGB);
+	/* move the camera to the eye level of the user */
+	float eye_height = compositor->GetFloat(OVR_KEY_EYE_HEIGHT, 1.65);
+
 	// Get both eye poses simultaneously, with IPD offset already included.
-	double displayMidpointSeconds = ovr_GetPredictedDisplayTime(session, 0);
-	double sensorSampleTime = ovr_GetTimeInSeconds();
-	ovrTrackingState hmdState = ovr_GetTrackingState(session, displayMidpointSeconds, ovrTrue);
-	ovr_CalcEyePoses(hmdState.HeadPose.ThePose, hmdToEyeViewOffset, layer.RenderPose);
-	layer.SensorSampleTime = sensorSampleTime;
+	// The tracking thread predicts for this display time from now on; the
+	// poses are latched again right before each eye is drawn.
+	stats_begin(STAGE_POSE);
+	double displayMidpointSeconds = compositor->GetPredictedDisplayTime(frame_index);
+	tracking_trace_display_time(displayMidpointSeconds);
+	tracking_set_display_time(displayMidpointSeconds);
+	latch_eye_poses(-1, eye_height, view_mat);
+	stats_end(STAGE_POSE);
+
+	// finish decoded textures a few rows at a time, the chess pattern stands in meanwhile
+	stats_begin(STAGE_STREAM);
+	texture_stream_update();
+	if (room_tex >= 0)
+		room_box->texture = texture_stream_get(room_tex);
+	stats_end(STAGE_STREAM);
+
+	// shrink or grow the rendered part of the eye buffers to stay inside the GPU budget
+	float render_gpu_ms = -1.0f;
+	if (stats_render_gpu_ms(render_gpu_ms) && res_ctrl.AddSample(render_gpu_ms))
+		printf("eye buffer scale %.2f (gpu %.2f ms, budget %.2f ms)\n", res_ctrl.scale, render_gpu_ms, res_ctrl.budgetMs);
+	res_ctrl.Apply(recommenedTex0Size.w, recommenedTex0Size.h, eyeViewport[0].w, eyeViewport[0].h);
+	res_ctrl.Apply(recommenedTex1Size.w, recommenedTex1Size.h, eyeViewport[1].w, eyeViewport[1].h);
+
+	for (int eye = 0; eye < 2; ++eye){
+		proj = ovrMatrix4f_Projection(desc.DefaultEyeFov[eye], 0.5, 500.0, 1);
+		for (int i = 0; i < 4; ++i)
+			for (int j = 0; j < 4; ++j)
+				proj_mat[eye][j * 4 + i] = proj.M[i][j];
+	}
+
+	if (single_pass_stereo && !stereo_target)
+		init_stereo_target();
+
+	// both eyes squeezed side by side into the stereo target
+	int stereo_w = eyeViewport[0].w + eyeViewport[1].w;
+	float s0 = (float)eyeViewport[0].w / stereo_w;
+	float s1 = (float)eyeViewport[1].w / stereo_w;
+	float eye_scale_offset[2][2] = {
+		{ s0, s0 - 1.0f },
+		{ s1, 1.0f - s1 }
+	};
+	// periphery and full rate inset of each eye, two-pass only
+	bool multires = multires_enabled() && !single_pass_stereo;
+	float inset_proj[2][16];
+	if (multires)
+		multires_begin_frame(eyeViewport, proj_mat, inset_proj);
 
-	if (isVisible){
+	// a frame that would miss its deadline, or that is not shown anyway,
+	// warps the last rendered images to the newest pose instead
+	const ovrSwapTextureSet *frame_sets[2] = {
+		single_pass_stereo ? stereo_target->TextureSet : eye_targets[0]->TextureSet,
+		single_pass_stereo ? stereo_target->TextureSet : eye_targets[1]->TextureSet
+	};
+	bool reprojected = reproject_decide(frame_sets, frame_sched.PredictMiss(), isVisible != 0);
+	ovrRecti reprojected_viewport[2];
+	if (reprojected){
+		stats_begin(STAGE_REPROJECT);
+		latch_eye_poses(-1, eye_height, view_mat);
+		reproject_begin_frame();
+		for (int eye = 0; eye < 2; ++eye)
+			reproject_eye(eye, view_mat[eye], proj_mat[eye], reprojected_viewport[eye]);
+		reproject_end_frame();
+		stats_end(STAGE_REPROJECT);
+	}
+	else{
+		// everything the shaders share this frame, in one uniform block write
+		instanced_begin_frame(view_mat, proj_mat, multires ? inset_proj : NULL, single_pass_stereo ? eye_scale_offset : NULL, eye_height);
+
+		// one culling pass against a frustum around both eyes, the survivors are drawn by either eye path
+		stats_begin(STAGE_CULL);
+		cull_scene(eye_height);
+		if (sorted_draws)
+			build_render_queue();
+		stats_end(STAGE_CULL);
+	}
+
+	if (!reprojected && isVisible && single_pass_stereo){
+		// both eyes in one submission, side by side in one shared texture set
+		stats_begin(STAGE_STEREO);
+		ovrSwapTextureSet *stereo_set = stereo_target->TextureSet;
+		stereo_set->CurrentIndex = (stereo_set->CurrentIndex + 1) % stereo_set->TextureCount;
+		glBindFramebuffer(GL_FRAMEBUFFER, stereo_target->Framebuffer());
+
+		glViewport(0, 0, stereo_w, eyeViewport[0].h > eyeViewport[1].h ? eyeViewport[0].h : eyeViewport[1].h);
+		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+		glViewport(0, 0, eyeViewport[0].w, eyeViewport[0].h);
+		hidden_area_draw(0);
+		glViewport(eyeViewport[0].w, 0, eyeViewport[1].w, eyeViewport[1].h);
+		hidden_area_draw(1);
+		glViewport(0, 0, stereo_w, eyeViewport[0].h > eyeViewport[1].h ? eyeViewport[0].h : eyeViewport[1].h);
+
+		latch_eye_poses(-1, eye_height, view_mat);
+		instanced_latch_view(0, view_mat[0]);
+		instanced_latch_view(1, view_mat[1]);
+		instanced_set_eye(-1, false);
+
+		draw_scene();
+		stats_end(STAGE_STEREO);
+		reproject_store(0, stereo_set, stereo_target->DepthTexture(), Recti(eyeViewport[0]), view_mat[0], proj_mat[0]);
+		reproject_store(1, stereo_set, stereo_target->DepthTexture(), Recti(eyeViewport[0].w, 0, eyeViewport[1].w, eyeViewport[1].h),
+			view_mat[1], proj_mat[1]);
+		capture_read(CAPTURE_STEREO, stereo_target->Framebuffer(), stereo_w,
+			eyeViewport[0].h > eyeViewport[1].h ? eyeViewport[0].h : eyeViewport[1].h);
+	}
+	else if (!reprojected && isVisible){
 		for (int eye = 0; eye < 2; ++eye){
+			FrameStage stage = eye == 0 ? STAGE_EYE_LEFT : STAGE_EYE_RIGHT;
+			stats_begin(stage);
 			// Increment to use next texture, just before writing
-			pTextureSet[eye]->CurrentIndex = (pTextureSet[eye]->CurrentIndex + 1) % pTextureSet[eye]->TextureCount;
+			ovrSwapTextureSet *eye_set = eye_targets[eye]->TextureSet;
+			eye_set->CurrentIndex = (eye_set->CurrentIndex + 1) % eye_set->TextureCount;
 
 			// Switch to eye render target
 			//eyeRenderTexture[eye]->SetAndClearRenderSurface(eyeDepthBuffer[eye]);
-			auto texl = reinterpret_cast<ovrGLTexture*>(&pTextureSet[eye]->Textures[pTextureSet[eye]->CurrentIndex]);
-
-			glBindFramebuffer(GL_FRAMEBUFFER, fbo[eye]);
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, texl->OGL.TexId, 0);
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, fb_depth[eye], 0);
-
-			glViewport(0, 0, eye == 0 ? recommenedTex0Size.w : recommenedTex1Size.w, eye == 0 ? recommenedTex0Size.h : recommenedTex1Size.h);
-			glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-
-			proj = ovrMatrix4f_Projection(desc.DefaultEyeFov[eye], 0.5, 500.0, 1);
-			glMatrixMode(GL_PROJECTION);
-			glLoadTransposeMatrixf(proj.M[0]);
-			
-			glMatrixMode(GL_MODELVIEW);
-			glLoadIdentity();
-			glTranslatef(hmdToEyeViewOffset[eye].x,
-				hmdToEyeViewOffset[eye].y,
-				hmdToEyeViewOffset[eye].z);
-			quat_to_matrix(&layer.RenderPose[eye].Orientation.x, rot_mat);
-			glMultMatrixf(rot_mat);
-			/* translate the view matrix with the positional tracking */
-			glTranslatef(-layer.RenderPose[eye].Position.x, -layer.RenderPose[eye].Position.y, -layer.RenderPose[eye].Position.z);
-			/* move the camera to the eye level of the user */
-			glTranslatef(0, -ovr_GetFloat(session, OVR_KEY_EYE_HEIGHT, 1.65), 0);
-			
-			draw_scene();
+			GLuint eye_fbo = eye_targets[eye]->Framebuffer();
+			if (multires)
+				multires_begin_periphery(eye);
+			else{
+				glBindFramebuffer(GL_FRAMEBUFFER, eye_fbo);
+				glViewport(0, 0, eyeViewport[eye].w, eyeViewport[eye].h);
+				glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+				hidden_area_draw(eye);
+			}
+
+			latch_eye_poses(eye, eye_height, view_mat);
+			instanced_latch_view(eye, view_mat[eye]);
+			instanced_set_eye(eye, false);
 
-			glBindFramebuffer(GL_FRAMEBUFFER, fbo[eye]);
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
-			glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
+			draw_scene();
+			if (multires){
+				// the centre again at full rate, then both into the swap texture
+				multires_begin_inset(eye);
+				instanced_set_eye(eye, true);
+				draw_scene();
+				multires_composite(eye, eye_fbo);
+				// the eye depth texture was not written
+				reproject_invalidate();
+			}
+			else
+				reproject_store(eye, eye_set, eye_targets[eye]->DepthTexture(), Recti(eyeViewport[eye]), view_mat[eye], proj_mat[eye]);
+			stats_end(stage);
+			capture_read(eye == 0 ? CAPTURE_LEFT : CAPTURE_RIGHT, eye_fbo, eyeViewport[eye].w, eyeViewport[eye].h);
 		}
 	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	if (!reprojected)
+		instanced_end_frame();
+
+	// panels only when they changed or their interval is up, the compositor places them every frame
+	static double last_frame_start;
+	hud_ms[hud_next] = last_frame_start > 0 ? (float)((frame_sched.frameStart - last_frame_start) * 1000.0) : 0.0f;
+	hud_next = (hud_next + 1) % HUD_FRAMES;
+	last_frame_start = frame_sched.frameStart;
+	stats_begin(STAGE_LAYERS);
+	quad_redraws += quad_layers_update();
+	stats_end(STAGE_LAYERS);
 
 	// Do distortion rendering, Present and flush/sync
 	layer.Header.Type = ovrLayerType_EyeFov;
 	layer.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft;
-	layer.ColorTexture[0] = pTextureSet[0];
-	layer.ColorTexture[1] = pTextureSet[1];
 	layer.Fov[0] = eyeRenderDesc[0].Fov;
 	layer.Fov[1] = eyeRenderDesc[1].Fov;
-	layer.Viewport[0] = Recti(recommenedTex0Size);
-	layer.Viewport[1] = Recti(recommenedTex1Size);
+	if (single_pass_stereo){
+		layer.ColorTexture[0] = stereo_target->TextureSet;
+		layer.ColorTexture[1] = stereo_target->TextureSet;
+		layer.Viewport[0] = Recti(eyeViewport[0]);
+		layer.Viewport[1] = Recti(eyeViewport[0].w, 0, eyeViewport[1].w, eyeViewport[1].h);
+	}
+	else{
+		layer.ColorTexture[0] = eye_targets[0]->TextureSet;
+		layer.ColorTexture[1] = eye_targets[1]->TextureSet;
+		layer.Viewport[0] = Recti(eyeViewport[0]);
+		layer.Viewport[1] = Recti(eyeViewport[1]);
+	}
+	if (reprojected){
+		// the resolution controller may have moved on, the images keep their size
+		layer.Viewport[0] = reprojected_viewport[0];
+		layer.Viewport[1] = reprojected_viewport[1];
+	}
 
 	// Set up positional data.
 	ovrViewScaleDesc viewScaleDesc;
@@ -213,29 +714,101 @@ void rendering_loop(){
 	viewScaleDesc.HmdToEyeViewOffset[0] = hmdToEyeViewOffset[0];
 	viewScaleDesc.HmdToEyeViewOffset[1] = hmdToEyeViewOffset[1];
 
-	ovrLayerHeader* layers = &layer.Header;
-	ovrResult result = ovr_SubmitFrame(session, 0, &viewScaleDesc, &layers, 1);
+	ovrLayerHeader const* layers[1 + QUAD_LAYER_MAX];
+	layers[0] = &layer.Header;
+	int layer_count = 1 + quad_layers_append(layers + 1, QUAD_LAYER_MAX);
+	frame_sched.Submitting(render_gpu_ms, !reprojected);
+	stats_begin(STAGE_SUBMIT);
+	ovrResult result = compositor->SubmitFrame(frame_index, &viewScaleDesc, layers, layer_count);
+	stats_end(STAGE_SUBMIT);
+	tracking_trace_submit(result);
+	if (result == ovrError_DisplayLost){
+		lose_session();
+		return;
+	}
 	isVisible = (result == ovrSuccess);
 	//printf("isVisible:%d\n", isVisible);
 
-	// Blit mirror texture to back buffer
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, mirrorFBO);
-	glBindFramebuffer(GL_DRAW_FRAMEBUFFER, 0);
-	GLint w = mirrorTexture->OGL.Header.TextureSize.w;
-	GLint h = mirrorTexture->OGL.Header.TextureSize.h;
-	glBlitFramebuffer(0, h, w, 0,
-		0, 0, w, h,
-		GL_COLOR_BUFFER_BIT, GL_NEAREST);
-	glBindFramebuffer(GL_READ_FRAMEBUFFER, 0);
+	// Blit mirror texture to back buffer and swap, as the mirror mode says
+	mirror_present();
+
+	// queue this frame's readbacks, hand finished earlier ones to the capture thread
+	if (const ovrGLTexture *mirror = mirror_texture())
+		capture_read(CAPTURE_MIRROR, mirror_framebuffer(), mirror->OGL.Header.TextureSize.w, mirror->OGL.Header.TextureSize.h);
+	capture_end_frame();
 }
 
 void shutdowm(){
+	FramePacingStats pacing;
+	frame_sched.GetStats(pacing);
+	printf("pacing: %lld frames, %lld missed deadlines, start delay %.2f ms, start to display %.2f ms, render cost p50 %.2f p90 %.2f ms\n",
+		pacing.frames, pacing.missed, pacing.delayMs, pacing.latencyMs, pacing.costP50Ms, pacing.costP90Ms);
+	ReprojectStats reproj;
+	reproject_get_stats(reproj);
+	printf("reprojection: %lld of %lld frames (%lld predicted misses, %lld not visible)\n",
+		reproj.reprojected, reproj.frames, reproj.predicted, reproj.hidden);
+	tracking_stop();
+	tracking_trace_close();
+	capture_shutdown();
+	if (capture_video)
+		fclose(capture_video);
+	capture_video = NULL;
+	mirror_shutdown();
+	stats_shutdown(trace_path);
+	scene_anim.Wait();
+	job_system_shutdown();
+	delete scene_boxes;
+	scene_boxes = nullptr;
+	delete room_box;
+	room_box = nullptr;
+	for (size_t i = 0; i < bench_boxes.size(); ++i)
+		delete bench_boxes[i];
+	bench_boxes.clear();
+	if (!bench_tex.empty())
+		glDeleteTextures((GLsizei)bench_tex.size(), &bench_tex[0]);
+	bench_tex.clear();
+	delete eye_targets[0];
+	delete eye_targets[1];
+	delete stereo_target;
+	eye_targets[0] = eye_targets[1] = stereo_target = nullptr;
+	TextureStreamStats stream_stats;
+	texture_stream_stats(stream_stats);
+	if (room_tex >= 0)
+		printf("textures: %d resident, %.1f MB uploaded, %lld evictions, %lld stalled frames\n", stream_stats.resident,
+			stream_stats.uploadedBytes / 1048576.0, stream_stats.evictions, stream_stats.stalls);
+	scene_free(scene);
+	scene = nullptr;
+	texture_stream_shutdown();
+	if (quad_redraws)
+		printf("quad layers: %lld redraws in %lld frames\n", quad_redraws, frame_index);
+	quad_layers_shutdown();
+	GpuResourceStats gpu;
+	gpu_resources_get_stats(gpu);
+	printf("gpu resources: %d depth textures made, %d reused; %d framebuffers made, %d reused; %d swap sets, %d sessions recreated\n",
+		gpu.depthAllocated, gpu.depthReused, gpu.framebuffersAllocated, gpu.framebuffersReused, gpu.swapSetsCreated,
+		gpu.sessionsRecreated);
+	multires_shutdown();
+	gpu_resources_shutdown();
+	reproject_shutdown();
+	hidden_area_shutdown();
+	instanced_shutdown();
+	mesh_shutdown();
+#if defined(_WIN32)
+	timeEndPeriod(1);
+#endif
 	// LibOVR must be shut down after GLFW.
+#ifdef O4_HEADLESS
+	OSMesaDestroyContext(osmesa);
+	free(osmesa_buffer);
+#else
 	glfwTerminate();
-	ovr_Destroy(session);
-	ovr_Shutdown();
+#endif
+	compositor->Shutdown();
+	delete compositor;
+	compositor = nullptr;
 }
 
+#ifndef O4_HEADLESS
 static void error_callback(int error, const char* description){
 	fputs(description, stderr);
 }
@@ -250,10 +823,68 @@ static void key_callback(GLFWwindow* window1, int key, int scancode, int action,
 		break;
 	case GLFW_KEY_W:
 		break;
+	case GLFW_KEY_R:
+		res_ctrl.enabled = !res_ctrl.enabled;
+		printf("adaptive resolution %s\n", res_ctrl.enabled ? "on" : "off");
+		break;
+	case GLFW_KEY_M:
+		// cycle off / every frame / every nth / reduced; the mirror thread is startup only
+		if (mirror_mode() != MIRROR_THREAD)
+			mirror_set_mode(MirrorMode((mirror_mode() + 1) % MIRROR_THREAD));
+		break;
+	case GLFW_KEY_C:
+		frustum_culling = !frustum_culling;
+		printf("frustum culling %s\n", frustum_culling ? "on" : "off");
+		break;
+	case GLFW_KEY_T:
+		reproject_set_enabled(!reproject_enabled());
+		// it needs the depth of both eyes kept, without it they can share one
+		reproject_invalidate();
+		eye_targets[0]->ShareDepth(!reproject_enabled());
+		eye_targets[1]->ShareDepth(!reproject_enabled());
+		printf("reprojection of late frames %s\n", reproject_enabled() ? "on" : "off");
+		break;
+	case GLFW_KEY_MINUS:
+	case GLFW_KEY_EQUAL:
+		// the eye buffers are resized at the start of the next frame
+		pixel_density += key == GLFW_KEY_EQUAL ? 0.25f : -0.25f;
+		pixel_density = pixel_density < 0.5f ? 0.5f : pixel_density > 2.0f ? 2.0f : pixel_density;
+		break;
+	case GLFW_KEY_O:
+		sorted_draws = !sorted_draws;
+		printf("sorted draws %s\n", sorted_draws ? "on" : "off");
+		break;
+	case GLFW_KEY_A:
+		animate_scene = !animate_scene;
+		printf("animated boxes %s (%d job threads)\n", animate_scene ? "on" : "off", job_system_threads());
+		break;
+	case GLFW_KEY_H:
+		hidden_area_set_enabled(!hidden_area_enabled());
+		printf("hidden area mask %s\n", hidden_area_enabled() ? "on" : "off");
+		break;
+	case GLFW_KEY_F:
+		multires_set_enabled(!multires_enabled());
+		printf("multi-resolution %s (centre %.2f, periphery %.2f)\n", multires_enabled() ? "on" : "off",
+			multires_config().centre, multires_config().periphery);
+		break;
+	case GLFW_KEY_U:
+		hud_visible = !hud_visible;
+		quad_layer_set_visible(hud_layer, hud_visible);
+		printf("frame time hud %s\n", hud_visible ? "on" : "off");
+		break;
+	case GLFW_KEY_P:
+		frame_sched.enabled = !frame_sched.enabled;
+		printf("frame pacing %s\n", frame_sched.enabled ? "on" : "off");
+		break;
+	case GLFW_KEY_S:
+		single_pass_stereo = !single_pass_stereo;
+		printf("single-pass stereo %s\n", single_pass_stereo ? "on" : "off");
+		break;
 	default:
 		break;
 	}
 }
+#endif
 
 void quat_to_matrix(const float *quat, float *mat){
 	mat[0] = 1.0 - 2.0 * quat[1] * quat[1] - 2.0 * quat[2] * quat[2];
@@ -275,118 +906,219 @@ void quat_to_matrix(const float *quat, float *mat){
 	mat[15] = 1.0f;
 }
 
-void draw_scene(void){
-	int i;
-	float grey[] = { 0.8, 0.8, 0.8, 1 };
-	float col[] = { 0, 0, 0, 1 };
-	float lpos[][4] = {
-		{ -8, 2, 10, 1 },
-		{ 0, 15, 0, 1 }
-	};
-	float lcol[][4] = {
-		{ 0.8, 0.8, 0.8, 1 },
-		{ 0.4, 0.3, 0.3, 1 }
-	};
+// Micro-benchmark of the batched view kernels against quat_to_matrix and
+// the translation that used to follow it, on count random eye poses.
+void bench_pose_math(int count){
+	std::vector<ovrPosef> poses(count);
+	std::vector<ovrVector3f> offsets(count);
+	srand(1);
+	for (int i = 0; i < count; ++i){
+		float q[4], len = 0;
+		for (int k = 0; k < 4; ++k){
+			q[k] = rand() / (float)RAND_MAX * 2.0f - 1.0f;
+			len += q[k] * q[k];
+		}
+		len = sqrtf(len);
+		poses[i].Orientation.x = q[0] / len;
+		poses[i].Orientation.y = q[1] / len;
+		poses[i].Orientation.z = q[2] / len;
+		poses[i].Orientation.w = q[3] / len;
+		poses[i].Position.x = rand() / (float)RAND_MAX * 4.0f - 2.0f;
+		poses[i].Position.y = rand() / (float)RAND_MAX * 2.0f;
+		poses[i].Position.z = rand() / (float)RAND_MAX * 4.0f - 2.0f;
+		offsets[i].x = i & 1 ? 0.032f : -0.032f;
+		offsets[i].y = offsets[i].z = 0;
+	}
+	ovrVector3f height = { 0, 1.65f, 0 };
+	std::vector<float> ref(count * 16), out(count * 16);
+	int reps = 2000000 / count > 1 ? 2000000 / count : 1;
 
-	for (i = 0; i<2; i++) {
-		glLightfv(GL_LIGHT0 + i, GL_POSITION, lpos[i]);
-		glLightfv(GL_LIGHT0 + i, GL_DIFFUSE, lcol[i]);
+	double t0 = ovr_GetTimeInSeconds();
+	for (int r = 0; r < reps; ++r){
+		for (int i = 0; i < count; ++i){
+			float *view = &ref[i * 16];
+			quat_to_matrix(&poses[i].Orientation.x, view);
+			float t[3] = { -poses[i].Position.x, -poses[i].Position.y - height.y, -poses[i].Position.z };
+			view[12] = view[0] * t[0] + view[4] * t[1] + view[8] * t[2] + offsets[i].x;
+			view[13] = view[1] * t[0] + view[5] * t[1] + view[9] * t[2] + offsets[i].y;
+			view[14] = view[2] * t[0] + view[6] * t[1] + view[10] * t[2] + offsets[i].z;
+		}
 	}
+	double base_ns = (ovr_GetTimeInSeconds() - t0) * 1e9 / ((double)reps * count);
+	printf("pose math: %d poses, quat_to_matrix %.2f ns/pose\n", count, base_ns);
 
-	glMatrixMode(GL_MODELVIEW);
+	PoseMathPath chosen = pose_math_path();
+	for (int p = 0; p < POSE_MATH_PATH_COUNT; ++p){
+		if (!pose_math_supported((PoseMathPath)p))
+			continue;
+		pose_math_set_path((PoseMathPath)p);
+		t0 = ovr_GetTimeInSeconds();
+		for (int r = 0; r < reps; ++r)
+			pose_view_matrices(&poses[0], count, &offsets[0], height, NULL, (float(*)[16])&out[0], NULL);
+		double ns = (ovr_GetTimeInSeconds() - t0) * 1e9 / ((double)reps * count);
+		float err = 0;
+		for (int i = 0; i < count * 16; ++i)
+			err = fmaxf(err, fabsf(out[i] - ref[i]));
+		printf("pose math: %-6s %.2f ns/pose (%.1fx), max error %g\n", pose_math_path_name((PoseMathPath)p), ns, base_ns / ns, err);
+	}
+	pose_math_set_path(chosen);
+}
+
+static float light_pos[][4] = {
+	{ -8, 2, 10, 1 },
+	{ 0, 15, 0, 1 }
+};
+static float light_col[][4] = {
+	{ 0.8, 0.8, 0.8, 1 },
+	{ 0.4, 0.3, 0.3, 1 }
+};
+static float light_ambient[] = { 1, 1, 1, 1 };
 
-	glPushMatrix();
-	glTranslatef(0, 10, 0);
-	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, grey);
-	glBindTexture(GL_TEXTURE_2D, chess_tex);
-	glEnable(GL_TEXTURE_2D);
-	draw_box(30, 20, 30, -1.0);
-	glDisable(GL_TEXTURE_2D);
-	glPopMatrix();
+void build_scene_instances(void){
+	int i, n = 0;
+	float grey[] = { 0.8, 0.8, 0.8, 1 };
+	float col[] = { 0, 0, 0, 1 };
+	InstanceData inst[10];
 
 	for (i = 0; i<4; i++) {
-		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, grey);
-		glPushMatrix();
-		glTranslatef(i & 1 ? 5 : -5, 1, i & 2 ? -5 : 5);
-		draw_box(0.5, 2, 0.5, 1.0);
-		glPopMatrix();
+		instance_box(inst[n++], i & 1 ? 5 : -5, 1, i & 2 ? -5 : 5, 0.5, 2, 0.5, grey);
 
 		col[0] = i & 1 ? 1.0 : 0.3;
 		col[1] = i == 0 ? 1.0 : 0.3;
 		col[2] = i & 2 ? 1.0 : 0.3;
-		glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, col);
-
-		glPushMatrix();
 		if (i & 1) {
-			glTranslatef(0, 0.25, i & 2 ? 2 : -2);
+			instance_box(inst[n++], 0, 0.25, i & 2 ? 2 : -2, 0.5, 0.5, 0.5, col);
 		}
 		else {
-			glTranslatef(i & 2 ? 2 : -2, 0.25, 0);
+			instance_box(inst[n++], i & 2 ? 2 : -2, 0.25, 0, 0.5, 0.5, 0.5, col);
 		}
-		draw_box(0.5, 0.5, 0.5, 1.0);
-		glPopMatrix();
 	}
 
 	col[0] = 1;
 	col[1] = 1;
 	col[2] = 0.4;
-	glMaterialfv(GL_FRONT_AND_BACK, GL_AMBIENT_AND_DIFFUSE, col);
-	draw_box(0.05, 1.2, 6, 1.0);
-	draw_box(6, 1.2, 0.05, 1.0);
+	instance_box(inst[n++], 0, 0, 0, 0.05, 1.2, 6, col);
+	instance_box(inst[n++], 0, 0, 0, 6, 1.2, 0.05, col);
+
+	scene_boxes = new InstanceBuffer(mesh_get(MESH_BOX), n);
+	scene_boxes->Update(inst, n);
+	if (bench_objects > 0)
+		build_bench_scene(bench_objects, bench_textures);
+	else{
+		Aabb unit_box = { { -1, -1, -1 }, { 1, 1, 1 } };
+		int owner = scene_culled.AddBuffer(scene_boxes);
+		for (i = 0; i < n; ++i)
+			scene_culled.Add(owner, inst[i], unit_box);
+		scene_culled.Build();
+	}
+
+	instance_box(inst[0], 0, 10, 0, 30, 20, 30, grey);
+	room_box = new InstanceBuffer(mesh_get(MESH_BOX_INSIDE), 1);
+	room_box->texture = chess_tex;
+	room_box->Update(inst, 1);
+
+	instanced_set_lights(light_pos, light_col, light_ambient);
+}
+
+// A square grid of boxes of varying height on the floor around the viewer,
+// dealt round robin into one instanced batch per chess texture (a single
+// untextured batch for textures == 0).
+void build_bench_scene(int objects, int textures){
+	int batches = textures > 0 ? textures : 1;
+	int side = (int)ceil(sqrt((double)objects));
+	float col[] = { 0.8, 0.8, 0.8, 1 };
+	std::vector<std::vector<InstanceData> > lists(batches);
+	for (int i = 0; i < objects; ++i){
+		float h = 0.25f * (1 + i % 7);
+		col[0] = 0.3f + 0.1f * (i % 8);
+		col[2] = 0.3f + 0.1f * (i / 8 % 8);
+		InstanceData inst;
+		instance_box(inst, (i % side - side * 0.5f) * 1.0f, h * 0.5f, (i / side - side * 0.5f) * 1.0f, 0.4f, h, 0.4f, col);
+		lists[i % batches].push_back(inst);
+	}
+
+	Aabb unit_box = { { -1, -1, -1 }, { 1, 1, 1 } };
+	for (int b = 0; b < batches; ++b){
+		int count = (int)lists[b].size();
+		InstanceBuffer *buffer = new InstanceBuffer(mesh_get(MESH_BOX), count > 0 ? count : 1);
+		if (count)
+			buffer->Update(&lists[b][0], count);
+		if (textures > 0){
+			float t = (float)b / batches;
+			buffer->texture = gen_chess_tex(1.0, t, 0.4, 0.4, 1.0 - t, 1.0);
+			bench_tex.push_back(buffer->texture);
+		}
+		int owner = scene_culled.AddBuffer(buffer);
+		for (int i = 0; i < count; ++i)
+			scene_culled.Add(owner, lists[b][i], unit_box);
+		bench_boxes.push_back(buffer);
+	}
+	scene_culled.Build();
+}
+
+// Cull the scene boxes (or the loaded scene) against one frustum holding
+// both eyes, placed at the head pose latched last; the room is never
+// culled, we are standing in it. Only the scene batches left fetch their
+// streamed texture. Animated boxes are updated a frame ahead.
+void cull_scene(float eye_height){
+	Frustum frustum;
+	if (frustum_culling){
+		float head_view[1][16];
+		ovrVector3f height = { 0, eye_height, 0 };
+		pose_view_matrices(&latched_head, 1, NULL, height, NULL, head_view, NULL);
+		frustum_combined_eyes(desc.DefaultEyeFov, hmdToEyeViewOffset, head_view[0], 0.5f, 500.0f, CULL_FOV_MARGIN, frustum);
+	}
+	const Frustum *f = frustum_culling ? &frustum : NULL;
+	if (scene){
+		scene_cull(scene, f);
+		scene_update_textures(scene);
+		return;
+	}
+	// the update kicked last frame has moved the boxes, they go up again in full
+	scene_anim.Wait();
+	scene_culled.Cull(f);
+	if (animate_scene){
+		// the next frame's poses, matrices and bounds, on the job threads while this one is drawn
+		if (!scene_anim.set){
+			Aabb unit_box = { { -1, -1, -1 }, { 1, 1, 1 } };
+			scene_anim.Init(&scene_culled, unit_box);
+		}
+		scene_anim.Kick(frame_sched.displayTime + frame_sched.frameSeconds);
+	}
 }
 
-void draw_box(float xsz, float ysz, float zsz, float norm_sign){
-	glMatrixMode(GL_MODELVIEW);
-	glPushMatrix();
-	glScalef(xsz * 0.5, ysz * 0.5, zsz * 0.5);
-
-	if (norm_sign < 0.0) {
-		glFrontFace(GL_CW);
-	}
-
-	glBegin(GL_QUADS);
-	glNormal3f(0, 0, 1 * norm_sign);
-	glTexCoord2f(0, 0); glVertex3f(-1, -1, 1);
-	glTexCoord2f(1, 0); glVertex3f(1, -1, 1);
-	glTexCoord2f(1, 1); glVertex3f(1, 1, 1);
-	glTexCoord2f(0, 1); glVertex3f(-1, 1, 1);
-	glNormal3f(1 * norm_sign, 0, 0);
-	glTexCoord2f(0, 0); glVertex3f(1, -1, 1);
-	glTexCoord2f(1, 0); glVertex3f(1, -1, -1);
-	glTexCoord2f(1, 1); glVertex3f(1, 1, -1);
-	glTexCoord2f(0, 1); glVertex3f(1, 1, 1);
-	glNormal3f(0, 0, -1 * norm_sign);
-	glTexCoord2f(0, 0); glVertex3f(1, -1, -1);
-	glTexCoord2f(1, 0); glVertex3f(-1, -1, -1);
-	glTexCoord2f(1, 1); glVertex3f(-1, 1, -1);
-	glTexCoord2f(0, 1); glVertex3f(1, 1, -1);
-	glNormal3f(-1 * norm_sign, 0, 0);
-	glTexCoord2f(0, 0); glVertex3f(-1, -1, -1);
-	glTexCoord2f(1, 0); glVertex3f(-1, -1, 1);
-	glTexCoord2f(1, 1); glVertex3f(-1, 1, 1);
-	glTexCoord2f(0, 1); glVertex3f(-1, 1, -1);
-	glEnd();
-	glBegin(GL_TRIANGLE_FAN);
-	glNormal3f(0, 1 * norm_sign, 0);
-	glTexCoord2f(0.5, 0.5); glVertex3f(0, 1, 0);
-	glTexCoord2f(0, 0); glVertex3f(-1, 1, 1);
-	glTexCoord2f(1, 0); glVertex3f(1, 1, 1);
-	glTexCoord2f(1, 1); glVertex3f(1, 1, -1);
-	glTexCoord2f(0, 1); glVertex3f(-1, 1, -1);
-	glTexCoord2f(0, 0); glVertex3f(-1, 1, 1);
-	glEnd();
-	glBegin(GL_TRIANGLE_FAN);
-	glNormal3f(0, -1 * norm_sign, 0);
-	glTexCoord2f(0.5, 0.5); glVertex3f(0, -1, 0);
-	glTexCoord2f(0, 0); glVertex3f(-1, -1, -1);
-	glTexCoord2f(1, 0); glVertex3f(1, -1, -1);
-	glTexCoord2f(1, 1); glVertex3f(1, -1, 1);
-	glTexCoord2f(0, 1); glVertex3f(-1, -1, 1);
-	glTexCoord2f(0, 0); glVertex3f(-1, -1, -1);
-	glEnd();
-
-	glFrontFace(GL_CCW);
-	glPopMatrix();
+// Everything that survived culling, sorted by program and texture once for
+// all the eye passes of the frame. Only the room gets a depth: it encloses
+// the rest and goes last among the draws sharing its texture.
+void build_render_queue(){
+	render_queue.Clear();
+	render_queue.Add(room_box, 1000.0f);
+	if (scene)
+		scene_enqueue(scene, render_queue);
+	else if (!bench_boxes.empty()){
+		for (size_t i = 0; i < bench_boxes.size(); ++i)
+			render_queue.Add(bench_boxes[i], 0);
+	}
+	else
+		render_queue.Add(scene_boxes, 0);
+	render_queue.Sort();
+}
+
+void draw_scene(void){
+	if (sorted_draws){
+		render_queue.Submit();
+		return;
+	}
+	// the room, then pillars, cubes and rails (or the loaded scene), each one instanced draw
+	room_box->Draw();
+	if (scene)
+		scene_draw(scene);
+	else if (!bench_boxes.empty()){
+		for (size_t i = 0; i < bench_boxes.size(); ++i)
+			bench_boxes[i]->Draw();
+	}
+	else
+		scene_boxes->Draw();
 }
 
 unsigned int gen_chess_tex(float r0, float g0, float b0, float r1, float g1, float b1){
@@ -415,6 +1147,8 @@ unsigned int gen_chess_tex(float r0, float g0, float b0, float r1, float g1, flo
 	return tex;
 }
 
+#ifndef O4_HEADLESS
 static void scroll_callback(GLFWwindow* window, double x, double y){
 	return;
 }
+#endif
@@ -14,202 +14,133 @@
 
 #include <stdio.h>
 #include<stdlib.h>
+#include <string.h>
+#include <math.h>
 #include <GL/glew.h>
-#include <GLFW\glfw3.h>
+#ifdef O4_HEADLESS
+#include <GL/osmesa.h>
+#else
+#include <GLFW/glfw3.h>
 #include <GLFW/glfw3native.h>
+#endif
+#if defined(_WIN32)
+#include <windows.h>
+#include <mmsystem.h> // timeBeginPeriod
+#pragma comment(lib, "winmm.lib")
+#endif
 #include <OVR_CAPI.h>
 #include <OVR_CAPI_GL.h>
 #include <Extras/OVR_Math.h>
+#include "compositor.h"
+#include "mesh.h"
+#include "instanced.h"
+#include "swap_fbo.h"
+#include "gpu_resources.h"
+#include "frame_stats.h"
+#include "resolution.h"
+#include "frame_scheduler.h"
+#include "tracking_sampler.h"
+#include "tracking_trace.h"
+#include "mirror.h"
+#include "texture_stream.h"
+#include "scene_file.h"
+#include "cull.h"
+#include "hidden_area.h"
+#include "multires.h"
+#include "capture.h"
+#include "quad_layer.h"
+#include "pose_math.h"
+#include "render_queue.h"
+#include "reproject.h"
+#include "job_system.h"
+#include "animation.h"
 
 using namespace OVR;
 
 int init();
 void rendering_loop();
+void init_stereo_target();
+bool create_eye_targets();
+void resize_eye_targets();
+void lose_session();
+bool recover_session();
+void latch_eye_poses(int eye, float eye_height, float view_mat[][16]);
+void shutdowm();
 void quat_to_matrix(const float *quat, float *mat);
+void bench_pose_math(int count);
+void build_scene_instances(void);
+void build_bench_scene(int objects, int textures);
+void cull_scene(float eye_height);
+void build_render_queue();
+void start_capture();
+void create_hud();
 void draw_scene(void);
-void draw_box(float xsz, float ysz, float zsz, float norm_sign);
 unsigned int gen_chess_tex(float r0, float g0, float b0, float r1, float g1, float b1);
+#ifndef O4_HEADLESS
 static void error_callback(int error, const char* description);
 static void key_callback(GLFWwindow* window1, int key, int scancode, int action, int mods);
 static void scroll_callback(GLFWwindow* window, double x, double y);
+#endif
 
 static ovrResult result;
-static ovrSession session;
-static ovrGraphicsLuid luid;
+static Compositor *compositor;
 static ovrHmdDesc desc;
 static ovrSizei resolution, recommenedTex0Size, recommenedTex1Size;
 static ovrSizei bufferSize;
-static ovrGLTexture* tex;
-static ovrGLTexture  * mirrorTexture = nullptr;
 static ovrTrackingState ts;
 static ovrPoseStatef pose;
+#ifdef O4_HEADLESS
+static HeadlessConfig headless;
+static OSMesaContext osmesa;
+static unsigned char *osmesa_buffer;
+#else
 static GLFWwindow *window;
-static GLuint fbo[2] = { 0, 0 }, fb_depth[2] = { 0, 0 }, fb_texture, chess_tex, mirrorFBO;
+static GLFWwindow *render_window; // == window unless the mirror has its own thread
+#endif
+static GLuint fb_texture, chess_tex;
 static ovrEyeRenderDesc eyeRenderDesc[2];
 static ovrVector3f hmdToEyeViewOffset[2];
+static ovrPosef latched_head; // head pose of the last latch_eye_poses()
 static ovrLayerEyeFov layer;
 static bool isVisible;
-static ovrSwapTextureSet * pTextureSet[2];
-
-struct DepthBuffer
-{
-	GLuint        texId;
-
-	DepthBuffer(Sizei size, int sampleCount)
-	{
-		//OVR_ASSERT(sampleCount <= 1); // The code doesn't currently handle MSAA textures.
-
-		glGenTextures(1, &texId);
-		glBindTexture(GL_TEXTURE_2D, texId);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-
-		GLenum internalFormat = GL_DEPTH_COMPONENT24;
-		GLenum type = GL_UNSIGNED_INT;
-		/*if (GLE_ARB_depth_buffer_float)
-		{
-			internalFormat = GL_DEPTH_COMPONENT32F;
-			type = GL_FLOAT;
-		}*/
-
-		glTexImage2D(GL_TEXTURE_2D, 0, internalFormat, size.w, size.h, 0, GL_DEPTH_COMPONENT, type, NULL);
-	}
-	~DepthBuffer()
-	{
-		if (texId)
-		{
-			glDeleteTextures(1, &texId);
-			texId = 0;
-		}
-	}
-};
-
-//--------------------------------------------------------------------------
-struct TextureBuffer
-{
-	ovrHmd              hmd;
-	ovrSwapTextureSet*  TextureSet;
-	GLuint              texId;
-	GLuint              fboId;
-	Sizei               texSize;
-
-	TextureBuffer(ovrHmd hmd, bool rendertarget, bool displayableOnHmd, Sizei size, int mipLevels, unsigned char * data, int sampleCount) :
-		hmd(hmd),
-		TextureSet(nullptr),
-		texId(0),
-		fboId(0),
-		texSize(0, 0)
-	{
-		//OVR_ASSERT(sampleCount <= 1); // The code doesn't currently handle MSAA textures.
-
-		texSize = size;
-
-		if (displayableOnHmd)
-		{
-			// This texture isn't necessarily going to be a rendertarget, but it usually is.
-			//OVR_ASSERT(hmd); // No HMD? A little odd.
-			//OVR_ASSERT(sampleCount == 1); // ovr_CreateSwapTextureSetD3D11 doesn't support MSAA.
-
-			ovrResult result = ovr_CreateSwapTextureSetGL(hmd, GL_SRGB8_ALPHA8, size.w, size.h, &TextureSet);
-
-			if (OVR_SUCCESS(result))
-			{
-				for (int i = 0; i < TextureSet->TextureCount; ++i)
-				{
-					ovrGLTexture* tex = (ovrGLTexture*)&TextureSet->Textures[i];
-					glBindTexture(GL_TEXTURE_2D, tex->OGL.TexId);
-
-					if (rendertarget)
-					{
-						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-					}
-					else
-					{
-						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-						glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-					}
-				}
-			}
-		}
-		else
-		{
-			glGenTextures(1, &texId);
-			glBindTexture(GL_TEXTURE_2D, texId);
-
-			if (rendertarget)
-			{
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_CLAMP_TO_EDGE);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_CLAMP_TO_EDGE);
-			}
-			else
-			{
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
-				glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
-			}
-
-			glTexImage2D(GL_TEXTURE_2D, 0, GL_SRGB8_ALPHA8, texSize.w, texSize.h, 0, GL_RGBA, GL_UNSIGNED_BYTE, data);
-		}
-
-		if (mipLevels > 1)
-		{
-			glGenerateMipmap(GL_TEXTURE_2D);
-		}
-
-		glGenFramebuffers(1, &fboId);
-	}
-
-	~TextureBuffer()
-	{
-		if (TextureSet)
-		{
-			ovr_DestroySwapTextureSet(hmd, TextureSet);
-			TextureSet = nullptr;
-		}
-		if (texId)
-		{
-			glDeleteTextures(1, &texId);
-			texId = 0;
-		}
-		if (fboId)
-		{
-			glDeleteFramebuffers(1, &fboId);
-			fboId = 0;
-		}
-	}
-
-	Sizei GetSize() const
-	{
-		return texSize;
-	}
-
-	void SetAndClearRenderSurface(DepthBuffer* dbuffer)
-	{
-		auto tex = reinterpret_cast<ovrGLTexture*>(&TextureSet->Textures[TextureSet->CurrentIndex]);
-
-		glBindFramebuffer(GL_FRAMEBUFFER, fboId);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex->OGL.TexId, 0);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, dbuffer->texId, 0);
-
-		glViewport(0, 0, texSize.w, texSize.h);
-		glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
-		glEnable(GL_FRAMEBUFFER_SRGB);
-	}
-
-	void UnsetRenderSurface()
-	{
-		glBindFramebuffer(GL_FRAMEBUFFER, fboId);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, 0, 0);
-		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, 0, 0);
-	}
-};
+static TextureBuffer *eye_targets[2]; // swap sets with framebuffers and (pooled, maybe shared) depth
+static InstanceBuffer *scene_boxes, *room_box;
+static bool single_pass_stereo;
+static ResolutionController res_ctrl;
+static FrameScheduler frame_sched;
+static long long frame_index; // of the frame being rendered, from frame_sched
+static ovrSizei eyeViewport[2];
+static const char *trace_path = "o4_trace.json";
+static const char *tracking_record_path, *tracking_replay_path; // tracking trace to write, or to play instead of the session
+static MirrorConfig mirror_cfg;
+static const char *room_texture_path; // streamed in over the chess pattern when set
+static TextureHandle room_tex = -1;
+static const char *scene_path; // converted .o4s scene instead of the built-in boxes
+static Scene *scene;
+static CulledInstances scene_culled; // the built-in boxes
+static InstanceAnimation scene_anim; // spins and bobs them on the job threads
+static bool animate_scene;
+static int job_threads; // threads for scene jobs, <= 0 for one per hardware thread
+static bool frustum_culling = true;
+static RenderQueue render_queue; // sorted once a frame after culling, submitted for every eye
+static bool sorted_draws = true;
+static MultiResConfig multires_cfg;
+static ReprojectConfig reproject_cfg;
+static CaptureConfig capture_cfg;
+static const char *capture_prefix, *capture_video_path, *golden_dir; // PPM per image, one PPM stream, golden image comparison
+static FILE *capture_video;
+static GoldenCompare golden;
+#define HUD_FRAMES 64
+static QuadLayerHandle hud_layer = -1; // head-locked frame time graph, redrawn every ninth frame (10 Hz at 90)
+static bool hud_visible;
+static float hud_ms[HUD_FRAMES];
+static int hud_next;
+static long long quad_redraws;
+static int bench_objects, bench_textures; // synthetic scene instead of the built-in boxes when bench_objects > 0
+static std::vector<InstanceBuffer*> bench_boxes;
+static std::vector<GLuint> bench_tex;
+static bool bench_output; // one machine-readable summary line on exit, for o4bench
+static TextureBuffer *stereo_target; // both eyes side by side, made on first use
+static float pixel_density = 1.0f, target_density; // eye buffer pixels per display pixel: wanted, allocated
+static bool session_lost;
+static double session_retry; // next attempt to recreate a lost session
@@ -0,0 +1,370 @@
+#include "pose_math_kernels.h"
+#include <string.h>
+
+#ifdef POSE_MATH_SSE
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#endif
+#endif
+
+#define POSE_BLOCK 64 // poses repacked to SoA at a time
+
+struct SoABlock
+{
+	float qx[POSE_BLOCK], qy[POSE_BLOCK], qz[POSE_BLOCK], qw[POSE_BLOCK];
+	float px[POSE_BLOCK], py[POSE_BLOCK], pz[POSE_BLOCK];
+	float vx[POSE_BLOCK], vy[POSE_BLOCK], vz[POSE_BLOCK]; // view offsets or scales
+
+	PoseSoA Load(const ovrPosef* poses, int n)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			qx[i] = poses[i].Orientation.x;
+			qy[i] = poses[i].Orientation.y;
+			qz[i] = poses[i].Orientation.z;
+			qw[i] = poses[i].Orientation.w;
+			px[i] = poses[i].Position.x;
+			py[i] = poses[i].Position.y;
+			pz[i] = poses[i].Position.z;
+		}
+		PoseSoA soa = { qx, qy, qz, qw, px, py, pz };
+		return soa;
+	}
+
+	void LoadVectors(const ovrVector3f* v, int n)
+	{
+		for (int i = 0; i < n; ++i)
+		{
+			vx[i] = v[i].x;
+			vy[i] = v[i].y;
+			vz[i] = v[i].z;
+		}
+	}
+};
+
+static PoseSoA advance(const PoseSoA& p, int i)
+{
+	PoseSoA r = { p.qx + i, p.qy + i, p.qz + i, p.qw + i, p.px + i, p.py + i, p.pz + i };
+	return r;
+}
+
+// viewProj = proj * view, the bottom row of view being 0 0 0 1
+static void mul_proj(const float* proj, const float* view, float* out)
+{
+	for (int c = 0; c < 4; ++c)
+		for (int r = 0; r < 4; ++r)
+			out[c * 4 + r] = proj[r] * view[c * 4] + proj[4 + r] * view[c * 4 + 1] + proj[8 + r] * view[c * 4 + 2]
+				+ (c == 3 ? proj[12 + r] : 0.0f);
+}
+
+void view_scalar(const ViewJob& j, int i, int n)
+{
+	for (; i < n; ++i)
+	{
+		float x = j.p.qx[i], y = j.p.qy[i], z = j.p.qz[i], w = j.p.qw[i];
+		float x2 = x + x, y2 = y + y, z2 = z + z;
+		float xx = x * x2, yy = y * y2, zz = z * z2;
+		float xy = x * y2, xz = x * z2, yz = y * z2;
+		float wx = w * x2, wy = w * y2, wz = w * z2;
+
+		// the inverse (transposed) rotation
+		float *m = j.view[i];
+		m[0] = 1 - (yy + zz); m[4] = xy + wz;       m[8] = xz - wy;
+		m[1] = xy - wz;       m[5] = 1 - (xx + zz); m[9] = yz + wx;
+		m[2] = xz + wy;       m[6] = yz - wx;       m[10] = 1 - (xx + yy);
+		m[3] = m[7] = m[11] = 0;
+		m[15] = 1;
+
+		float tx = -(j.p.px[i] + j.wx), ty = -(j.p.py[i] + j.wy), tz = -(j.p.pz[i] + j.wz);
+		m[12] = m[0] * tx + m[4] * ty + m[8] * tz + (j.ox ? j.ox[i] : 0);
+		m[13] = m[1] * tx + m[5] * ty + m[9] * tz + (j.oy ? j.oy[i] : 0);
+		m[14] = m[2] * tx + m[6] * ty + m[10] * tz + (j.oz ? j.oz[i] : 0);
+
+		if (j.viewProj)
+			mul_proj(j.proj, m, j.viewProj[i]);
+	}
+}
+
+void model_scalar(const ModelJob& j, int i, int n)
+{
+	for (; i < n; ++i)
+	{
+		float x = j.p.qx[i], y = j.p.qy[i], z = j.p.qz[i], w = j.p.qw[i];
+		float x2 = x + x, y2 = y + y, z2 = z + z;
+		float xx = x * x2, yy = y * y2, zz = z * z2;
+		float xy = x * y2, xz = x * z2, yz = y * z2;
+		float wx = w * x2, wy = w * y2, wz = w * z2;
+		float sx = j.sx ? j.sx[i] : 1, sy = j.sy ? j.sy[i] : 1, sz = j.sz ? j.sz[i] : 1;
+
+		float *m = j.model + (size_t)i * j.stride;
+		m[0] = (1 - (yy + zz)) * sx; m[4] = (xy - wz) * sy;       m[8] = (xz + wy) * sz;
+		m[1] = (xy + wz) * sx;       m[5] = (1 - (xx + zz)) * sy; m[9] = (yz - wx) * sz;
+		m[2] = (xz - wy) * sx;       m[6] = (yz + wx) * sy;       m[10] = (1 - (xx + yy)) * sz;
+		m[3] = m[7] = m[11] = 0;
+		m[12] = j.p.px[i];
+		m[13] = j.p.py[i];
+		m[14] = j.p.pz[i];
+		m[15] = 1;
+	}
+}
+
+#ifdef POSE_MATH_SSE
+// m[k] holds element k of four matrices; write them stride floats apart
+static inline void store_sse(__m128* m, float* out, int stride)
+{
+	for (int c = 0; c < 16; c += 4)
+	{
+		__m128 a = m[c], b = m[c + 1], d = m[c + 2], e = m[c + 3];
+		_MM_TRANSPOSE4_PS(a, b, d, e);
+		_mm_storeu_ps(out + c, a);
+		_mm_storeu_ps(out + stride + c, b);
+		_mm_storeu_ps(out + 2 * stride + c, d);
+		_mm_storeu_ps(out + 3 * stride + c, e);
+	}
+}
+
+static inline __m128 madd_sse(__m128 a, __m128 b, __m128 c)
+{
+	return _mm_add_ps(_mm_mul_ps(a, b), c);
+}
+
+static void view_sse(const ViewJob& j, int i, int n)
+{
+	const __m128 one = _mm_set1_ps(1), zero = _mm_setzero_ps();
+	const __m128 wox = _mm_set1_ps(j.wx), woy = _mm_set1_ps(j.wy), woz = _mm_set1_ps(j.wz);
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(j.p.qx + i), y = _mm_loadu_ps(j.p.qy + i);
+		__m128 z = _mm_loadu_ps(j.p.qz + i), w = _mm_loadu_ps(j.p.qw + i);
+		__m128 x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+		__m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+
+		__m128 m[16];
+		m[0] = _mm_sub_ps(one, _mm_add_ps(yy, zz)); m[4] = _mm_add_ps(xy, wz); m[8] = _mm_sub_ps(xz, wy);
+		m[1] = _mm_sub_ps(xy, wz); m[5] = _mm_sub_ps(one, _mm_add_ps(xx, zz)); m[9] = _mm_add_ps(yz, wx);
+		m[2] = _mm_add_ps(xz, wy); m[6] = _mm_sub_ps(yz, wx); m[10] = _mm_sub_ps(one, _mm_add_ps(xx, yy));
+		m[3] = m[7] = m[11] = zero;
+		m[15] = one;
+
+		__m128 tx = _mm_sub_ps(zero, _mm_add_ps(_mm_loadu_ps(j.p.px + i), wox));
+		__m128 ty = _mm_sub_ps(zero, _mm_add_ps(_mm_loadu_ps(j.p.py + i), woy));
+		__m128 tz = _mm_sub_ps(zero, _mm_add_ps(_mm_loadu_ps(j.p.pz + i), woz));
+		m[12] = madd_sse(m[0], tx, madd_sse(m[4], ty, madd_sse(m[8], tz, j.ox ? _mm_loadu_ps(j.ox + i) : zero)));
+		m[13] = madd_sse(m[1], tx, madd_sse(m[5], ty, madd_sse(m[9], tz, j.oy ? _mm_loadu_ps(j.oy + i) : zero)));
+		m[14] = madd_sse(m[2], tx, madd_sse(m[6], ty, madd_sse(m[10], tz, j.oz ? _mm_loadu_ps(j.oz + i) : zero)));
+		store_sse(m, j.view[i], 16);
+
+		if (j.viewProj)
+		{
+			__m128 vp[16];
+			for (int c = 0; c < 4; ++c)
+				for (int r = 0; r < 4; ++r)
+				{
+					__m128 s = c == 3 ? _mm_set1_ps(j.proj[12 + r]) : zero;
+					s = madd_sse(_mm_set1_ps(j.proj[8 + r]), m[c * 4 + 2], s);
+					s = madd_sse(_mm_set1_ps(j.proj[4 + r]), m[c * 4 + 1], s);
+					vp[c * 4 + r] = madd_sse(_mm_set1_ps(j.proj[r]), m[c * 4], s);
+				}
+			store_sse(vp, j.viewProj[i], 16);
+		}
+	}
+	view_scalar(j, i, n);
+}
+
+static void model_sse(const ModelJob& j, int i, int n)
+{
+	const __m128 one = _mm_set1_ps(1), zero = _mm_setzero_ps();
+	for (; i + 4 <= n; i += 4)
+	{
+		__m128 x = _mm_loadu_ps(j.p.qx + i), y = _mm_loadu_ps(j.p.qy + i);
+		__m128 z = _mm_loadu_ps(j.p.qz + i), w = _mm_loadu_ps(j.p.qw + i);
+		__m128 x2 = _mm_add_ps(x, x), y2 = _mm_add_ps(y, y), z2 = _mm_add_ps(z, z);
+		__m128 xx = _mm_mul_ps(x, x2), yy = _mm_mul_ps(y, y2), zz = _mm_mul_ps(z, z2);
+		__m128 xy = _mm_mul_ps(x, y2), xz = _mm_mul_ps(x, z2), yz = _mm_mul_ps(y, z2);
+		__m128 wx = _mm_mul_ps(w, x2), wy = _mm_mul_ps(w, y2), wz = _mm_mul_ps(w, z2);
+		__m128 sx = j.sx ? _mm_loadu_ps(j.sx + i) : one;
+		__m128 sy = j.sy ? _mm_loadu_ps(j.sy + i) : one;
+		__m128 sz = j.sz ? _mm_loadu_ps(j.sz + i) : one;
+
+		__m128 m[16];
+		m[0] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(yy, zz)), sx);
+		m[1] = _mm_mul_ps(_mm_add_ps(xy, wz), sx);
+		m[2] = _mm_mul_ps(_mm_sub_ps(xz, wy), sx);
+		m[4] = _mm_mul_ps(_mm_sub_ps(xy, wz), sy);
+		m[5] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, zz)), sy);
+		m[6] = _mm_mul_ps(_mm_add_ps(yz, wx), sy);
+		m[8] = _mm_mul_ps(_mm_add_ps(xz, wy), sz);
+		m[9] = _mm_mul_ps(_mm_sub_ps(yz, wx), sz);
+		m[10] = _mm_mul_ps(_mm_sub_ps(one, _mm_add_ps(xx, yy)), sz);
+		m[3] = m[7] = m[11] = zero;
+		m[12] = _mm_loadu_ps(j.p.px + i);
+		m[13] = _mm_loadu_ps(j.p.py + i);
+		m[14] = _mm_loadu_ps(j.p.pz + i);
+		m[15] = one;
+		store_sse(m, j.model + (size_t)i * j.stride, j.stride);
+	}
+	model_scalar(j, i, n);
+}
+
+static bool cpu_has_avx2()
+{
+#ifdef _MSC_VER
+	int info[4];
+	__cpuid(info, 0);
+	if (info[0] < 7)
+		return false;
+	__cpuid(info, 1);
+	bool fma = (info[2] & (1 << 12)) != 0;
+	bool osxsave = (info[2] & (1 << 27)) != 0;
+	// the OS has to save the ymm registers too
+	if (!fma || !osxsave || (_xgetbv(0) & 6) != 6)
+		return false;
+	__cpuidex(info, 7, 0);
+	return (info[1] & (1 << 5)) != 0;
+#else
+	return __builtin_cpu_supports("avx2") && __builtin_cpu_supports("fma");
+#endif
+}
+#endif
+
+typedef void (*ViewKernel)(const ViewJob& j, int i, int n);
+typedef void (*ModelKernel)(const ModelJob& j, int i, int n);
+
+#ifdef POSE_MATH_SSE
+static const ViewKernel view_kernels[POSE_MATH_PATH_COUNT] = { view_scalar, view_sse, view_avx2 };
+static const ModelKernel model_kernels[POSE_MATH_PATH_COUNT] = { model_scalar, model_sse, model_avx2 };
+static const bool avx2_supported = cpu_has_avx2();
+#else
+static const ViewKernel view_kernels[POSE_MATH_PATH_COUNT] = { view_scalar, view_scalar, view_scalar };
+static const ModelKernel model_kernels[POSE_MATH_PATH_COUNT] = { model_scalar, model_scalar, model_scalar };
+static const bool avx2_supported = false;
+#endif
+
+bool pose_math_supported(PoseMathPath path)
+{
+	switch (path)
+	{
+	case POSE_MATH_SCALAR:
+		return true;
+#ifdef POSE_MATH_SSE
+	case POSE_MATH_SSE:
+		return true;
+#endif
+	case POSE_MATH_AVX2:
+		return avx2_supported;
+	default:
+		return false;
+	}
+}
+
+static PoseMathPath best_path(PoseMathPath limit)
+{
+	int p = limit < POSE_MATH_PATH_COUNT ? limit : POSE_MATH_PATH_COUNT - 1;
+	while (p > POSE_MATH_SCALAR && !pose_math_supported((PoseMathPath)p))
+		--p;
+	return (PoseMathPath)p;
+}
+
+static PoseMathPath active_path = best_path(POSE_MATH_AVX2);
+
+void pose_math_set_path(PoseMathPath path)
+{
+	active_path = best_path(path);
+}
+
+PoseMathPath pose_math_path()
+{
+	return active_path;
+}
+
+const char* pose_math_path_name(PoseMathPath path)
+{
+	static const char *names[POSE_MATH_PATH_COUNT] = { "scalar", "sse", "avx2" };
+	return path >= 0 && path < POSE_MATH_PATH_COUNT ? names[path] : "unknown";
+}
+
+static void run_view(const PoseSoA& p, int n, const ovrVector3f* viewOffsets, ovrVector3f worldOffset,
+	const float* proj, float (*view)[16], float (*viewProj)[16], SoABlock& block)
+{
+	ViewJob j;
+	j.p = p;
+	j.ox = j.oy = j.oz = nullptr;
+	if (viewOffsets)
+	{
+		block.LoadVectors(viewOffsets, n);
+		j.ox = block.vx;
+		j.oy = block.vy;
+		j.oz = block.vz;
+	}
+	j.wx = worldOffset.x;
+	j.wy = worldOffset.y;
+	j.wz = worldOffset.z;
+	j.proj = proj;
+	j.view = view;
+	j.viewProj = proj ? viewProj : nullptr;
+	view_kernels[active_path](j, 0, n);
+}
+
+static void run_model(const PoseSoA& p, int n, const ovrVector3f* scales, float* model, int stride, SoABlock& block)
+{
+	ModelJob j;
+	j.p = p;
+	j.sx = j.sy = j.sz = nullptr;
+	if (scales)
+	{
+		block.LoadVectors(scales, n);
+		j.sx = block.vx;
+		j.sy = block.vy;
+		j.sz = block.vz;
+	}
+	j.model = model;
+	j.stride = stride;
+	model_kernels[active_path](j, 0, n);
+}
+
+void pose_view_matrices(const ovrPosef* poses, int count, const ovrVector3f* viewOffsets, ovrVector3f worldOffset,
+	const float* proj, float (*view)[16], float (*viewProj)[16])
+{
+	SoABlock block;
+	for (int i = 0; i < count; i += POSE_BLOCK)
+	{
+		int n = count - i < POSE_BLOCK ? count - i : POSE_BLOCK;
+		run_view(block.Load(poses + i, n), n, viewOffsets ? viewOffsets + i : nullptr, worldOffset,
+			proj, view + i, viewProj ? viewProj + i : nullptr, block);
+	}
+}
+
+void pose_view_matrices_soa(const PoseSoA& poses, int count, const ovrVector3f* viewOffsets, ovrVector3f worldOffset,
+	const float* proj, float (*view)[16], float (*viewProj)[16])
+{
+	SoABlock block;
+	for (int i = 0; i < count; i += POSE_BLOCK)
+	{
+		int n = count - i < POSE_BLOCK ? count - i : POSE_BLOCK;
+		run_view(advance(poses, i), n, viewOffsets ? viewOffsets + i : nullptr, worldOffset,
+			proj, view + i, viewProj ? viewProj + i : nullptr, block);
+	}
+}
+
+void pose_model_matrices(const ovrPosef* poses, const ovrVector3f* scales, int count, float* model, int stride)
+{
+	SoABlock block;
+	for (int i = 0; i < count; i += POSE_BLOCK)
+	{
+		int n = count - i < POSE_BLOCK ? count - i : POSE_BLOCK;
+		run_model(block.Load(poses + i, n), n, scales ? scales + i : nullptr, model + (size_t)i * stride, stride, block);
+	}
+}
+
+void pose_model_matrices_soa(const PoseSoA& poses, const ovrVector3f* scales, int count, float* model, int stride)
+{
+	SoABlock block;
+	for (int i = 0; i < count; i += POSE_BLOCK)
+	{
+		int n = count - i < POSE_BLOCK ? count - i : POSE_BLOCK;
+		run_model(advance(poses, i), n, scales ? scales + i : nullptr, model + (size_t)i * stride, stride, block);
+	}
+}
@@ -0,0 +1,43 @@
+#pragma once
+
+#include <OVR_CAPI.h>
+
+// Batched pose to matrix kernels. Poses are processed in structure-of-arrays
+// form, four (SSE) or eight (AVX2) at a time, and the column-major matrices
+// are written out with in-register transposes. The ovrPosef entry points
+// repack their input into SoA blocks on the stack first; callers that keep
+// thousands of animated poses can hand over PoseSoA directly.
+//
+// The path is picked at startup from what the CPU supports; the scalar one
+// also handles the tail of a batch that does not fill a register.
+enum PoseMathPath
+{
+	POSE_MATH_SCALAR,
+	POSE_MATH_SSE,
+	POSE_MATH_AVX2,
+	POSE_MATH_PATH_COUNT
+};
+
+struct PoseSoA
+{
+	const float *qx, *qy, *qz, *qw; // orientation
+	const float *px, *py, *pz;      // position
+};
+
+// view = translate(viewOffset) * inverse(rotation) * translate(-(position + worldOffset))
+// viewOffsets (one per pose), proj and viewProj may be null; viewProj = proj * view.
+void pose_view_matrices(const ovrPosef* poses, int count, const ovrVector3f* viewOffsets, ovrVector3f worldOffset,
+	const float* proj, float (*view)[16], float (*viewProj)[16]);
+void pose_view_matrices_soa(const PoseSoA& poses, int count, const ovrVector3f* viewOffsets, ovrVector3f worldOffset,
+	const float* proj, float (*view)[16], float (*viewProj)[16]);
+
+// model = translate(position) * rotation * scale, written every stride floats
+// from model (16 for packed matrices, 20 for InstanceData.transform)
+void pose_model_matrices(const ovrPosef* poses, const ovrVector3f* scales, int count, float* model, int stride);
+void pose_model_matrices_soa(const PoseSoA& poses, const ovrVector3f* scales, int count, float* model, int stride);
+
+// falls back to the best supported path below the one asked for
+void pose_math_set_path(PoseMathPath path);
+PoseMathPath pose_math_path();
+bool pose_math_supported(PoseMathPath path);
+const char* pose_math_path_name(PoseMathPath path);
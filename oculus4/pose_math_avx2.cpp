@@ -0,0 +1,116 @@
+#include "pose_math_kernels.h"
+
+// Built with /arch:AVX2 under MSVC (set on this file only in the project);
+// GCC and Clang get the same from the target attribute.
+#ifdef POSE_MATH_SSE
+#include <immintrin.h>
+#ifdef _MSC_VER
+#define POSE_MATH_AVX2_TARGET
+#else
+#define POSE_MATH_AVX2_TARGET __attribute__((target("avx2,fma")))
+#endif
+
+// Eight lanes; the results are split into halves and transposed with the
+// same 4x4 shuffles as the SSE path, VEX encoded like everything here.
+static inline POSE_MATH_AVX2_TARGET void store_avx2(__m256* m, float* out, int stride)
+{
+	for (int half = 0; half < 2; ++half)
+	{
+		float *o = out + half * 4 * stride;
+		for (int c = 0; c < 16; c += 4)
+		{
+			__m128 a = half ? _mm256_extractf128_ps(m[c], 1) : _mm256_castps256_ps128(m[c]);
+			__m128 b = half ? _mm256_extractf128_ps(m[c + 1], 1) : _mm256_castps256_ps128(m[c + 1]);
+			__m128 d = half ? _mm256_extractf128_ps(m[c + 2], 1) : _mm256_castps256_ps128(m[c + 2]);
+			__m128 e = half ? _mm256_extractf128_ps(m[c + 3], 1) : _mm256_castps256_ps128(m[c + 3]);
+			_MM_TRANSPOSE4_PS(a, b, d, e);
+			_mm_storeu_ps(o + c, a);
+			_mm_storeu_ps(o + stride + c, b);
+			_mm_storeu_ps(o + 2 * stride + c, d);
+			_mm_storeu_ps(o + 3 * stride + c, e);
+		}
+	}
+}
+
+POSE_MATH_AVX2_TARGET void view_avx2(const ViewJob& j, int i, int n)
+{
+	const __m256 one = _mm256_set1_ps(1), zero = _mm256_setzero_ps();
+	const __m256 wox = _mm256_set1_ps(j.wx), woy = _mm256_set1_ps(j.wy), woz = _mm256_set1_ps(j.wz);
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(j.p.qx + i), y = _mm256_loadu_ps(j.p.qy + i);
+		__m256 z = _mm256_loadu_ps(j.p.qz + i), w = _mm256_loadu_ps(j.p.qw + i);
+		__m256 x2 = _mm256_add_ps(x, x), y2 = _mm256_add_ps(y, y), z2 = _mm256_add_ps(z, z);
+		__m256 xx = _mm256_mul_ps(x, x2), yy = _mm256_mul_ps(y, y2), zz = _mm256_mul_ps(z, z2);
+		__m256 xy = _mm256_mul_ps(x, y2), xz = _mm256_mul_ps(x, z2), yz = _mm256_mul_ps(y, z2);
+		__m256 wx = _mm256_mul_ps(w, x2), wy = _mm256_mul_ps(w, y2), wz = _mm256_mul_ps(w, z2);
+
+		__m256 m[16];
+		m[0] = _mm256_sub_ps(one, _mm256_add_ps(yy, zz)); m[4] = _mm256_add_ps(xy, wz); m[8] = _mm256_sub_ps(xz, wy);
+		m[1] = _mm256_sub_ps(xy, wz); m[5] = _mm256_sub_ps(one, _mm256_add_ps(xx, zz)); m[9] = _mm256_add_ps(yz, wx);
+		m[2] = _mm256_add_ps(xz, wy); m[6] = _mm256_sub_ps(yz, wx); m[10] = _mm256_sub_ps(one, _mm256_add_ps(xx, yy));
+		m[3] = m[7] = m[11] = zero;
+		m[15] = one;
+
+		__m256 tx = _mm256_sub_ps(zero, _mm256_add_ps(_mm256_loadu_ps(j.p.px + i), wox));
+		__m256 ty = _mm256_sub_ps(zero, _mm256_add_ps(_mm256_loadu_ps(j.p.py + i), woy));
+		__m256 tz = _mm256_sub_ps(zero, _mm256_add_ps(_mm256_loadu_ps(j.p.pz + i), woz));
+		m[12] = _mm256_fmadd_ps(m[0], tx, _mm256_fmadd_ps(m[4], ty, _mm256_fmadd_ps(m[8], tz, j.ox ? _mm256_loadu_ps(j.ox + i) : zero)));
+		m[13] = _mm256_fmadd_ps(m[1], tx, _mm256_fmadd_ps(m[5], ty, _mm256_fmadd_ps(m[9], tz, j.oy ? _mm256_loadu_ps(j.oy + i) : zero)));
+		m[14] = _mm256_fmadd_ps(m[2], tx, _mm256_fmadd_ps(m[6], ty, _mm256_fmadd_ps(m[10], tz, j.oz ? _mm256_loadu_ps(j.oz + i) : zero)));
+		store_avx2(m, j.view[i], 16);
+
+		if (j.viewProj)
+		{
+			__m256 vp[16];
+			for (int c = 0; c < 4; ++c)
+				for (int r = 0; r < 4; ++r)
+				{
+					__m256 s = c == 3 ? _mm256_set1_ps(j.proj[12 + r]) : zero;
+					s = _mm256_fmadd_ps(_mm256_set1_ps(j.proj[8 + r]), m[c * 4 + 2], s);
+					s = _mm256_fmadd_ps(_mm256_set1_ps(j.proj[4 + r]), m[c * 4 + 1], s);
+					vp[c * 4 + r] = _mm256_fmadd_ps(_mm256_set1_ps(j.proj[r]), m[c * 4], s);
+				}
+			store_avx2(vp, j.viewProj[i], 16);
+		}
+	}
+	_mm256_zeroupper();
+	view_scalar(j, i, n);
+}
+
+POSE_MATH_AVX2_TARGET void model_avx2(const ModelJob& j, int i, int n)
+{
+	const __m256 one = _mm256_set1_ps(1), zero = _mm256_setzero_ps();
+	for (; i + 8 <= n; i += 8)
+	{
+		__m256 x = _mm256_loadu_ps(j.p.qx + i), y = _mm256_loadu_ps(j.p.qy + i);
+		__m256 z = _mm256_loadu_ps(j.p.qz + i), w = _mm256_loadu_ps(j.p.qw + i);
+		__m256 x2 = _mm256_add_ps(x, x), y2 = _mm256_add_ps(y, y), z2 = _mm256_add_ps(z, z);
+		__m256 xx = _mm256_mul_ps(x, x2), yy = _mm256_mul_ps(y, y2), zz = _mm256_mul_ps(z, z2);
+		__m256 xy = _mm256_mul_ps(x, y2), xz = _mm256_mul_ps(x, z2), yz = _mm256_mul_ps(y, z2);
+		__m256 wx = _mm256_mul_ps(w, x2), wy = _mm256_mul_ps(w, y2), wz = _mm256_mul_ps(w, z2);
+		__m256 sx = j.sx ? _mm256_loadu_ps(j.sx + i) : one;
+		__m256 sy = j.sy ? _mm256_loadu_ps(j.sy + i) : one;
+		__m256 sz = j.sz ? _mm256_loadu_ps(j.sz + i) : one;
+
+		__m256 m[16];
+		m[0] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(yy, zz)), sx);
+		m[1] = _mm256_mul_ps(_mm256_add_ps(xy, wz), sx);
+		m[2] = _mm256_mul_ps(_mm256_sub_ps(xz, wy), sx);
+		m[4] = _mm256_mul_ps(_mm256_sub_ps(xy, wz), sy);
+		m[5] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, zz)), sy);
+		m[6] = _mm256_mul_ps(_mm256_add_ps(yz, wx), sy);
+		m[8] = _mm256_mul_ps(_mm256_add_ps(xz, wy), sz);
+		m[9] = _mm256_mul_ps(_mm256_sub_ps(yz, wx), sz);
+		m[10] = _mm256_mul_ps(_mm256_sub_ps(one, _mm256_add_ps(xx, yy)), sz);
+		m[3] = m[7] = m[11] = zero;
+		m[12] = _mm256_loadu_ps(j.p.px + i);
+		m[13] = _mm256_loadu_ps(j.p.py + i);
+		m[14] = _mm256_loadu_ps(j.p.pz + i);
+		m[15] = one;
+		store_avx2(m, j.model + (size_t)i * j.stride, j.stride);
+	}
+	_mm256_zeroupper();
+	model_scalar(j, i, n);
+}
+#endif
@@ -0,0 +1,38 @@
+#pragma once
+
+#include "pose_math.h"
+
+// Shared between pose_math.cpp and pose_math_avx2.cpp, which is built with
+// AVX2 code generation on its own so the rest of the program never emits
+// an instruction the CPU might lack.
+
+#if defined(_M_X64) || defined(__x86_64__) || defined(__SSE2__) || (defined(_M_IX86_FP) && _M_IX86_FP >= 2)
+#define POSE_MATH_SSE 1
+#endif
+
+struct ViewJob
+{
+	PoseSoA      p;
+	const float *ox, *oy, *oz; // view offsets, null for none
+	float        wx, wy, wz;   // world offset
+	const float *proj;         // null for no viewProj
+	float      (*view)[16];
+	float      (*viewProj)[16];
+};
+
+struct ModelJob
+{
+	PoseSoA      p;
+	const float *sx, *sy, *sz; // null for unit scale
+	float       *model;
+	int          stride;
+};
+
+// kernels compute matrices i..n-1 of a job
+void view_scalar(const ViewJob& j, int i, int n);
+void model_scalar(const ModelJob& j, int i, int n);
+#ifdef POSE_MATH_SSE
+// only called once the CPU reported AVX2 and FMA
+void view_avx2(const ViewJob& j, int i, int n);
+void model_avx2(const ModelJob& j, int i, int n);
+#endif
@@ -0,0 +1,167 @@
+#include "quad_layer.h"
+#include "gpu_resources.h"
+#include <stdio.h>
+
+struct QuadLayerEntry
+{
+	bool               used;
+	QuadLayerDesc      desc;
+	TextureBuffer     *target;
+	int                generation; // of target's set the layer was drawn into
+	ovrLayerQuad       layer;
+	bool               visible;
+	bool               dirty;
+	bool               drawn; // the set holds a finished image
+	int                age;   // frames since the last redraw
+};
+
+static Compositor *quad_compositor;
+static QuadLayerEntry entries[QUAD_LAYER_MAX];
+
+static QuadLayerEntry* get(QuadLayerHandle handle)
+{
+	if (handle < 0 || handle >= QUAD_LAYER_MAX || !entries[handle].used)
+		return nullptr;
+	return &entries[handle];
+}
+
+void quad_layers_init(Compositor* compositor)
+{
+	quad_compositor = compositor;
+}
+
+void quad_layers_shutdown()
+{
+	for (int i = 0; i < QUAD_LAYER_MAX; ++i)
+		quad_layer_destroy(i);
+	quad_compositor = nullptr;
+}
+
+QuadLayerHandle quad_layer_create(const QuadLayerDesc& desc)
+{
+	int i = 0;
+	while (i < QUAD_LAYER_MAX && entries[i].used)
+		++i;
+	if (i == QUAD_LAYER_MAX || !quad_compositor || !desc.draw)
+		return -1;
+
+	QuadLayerEntry& e = entries[i];
+	ovrSizei size = { desc.width, desc.height };
+	e.target = new TextureBuffer(size, 0, false);
+	if (!e.target->Valid())
+	{
+		fprintf(stderr, "Failed to create a %dx%d quad layer texture set.\n", desc.width, desc.height);
+		delete e.target;
+		e.target = nullptr;
+		return -1;
+	}
+	e.generation = e.target->generation;
+
+	e.used = true;
+	e.desc = desc;
+	e.visible = true;
+	e.dirty = true;
+	e.drawn = false;
+	e.age = 0;
+
+	e.layer.Header.Type = ovrLayerType_Quad;
+	e.layer.Header.Flags = ovrLayerFlag_TextureOriginAtBottomLeft | (desc.headLocked ? ovrLayerFlag_HeadLocked : 0);
+	e.layer.ColorTexture = e.target->TextureSet;
+	e.layer.Viewport.Pos.x = e.layer.Viewport.Pos.y = 0;
+	e.layer.Viewport.Size.w = desc.width;
+	e.layer.Viewport.Size.h = desc.height;
+	e.layer.QuadPoseCenter = desc.pose;
+	e.layer.QuadSize = desc.size;
+	return i;
+}
+
+void quad_layer_destroy(QuadLayerHandle handle)
+{
+	QuadLayerEntry *e = get(handle);
+	if (!e)
+		return;
+	delete e->target;
+	e->target = nullptr;
+	e->used = false;
+}
+
+void quad_layer_mark_dirty(QuadLayerHandle handle)
+{
+	if (QuadLayerEntry *e = get(handle))
+		e->dirty = true;
+}
+
+void quad_layer_set_pose(QuadLayerHandle handle, const ovrPosef& pose, const ovrVector2f& size)
+{
+	// placement is the compositor's job, no redraw needed
+	if (QuadLayerEntry *e = get(handle))
+	{
+		e->layer.QuadPoseCenter = pose;
+		e->layer.QuadSize = size;
+	}
+}
+
+void quad_layer_set_visible(QuadLayerHandle handle, bool visible)
+{
+	QuadLayerEntry *e = get(handle);
+	if (!e)
+		return;
+	// hidden layers are not updated, so bring it up to date on showing it
+	if (visible && !e->visible)
+		e->dirty = true;
+	e->visible = visible;
+}
+
+bool quad_layer_visible(QuadLayerHandle handle)
+{
+	QuadLayerEntry *e = get(handle);
+	return e && e->visible;
+}
+
+int quad_layers_update()
+{
+	int drawn = 0;
+	for (int i = 0; i < QUAD_LAYER_MAX; ++i)
+	{
+		QuadLayerEntry& e = entries[i];
+		if (!e.used || !e.visible || !e.target->Valid())
+			continue;
+		if (e.generation != e.target->generation)
+		{
+			// a new set after a lost session, nothing in it yet
+			e.generation = e.target->generation;
+			e.layer.ColorTexture = e.target->TextureSet;
+			e.dirty = true;
+			e.drawn = false;
+		}
+		++e.age;
+		if (!e.dirty && !(e.desc.interval > 0 && e.age >= e.desc.interval))
+			continue;
+
+		// a texture the compositor is not showing right now
+		ovrSwapTextureSet *set = e.target->TextureSet;
+		set->CurrentIndex = (set->CurrentIndex + 1) % set->TextureCount;
+		glBindFramebuffer(GL_FRAMEBUFFER, e.target->Framebuffer());
+		glViewport(0, 0, e.desc.width, e.desc.height);
+		e.desc.draw(e.desc.width, e.desc.height, e.desc.user);
+		e.dirty = false;
+		e.drawn = true;
+		e.age = 0;
+		++drawn;
+	}
+	if (drawn)
+		glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return drawn;
+}
+
+int quad_layers_append(ovrLayerHeader const** layers, int maxLayers)
+{
+	int n = 0;
+	for (int i = 0; i < QUAD_LAYER_MAX && n < maxLayers; ++i)
+	{
+		const QuadLayerEntry& e = entries[i];
+		if (e.used && e.visible && e.drawn && e.generation == e.target->generation)
+			layers[n++] = &e.layer.Header;
+	}
+	return n;
+}
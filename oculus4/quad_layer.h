@@ -0,0 +1,59 @@
+#pragma once
+
+#include <stddef.h>
+#include <GL/glew.h>
+#include <OVR_CAPI_GL.h>
+#include "compositor.h"
+
+#define QUAD_LAYER_MAX 8
+
+// Quad layers for panels and HUDs. Each has its own swap texture set and is
+// submitted next to the eye layer, so the compositor places it every frame
+// while the app only redraws it when it was marked dirty or its interval
+// has passed. On the other frames the texture set keeps its CurrentIndex
+// and the panel costs nothing to render.
+// The sets are gpu_resources TextureBuffers; after a lost session a layer
+// is left out until it has been drawn into its new set.
+typedef int QuadLayerHandle; // < 0 is invalid
+
+// draws into the bound framebuffer, viewport already set to w x h
+typedef void (*QuadLayerDraw)(int w, int h, void* user);
+
+struct QuadLayerDesc
+{
+	int           width, height; // texture size in pixels
+	ovrPosef      pose;          // centre, in tracking space or relative to the head
+	ovrVector2f   size;          // metres
+	bool          headLocked;
+	int           interval;      // also redraw every interval-th frame, 0 only when dirty
+	QuadLayerDraw draw;
+	void         *user;
+
+	QuadLayerDesc() : width(512), height(256), headLocked(false), interval(0), draw(NULL), user(NULL)
+	{
+		pose.Orientation.x = pose.Orientation.y = pose.Orientation.z = 0;
+		pose.Orientation.w = 1;
+		pose.Position.x = pose.Position.y = 0;
+		pose.Position.z = -1;
+		size.x = 1.0f;
+		size.y = 0.5f;
+	}
+};
+
+void quad_layers_init(Compositor* compositor);
+void quad_layers_shutdown();
+
+// dirty and visible from the start, -1 if the texture set cannot be made
+QuadLayerHandle quad_layer_create(const QuadLayerDesc& desc);
+void quad_layer_destroy(QuadLayerHandle handle);
+void quad_layer_mark_dirty(QuadLayerHandle handle);
+void quad_layer_set_pose(QuadLayerHandle handle, const ovrPosef& pose, const ovrVector2f& size);
+void quad_layer_set_visible(QuadLayerHandle handle, bool visible);
+bool quad_layer_visible(QuadLayerHandle handle);
+
+// Once per frame on the GL thread: redraws the visible layers that are
+// dirty or due into the next texture of their set. Returns how many were
+// drawn; leaves framebuffer 0 bound.
+int quad_layers_update();
+// the headers of the visible layers, for SubmitFrame after the eye layer
+int quad_layers_append(ovrLayerHeader const** layers, int maxLayers);
@@ -0,0 +1,72 @@
+#include "render_queue.h"
+#include <string.h>
+
+uint64_t render_key(GLuint program, GLuint texture, float depth)
+{
+	uint32_t d = 0;
+	if (depth > 0)
+		memcpy(&d, &depth, sizeof(d));
+	return (uint64_t)(program & 0xff) << RENDER_KEY_PROGRAM_SHIFT |
+		(uint64_t)(texture & 0xffffff) << RENDER_KEY_TEXTURE_SHIFT | d;
+}
+
+void RenderQueue::Clear()
+{
+	items.clear();
+}
+
+void RenderQueue::Add(InstanceBuffer* buffer, float depth)
+{
+	if (!buffer->count)
+		return;
+	RenderItem item;
+	item.key = render_key(instanced_program(), buffer->texture, depth);
+	item.buffer = buffer;
+	items.push_back(item);
+}
+
+void RenderQueue::Sort()
+{
+	size_t n = items.size();
+	if (n < 2)
+		return;
+	scratch.resize(n);
+
+	size_t hist[8][256];
+	memset(hist, 0, sizeof(hist));
+	for (size_t i = 0; i < n; ++i)
+		for (int b = 0; b < 8; ++b)
+			++hist[b][(items[i].key >> (b * 8)) & 0xff];
+
+	RenderItem *src = &items[0], *dst = &scratch[0];
+	for (int b = 0; b < 8; ++b)
+	{
+		size_t *h = hist[b];
+		int shift = b * 8;
+		// every key has the same digit here, the pass would not move anything
+		if (h[(src[0].key >> shift) & 0xff] == n)
+			continue;
+		size_t offset = 0;
+		for (int d = 0; d < 256; ++d)
+		{
+			size_t c = h[d];
+			h[d] = offset;
+			offset += c;
+		}
+		for (size_t i = 0; i < n; ++i)
+			dst[h[(src[i].key >> shift) & 0xff]++] = src[i];
+		RenderItem *t = src;
+		src = dst;
+		dst = t;
+	}
+	if (src != &items[0])
+		items.swap(scratch);
+}
+
+void RenderQueue::Submit() const
+{
+	DrawState state;
+	for (size_t i = 0; i < items.size(); ++i)
+		items[i].buffer->Draw(state);
+	instanced_end_draws(state);
+}
@@ -0,0 +1,40 @@
+#pragma once
+
+#include <vector>
+#include <stdint.h>
+#include "instanced.h"
+
+// 64-bit sort key, most significant first: program (8 bits), texture
+// (24 bits), view depth (32 bits, the float's bit pattern, so front to back
+// for depths >= 0). GL names are truncated to fit; a collision only costs
+// a redundant bind, never a wrong one.
+#define RENDER_KEY_PROGRAM_SHIFT 56
+#define RENDER_KEY_TEXTURE_SHIFT 32
+
+struct RenderItem
+{
+	uint64_t        key;
+	InstanceBuffer *buffer;
+};
+
+// The draws of one frame, filled after culling and radix sorted once, then
+// submitted for each eye (or the single stereo pass) in the same order.
+// Submission keeps a DrawState across the draws, so program, texture and
+// uniform changes are only made where neighbouring items differ; what is
+// actually changed is counted in the frame stats.
+struct RenderQueue
+{
+	std::vector<RenderItem> items;
+
+	void Clear();
+	// buffers with nothing to draw are left out
+	void Add(InstanceBuffer* buffer, float depth);
+	// LSD radix sort on 8-bit digits, skipping digits all keys share
+	void Sort();
+	void Submit() const;
+
+private:
+	std::vector<RenderItem> scratch;
+};
+
+uint64_t render_key(GLuint program, GLuint texture, float depth);
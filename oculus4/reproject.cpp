@@ -0,0 +1,285 @@
+#include "reproject.h"
+#include "mesh.h"
+#include "shader.h"
+#include "frame_stats.h"
+#include <stdio.h>
+#include <string.h>
+#include <vector>
+
+struct ReprojectEye
+{
+	bool               valid;
+	ovrSwapTextureSet *set;
+	int                index;      // texture of the set holding the image
+	GLuint             depth;
+	ovrRecti           viewport;
+	float              invViewProj[16];
+};
+
+static ReprojectConfig cfg;
+static ReprojectEye eyes[2];
+static ReprojectStats counters;
+static int consecutive;
+static StaticMesh *grid;
+static GLuint warp_prog, warp_fbo, warp_depth;
+static int warp_depth_w, warp_depth_h;
+static GLint loc_matrix, loc_src_rect, loc_cell, loc_color_tex, loc_depth_tex;
+static ovrSwapTextureSet *advanced[2]; // sets already moved on this frame
+
+static const char *warp_vs =
+	"#version 330 compatibility\n"
+	"layout(location = 0) in vec3 in_pos;\n" // xy in [0, 1] over the stored image
+	"uniform mat4 reproject;\n"              // new viewProj * inverse(old viewProj)
+	"uniform vec4 src_rect;\n"               // the image in texture coordinates, xy offset, zw size
+	"uniform vec2 cell;\n"                   // half a grid cell in texture coordinates
+	"uniform sampler2D depth_tex;\n"
+	"out vec2 uv;\n"
+	// the hidden area mask is at depth 0, nothing real is; take it as far away
+	"float depth_at(vec2 p){\n"
+	"	float d = textureLod(depth_tex, clamp(p, src_rect.xy, src_rect.xy + src_rect.zw), 0.0).r;\n"
+	"	return d > 0.0 ? d : 1.0;\n"
+	"}\n"
+	"void main(){\n"
+	"	uv = src_rect.xy + in_pos.xy * src_rect.zw;\n"
+	// the nearest depth around the vertex, so foreground edges grow rather than tear
+	"	float d = min(depth_at(uv), min(min(depth_at(uv - cell), depth_at(uv + cell)),\n"
+	"		min(depth_at(uv + vec2(cell.x, -cell.y)), depth_at(uv + vec2(-cell.x, cell.y)))));\n"
+	"	gl_Position = reproject * vec4(in_pos.xy * 2.0 - 1.0, d * 2.0 - 1.0, 1.0);\n"
+	"}\n";
+
+static const char *warp_fs =
+	"#version 330 compatibility\n"
+	"uniform sampler2D color_tex;\n"
+	"in vec2 uv;\n"
+	"void main(){\n"
+	"	gl_FragColor = texture(color_tex, uv);\n"
+	"}\n";
+
+// column-major a * b
+static void mul(const float* a, const float* b, float* out)
+{
+	for (int c = 0; c < 4; ++c)
+		for (int r = 0; r < 4; ++r)
+			out[c * 4 + r] = a[r] * b[c * 4] + a[4 + r] * b[c * 4 + 1] + a[8 + r] * b[c * 4 + 2] + a[12 + r] * b[c * 4 + 3];
+}
+
+// general inverse by cofactors, false when singular
+static bool invert(const float* m, float* out)
+{
+	float inv[16];
+	inv[0] = m[5] * m[10] * m[15] - m[5] * m[11] * m[14] - m[9] * m[6] * m[15] + m[9] * m[7] * m[14] + m[13] * m[6] * m[11] - m[13] * m[7] * m[10];
+	inv[4] = -m[4] * m[10] * m[15] + m[4] * m[11] * m[14] + m[8] * m[6] * m[15] - m[8] * m[7] * m[14] - m[12] * m[6] * m[11] + m[12] * m[7] * m[10];
+	inv[8] = m[4] * m[9] * m[15] - m[4] * m[11] * m[13] - m[8] * m[5] * m[15] + m[8] * m[7] * m[13] + m[12] * m[5] * m[11] - m[12] * m[7] * m[9];
+	inv[12] = -m[4] * m[9] * m[14] + m[4] * m[10] * m[13] + m[8] * m[5] * m[14] - m[8] * m[6] * m[13] - m[12] * m[5] * m[10] + m[12] * m[6] * m[9];
+	inv[1] = -m[1] * m[10] * m[15] + m[1] * m[11] * m[14] + m[9] * m[2] * m[15] - m[9] * m[3] * m[14] - m[13] * m[2] * m[11] + m[13] * m[3] * m[10];
+	inv[5] = m[0] * m[10] * m[15] - m[0] * m[11] * m[14] - m[8] * m[2] * m[15] + m[8] * m[3] * m[14] + m[12] * m[2] * m[11] - m[12] * m[3] * m[10];
+	inv[9] = -m[0] * m[9] * m[15] + m[0] * m[11] * m[13] + m[8] * m[1] * m[15] - m[8] * m[3] * m[13] - m[12] * m[1] * m[11] + m[12] * m[3] * m[9];
+	inv[13] = m[0] * m[9] * m[14] - m[0] * m[10] * m[13] - m[8] * m[1] * m[14] + m[8] * m[2] * m[13] + m[12] * m[1] * m[10] - m[12] * m[2] * m[9];
+	inv[2] = m[1] * m[6] * m[15] - m[1] * m[7] * m[14] - m[5] * m[2] * m[15] + m[5] * m[3] * m[14] + m[13] * m[2] * m[7] - m[13] * m[3] * m[6];
+	inv[6] = -m[0] * m[6] * m[15] + m[0] * m[7] * m[14] + m[4] * m[2] * m[15] - m[4] * m[3] * m[14] - m[12] * m[2] * m[7] + m[12] * m[3] * m[6];
+	inv[10] = m[0] * m[5] * m[15] - m[0] * m[7] * m[13] - m[4] * m[1] * m[15] + m[4] * m[3] * m[13] + m[12] * m[1] * m[7] - m[12] * m[3] * m[5];
+	inv[14] = -m[0] * m[5] * m[14] + m[0] * m[6] * m[13] + m[4] * m[1] * m[14] - m[4] * m[2] * m[13] - m[12] * m[1] * m[6] + m[12] * m[2] * m[5];
+	inv[3] = -m[1] * m[6] * m[11] + m[1] * m[7] * m[10] + m[5] * m[2] * m[11] - m[5] * m[3] * m[10] - m[9] * m[2] * m[7] + m[9] * m[3] * m[6];
+	inv[7] = m[0] * m[6] * m[11] - m[0] * m[7] * m[10] - m[4] * m[2] * m[11] + m[4] * m[3] * m[10] + m[8] * m[2] * m[7] - m[8] * m[3] * m[6];
+	inv[11] = -m[0] * m[5] * m[11] + m[0] * m[7] * m[9] + m[4] * m[1] * m[11] - m[4] * m[3] * m[9] - m[8] * m[1] * m[7] + m[8] * m[3] * m[5];
+	inv[15] = m[0] * m[5] * m[10] - m[0] * m[6] * m[9] - m[4] * m[1] * m[10] + m[4] * m[2] * m[9] + m[8] * m[1] * m[6] - m[8] * m[2] * m[5];
+
+	float det = m[0] * inv[0] + m[1] * inv[4] + m[2] * inv[8] + m[3] * inv[12];
+	if (det == 0)
+		return false;
+	for (int i = 0; i < 16; ++i)
+		out[i] = inv[i] / det;
+	return true;
+}
+
+void reproject_init(const ReprojectConfig& config)
+{
+	cfg = config;
+	memset(eyes, 0, sizeof(eyes));
+	memset(&counters, 0, sizeof(counters));
+	consecutive = 0;
+
+	warp_prog = shader_program(warp_vs, warp_fs, "reprojection");
+	loc_matrix = glGetUniformLocation(warp_prog, "reproject");
+	loc_src_rect = glGetUniformLocation(warp_prog, "src_rect");
+	loc_cell = glGetUniformLocation(warp_prog, "cell");
+	loc_color_tex = glGetUniformLocation(warp_prog, "color_tex");
+	loc_depth_tex = glGetUniformLocation(warp_prog, "depth_tex");
+
+	std::vector<MeshVertex> vertices;
+	std::vector<GLushort> indices;
+	for (int y = 0; y <= REPROJECT_GRID_Y; ++y)
+	{
+		for (int x = 0; x <= REPROJECT_GRID_X; ++x)
+		{
+			MeshVertex v = {};
+			v.pos[0] = (float)x / REPROJECT_GRID_X;
+			v.pos[1] = (float)y / REPROJECT_GRID_Y;
+			vertices.push_back(v);
+		}
+	}
+	for (int y = 0; y < REPROJECT_GRID_Y; ++y)
+	{
+		for (int x = 0; x < REPROJECT_GRID_X; ++x)
+		{
+			GLushort i0 = (GLushort)(y * (REPROJECT_GRID_X + 1) + x), i1 = i0 + 1;
+			GLushort i2 = (GLushort)(i0 + REPROJECT_GRID_X + 1), i3 = i2 + 1;
+			GLushort quad[6] = { i0, i1, i3, i0, i3, i2 };
+			indices.insert(indices.end(), quad, quad + 6);
+		}
+	}
+	grid = new StaticMesh(&vertices[0], (int)vertices.size(), &indices[0], (int)indices.size());
+
+	glGenFramebuffers(1, &warp_fbo);
+	glGenRenderbuffers(1, &warp_depth);
+	warp_depth_w = warp_depth_h = 0;
+}
+
+void reproject_shutdown()
+{
+	delete grid;
+	grid = nullptr;
+	if (warp_prog)
+	{
+		glDeleteProgram(warp_prog);
+		glDeleteFramebuffers(1, &warp_fbo);
+		glDeleteRenderbuffers(1, &warp_depth);
+		warp_prog = warp_fbo = warp_depth = 0;
+	}
+	memset(eyes, 0, sizeof(eyes));
+}
+
+void reproject_store(int eye, ovrSwapTextureSet* set, GLuint depthTexture, const ovrRecti& viewport,
+	const float* view, const float* proj)
+{
+	ReprojectEye& e = eyes[eye];
+	float viewProj[16];
+	mul(proj, view, viewProj);
+	e.valid = invert(viewProj, e.invViewProj);
+	e.set = set;
+	e.index = set->CurrentIndex;
+	e.depth = depthTexture;
+	e.viewport = viewport;
+}
+
+void reproject_invalidate()
+{
+	eyes[0].valid = eyes[1].valid = false;
+}
+
+bool reproject_decide(const ovrSwapTextureSet* const sets[2], bool predictedMiss, bool visible)
+{
+	++counters.frames;
+	bool available = cfg.enabled;
+	for (int i = 0; i < 2 && available; ++i)
+		available = eyes[i].valid && eyes[i].set == sets[i] && sets[i]->TextureCount > 1;
+
+	// a frame nobody sees can always be warped; for predicted misses one
+	// has to be rendered now and then or the image would never change
+	bool reproject = available && (!visible || (predictedMiss && consecutive < cfg.maxConsecutive));
+	if (!reproject)
+	{
+		consecutive = 0;
+		return false;
+	}
+	++counters.reprojected;
+	if (visible)
+	{
+		++counters.predicted;
+		++consecutive;
+	}
+	else
+		++counters.hidden;
+	return true;
+}
+
+void reproject_begin_frame()
+{
+	advanced[0] = advanced[1] = nullptr;
+	glUseProgram(warp_prog);
+	glUniform1i(loc_color_tex, 0);
+	glUniform1i(loc_depth_tex, 1);
+	glDisable(GL_CULL_FACE);
+}
+
+bool reproject_eye(int eye, const float* view, const float* proj, ovrRecti& viewport)
+{
+	ReprojectEye& e = eyes[eye];
+	if (!e.valid)
+		return false;
+
+	// the next texture of the set, stepping over the one holding the image;
+	// with single-pass stereo both eyes share it and it moves on once
+	ovrSwapTextureSet *set = e.set;
+	if (advanced[0] != set && advanced[1] != set)
+	{
+		int next = (set->CurrentIndex + 1) % set->TextureCount;
+		if (next == e.index)
+			next = (next + 1) % set->TextureCount;
+		set->CurrentIndex = next;
+		advanced[eye] = set;
+	}
+	const ovrGLTexture *src = (const ovrGLTexture*)&set->Textures[e.index];
+	const ovrGLTexture *dst = (const ovrGLTexture*)&set->Textures[set->CurrentIndex];
+	int tw = src->OGL.Header.TextureSize.w, th = src->OGL.Header.TextureSize.h;
+
+	if (tw > warp_depth_w || th > warp_depth_h)
+	{
+		warp_depth_w = tw > warp_depth_w ? tw : warp_depth_w;
+		warp_depth_h = th > warp_depth_h ? th : warp_depth_h;
+		glBindRenderbuffer(GL_RENDERBUFFER, warp_depth);
+		glRenderbufferStorage(GL_RENDERBUFFER, GL_DEPTH_COMPONENT24, warp_depth_w, warp_depth_h);
+		glBindRenderbuffer(GL_RENDERBUFFER, 0);
+	}
+	// the eye framebuffers have the stored depth attached, draw through one of our own
+	glBindFramebuffer(GL_FRAMEBUFFER, warp_fbo);
+	glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, dst->OGL.TexId, 0);
+	glFramebufferRenderbuffer(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_RENDERBUFFER, warp_depth);
+
+	viewport = e.viewport;
+	glViewport(viewport.Pos.x, viewport.Pos.y, viewport.Size.w, viewport.Size.h);
+	glEnable(GL_SCISSOR_TEST);
+	glScissor(viewport.Pos.x, viewport.Pos.y, viewport.Size.w, viewport.Size.h);
+	glClear(GL_COLOR_BUFFER_BIT | GL_DEPTH_BUFFER_BIT);
+	glDisable(GL_SCISSOR_TEST);
+
+	float viewProj[16], m[16];
+	mul(proj, view, viewProj);
+	mul(viewProj, e.invViewProj, m);
+	glUniformMatrix4fv(loc_matrix, 1, GL_FALSE, m);
+	glUniform4f(loc_src_rect, (float)viewport.Pos.x / tw, (float)viewport.Pos.y / th,
+		(float)viewport.Size.w / tw, (float)viewport.Size.h / th);
+	glUniform2f(loc_cell, 0.5f * viewport.Size.w / (tw * REPROJECT_GRID_X), 0.5f * viewport.Size.h / (th * REPROJECT_GRID_Y));
+
+	glActiveTexture(GL_TEXTURE1);
+	glBindTexture(GL_TEXTURE_2D, e.depth);
+	glActiveTexture(GL_TEXTURE0);
+	glBindTexture(GL_TEXTURE_2D, src->OGL.TexId);
+	grid->Draw();
+	stats_count_state(9); // framebuffer and attachments, uniforms, textures
+	return true;
+}
+
+void reproject_end_frame()
+{
+	glEnable(GL_CULL_FACE);
+	glUseProgram(0);
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+}
+
+void reproject_set_enabled(bool enabled)
+{
+	cfg.enabled = enabled;
+	if (!enabled)
+		consecutive = 0;
+}
+
+bool reproject_enabled()
+{
+	return cfg.enabled;
+}
+
+void reproject_get_stats(ReprojectStats& stats)
+{
+	stats = counters;
+}
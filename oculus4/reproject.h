@@ -0,0 +1,58 @@
+#pragma once
+
+#include <GL/glew.h>
+#include <OVR_CAPI_GL.h>
+
+#define REPROJECT_GRID_X 96 // warp grid cells across an eye image
+#define REPROJECT_GRID_Y 96
+
+// App-side reprojection for frames that would miss their deadline (or are
+// not shown at all). The last fully rendered image of each eye stays in
+// its swap texture set together with the eye depth texture; instead of
+// drawing the scene, a grid over that image is displaced by its depth,
+// moved from the view it was rendered with to the newest one and drawn
+// into the next texture of the set. Nearer surfaces win through a depth
+// test of their own, holes opened at silhouettes stretch the grid over
+// them. The stored image is never overwritten by a reprojected frame.
+struct ReprojectConfig
+{
+	bool enabled;
+	int  maxConsecutive; // reprojected frames in a row for predicted misses, then one is rendered
+
+	ReprojectConfig() : enabled(true), maxConsecutive(1) {}
+};
+
+struct ReprojectStats
+{
+	long long frames;      // frames decided on
+	long long reprojected;
+	long long predicted;   // of those, because the frame would have missed its deadline
+	long long hidden;      // because the previous submit said it is not visible
+};
+
+// needs a current GL context
+void reproject_init(const ReprojectConfig& config);
+void reproject_shutdown();
+
+// After an eye was rendered in full: the image at the set's CurrentIndex in
+// viewport, with depth in depthTexture, seen through proj * view (column-major).
+void reproject_store(int eye, ovrSwapTextureSet* set, GLuint depthTexture, const ovrRecti& viewport,
+	const float* view, const float* proj);
+// the stored images can no longer be used, e.g. the eye depth was not written
+void reproject_invalidate();
+
+// Once a frame: whether to reproject instead of rendering, given the sets
+// this frame submits. Also counts the decision.
+bool reproject_decide(const ovrSwapTextureSet* const sets[2], bool predictedMiss, bool visible);
+
+// reprojected frame: advance each set once, then warp both eyes
+void reproject_begin_frame();
+// the stored image of eye as seen through proj * view, into its set's new
+// texture; viewport is where it lies, for the layer
+bool reproject_eye(int eye, const float* view, const float* proj, ovrRecti& viewport);
+// leaves framebuffer 0 bound
+void reproject_end_frame();
+
+void reproject_set_enabled(bool enabled);
+bool reproject_enabled();
+void reproject_get_stats(ReprojectStats& stats);
@@ -0,0 +1,70 @@
+#include "resolution.h"
+#include <math.h>
+
+ResolutionController::ResolutionController() :
+	enabled(true),
+	budgetMs(8.0f),
+	highWater(0.95f),
+	lowWater(0.75f),
+	minScale(0.5f),
+	maxScale(1.0f),
+	maxStep(0.1f),
+	cooldownFrames(15),
+	scale(1.0f),
+	smoothedMs(-1.0f),
+	cooldown(0)
+{
+}
+
+void ResolutionController::SetRefreshRate(float hz)
+{
+	if (hz > 0)
+		budgetMs = 0.8f * 1000.0f / hz;
+}
+
+bool ResolutionController::AddSample(float gpuMs)
+{
+	smoothedMs = smoothedMs < 0 ? gpuMs : smoothedMs * 0.8f + gpuMs * 0.2f;
+	if (!enabled)
+		return false;
+	if (cooldown > 0)
+	{
+		--cooldown;
+		return false;
+	}
+	if (smoothedMs <= budgetMs * highWater && smoothedMs >= budgetMs * lowWater)
+		return false;
+	if (smoothedMs < budgetMs * lowWater && scale >= maxScale)
+		return false;
+
+	// aim for the middle of the band
+	float target = budgetMs * 0.5f * (highWater + lowWater);
+	float wanted = scale * sqrtf(target / (smoothedMs > 0.01f ? smoothedMs : 0.01f));
+	if (wanted > scale + maxStep)
+		wanted = scale + maxStep;
+	if (wanted < scale - maxStep)
+		wanted = scale - maxStep;
+	if (wanted > maxScale)
+		wanted = maxScale;
+	if (wanted < minScale)
+		wanted = minScale;
+	if (fabsf(wanted - scale) < 0.01f)
+		return false;
+
+	// the old samples describe the old resolution
+	smoothedMs *= (wanted * wanted) / (scale * scale);
+	scale = wanted;
+	cooldown = cooldownFrames;
+	return true;
+}
+
+void ResolutionController::Apply(int w, int h, int& outW, int& outH) const
+{
+	float s = enabled ? scale : maxScale;
+	outW = (int)(w * s + 0.5f);
+	outH = (int)(h * s + 0.5f);
+	if (outW < 1) outW = 1;
+	if (outH < 1) outH = 1;
+	if (outW > w) outW = w;
+	if (outH > h) outH = h;
+}
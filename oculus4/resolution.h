@@ -0,0 +1,35 @@
+#pragma once
+
+// Picks the fraction of the allocated eye buffer to render into from the
+// measured GPU time of eye rendering. The swap textures keep their full
+// size; only the viewport (and layer.Viewport) shrinks or grows.
+//
+// GPU time is assumed to follow the pixel count, so the scale moves towards
+// sqrt(target / measured). Changes only happen when the smoothed time
+// leaves the [lowWater, highWater] band around the budget, and then not
+// again for cooldownFrames, which covers the few frames of GPU query latency
+// and keeps the resolution from oscillating.
+struct ResolutionController
+{
+	bool  enabled;
+	float budgetMs;       // GPU time allowed for eye rendering
+	float highWater;      // shrink above budget * highWater
+	float lowWater;       // grow below budget * lowWater
+	float minScale;
+	float maxScale;
+	float maxStep;        // largest change of scale per adjustment
+	int   cooldownFrames;
+
+	float scale;          // current per-axis scale
+	float smoothedMs;     // exponential moving average of the samples
+	int   cooldown;
+
+	ResolutionController();
+
+	// budget from the display rate, leaving room for the compositor
+	void SetRefreshRate(float hz);
+	// feed one GPU sample, returns true if scale changed
+	bool AddSample(float gpuMs);
+	// size of the rendered region inside a buffer of size w x h
+	void Apply(int w, int h, int& outW, int& outH) const;
+};
@@ -0,0 +1,37 @@
+#pragma once
+
+#include <atomic>
+
+// Fixed size single-producer/single-consumer queue. Push() is only called
+// from one thread and Pop() from one other thread; neither ever blocks.
+template<typename T, unsigned int N>
+struct SpscRing
+{
+	T                         items[N];
+	std::atomic<unsigned int> head; // next slot to write, owned by the producer
+	std::atomic<unsigned int> tail; // next slot to read, owned by the consumer
+
+	SpscRing() : head(0), tail(0) {}
+
+	// false when full, the item is dropped
+	bool Push(const T& item)
+	{
+		unsigned int h = head.load(std::memory_order_relaxed);
+		if (h - tail.load(std::memory_order_acquire) == N)
+			return false;
+		items[h % N] = item;
+		head.store(h + 1, std::memory_order_release);
+		return true;
+	}
+
+	// false when empty
+	bool Pop(T& item)
+	{
+		unsigned int t = tail.load(std::memory_order_relaxed);
+		if (t == head.load(std::memory_order_acquire))
+			return false;
+		item = items[t % N];
+		tail.store(t + 1, std::memory_order_release);
+		return true;
+	}
+};
@@ -0,0 +1,227 @@
+#include "scene_file.h"
+#include <stdio.h>
+#include <string.h>
+#include <map>
+#include <string>
+#include <utility>
+#ifdef _WIN32
+#define WIN32_LEAN_AND_MEAN
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+#endif
+#include <OVR_CAPI.h>
+
+struct MappedFile
+{
+	const unsigned char* data;
+	size_t               size;
+#ifdef _WIN32
+	HANDLE               file, mapping;
+#endif
+};
+
+static bool map_file(const char* path, MappedFile& m)
+{
+	m.data = nullptr;
+	m.size = 0;
+#ifdef _WIN32
+	m.file = CreateFileA(path, GENERIC_READ, FILE_SHARE_READ, NULL, OPEN_EXISTING, FILE_FLAG_SEQUENTIAL_SCAN, NULL);
+	if (m.file == INVALID_HANDLE_VALUE)
+		return false;
+	LARGE_INTEGER size;
+	GetFileSizeEx(m.file, &size);
+	m.size = (size_t)size.QuadPart;
+	m.mapping = CreateFileMappingA(m.file, NULL, PAGE_READONLY, 0, 0, NULL);
+	if (m.mapping)
+		m.data = (const unsigned char*)MapViewOfFile(m.mapping, FILE_MAP_READ, 0, 0, 0);
+	if (!m.data)
+	{
+		if (m.mapping)
+			CloseHandle(m.mapping);
+		CloseHandle(m.file);
+		return false;
+	}
+#else
+	int fd = open(path, O_RDONLY);
+	if (fd < 0)
+		return false;
+	struct stat st;
+	if (fstat(fd, &st) == 0 && st.st_size > 0)
+	{
+		void *p = mmap(NULL, st.st_size, PROT_READ, MAP_PRIVATE, fd, 0);
+		if (p != MAP_FAILED)
+		{
+			madvise(p, st.st_size, MADV_SEQUENTIAL);
+			madvise(p, st.st_size, MADV_WILLNEED);
+			m.data = (const unsigned char*)p;
+			m.size = st.st_size;
+		}
+	}
+	close(fd);
+	if (!m.data)
+		return false;
+#endif
+	return true;
+}
+
+static void unmap_file(MappedFile& m)
+{
+#ifdef _WIN32
+	UnmapViewOfFile(m.data);
+	CloseHandle(m.mapping);
+	CloseHandle(m.file);
+#else
+	munmap((void*)m.data, m.size);
+#endif
+	m.data = nullptr;
+}
+
+static bool section_ok(const MappedFile& m, uint64_t offset, uint64_t bytes)
+{
+	return offset <= m.size && bytes <= m.size - offset;
+}
+
+Scene* scene_load(const char* path)
+{
+	double t0 = ovr_GetTimeInSeconds();
+	MappedFile m;
+	if (!map_file(path, m))
+	{
+		fprintf(stderr, "scene: cannot open %s\n", path);
+		return nullptr;
+	}
+
+	const SceneFileHeader *h = (const SceneFileHeader*)m.data;
+	if (m.size < sizeof(SceneFileHeader) || h->magic != SCENE_MAGIC || h->version != SCENE_VERSION ||
+		!section_ok(m, h->meshOffset, (uint64_t)h->meshCount * sizeof(SceneMesh)) ||
+		!section_ok(m, h->materialOffset, (uint64_t)h->materialCount * sizeof(SceneMaterial)) ||
+		!section_ok(m, h->textureOffset, (uint64_t)h->textureCount * sizeof(SceneTexture)) ||
+		!section_ok(m, h->instanceOffset, (uint64_t)h->instanceCount * sizeof(SceneInstance)) ||
+		!section_ok(m, h->vertexOffset, h->vertexBytes) ||
+		!section_ok(m, h->indexOffset, h->indexBytes))
+	{
+		fprintf(stderr, "scene: %s is not a version %d scene file\n", path, SCENE_VERSION);
+		unmap_file(m);
+		return nullptr;
+	}
+
+	Scene *scene = new Scene;
+	const SceneMesh *meshes = (const SceneMesh*)(m.data + h->meshOffset);
+	const unsigned char *vertices = m.data + h->vertexOffset;
+	const unsigned char *indices = m.data + h->indexOffset;
+	scene->meshInfo.assign(meshes, meshes + h->meshCount);
+	for (uint32_t i = 0; i < h->meshCount; ++i)
+	{
+		const SceneMesh& sm = meshes[i];
+		if (sm.vertexOffset + (uint64_t)sm.vertexCount * SCENE_VERTEX_SIZE > h->vertexBytes ||
+			sm.indexOffset + (uint64_t)sm.indexCount * sizeof(GLushort) > h->indexBytes)
+		{
+			fprintf(stderr, "scene: mesh %u of %s is out of bounds\n", i, path);
+			scene->meshes.push_back(new StaticMesh(NULL, 0, NULL, 0));
+			continue;
+		}
+		// glBufferData reads the mapped pages directly, nothing is copied on our side
+		scene->meshes.push_back(new StaticMesh((const MeshVertex*)(vertices + sm.vertexOffset), sm.vertexCount,
+			(const GLushort*)(indices + sm.indexOffset), sm.indexCount));
+	}
+
+	const SceneMaterial *materials = (const SceneMaterial*)(m.data + h->materialOffset);
+	scene->materials.assign(materials, materials + h->materialCount);
+
+	// texture paths are relative to the scene file
+	std::string dir(path);
+	size_t slash = dir.find_last_of("/\\");
+	dir = slash == std::string::npos ? std::string() : dir.substr(0, slash + 1);
+	const SceneTexture *textures = (const SceneTexture*)(m.data + h->textureOffset);
+	std::vector<TextureHandle> texture_handles;
+	for (uint32_t i = 0; i < h->textureCount; ++i)
+	{
+		char name[sizeof(textures[i].path) + 1];
+		memcpy(name, textures[i].path, sizeof(textures[i].path));
+		name[sizeof(textures[i].path)] = 0;
+		texture_handles.push_back(texture_stream_load((dir + name).c_str()));
+	}
+
+	// one batch per mesh and texture, the material colour goes into the instance
+	const SceneInstance *instances = (const SceneInstance*)(m.data + h->instanceOffset);
+	scene->objects.assign(instances, instances + h->instanceCount);
+	std::map<std::pair<uint32_t, int>, std::vector<InstanceData> > groups;
+	for (uint32_t i = 0; i < h->instanceCount; ++i)
+	{
+		const SceneInstance& si = instances[i];
+		if (si.mesh >= h->meshCount)
+			continue;
+		const SceneMaterial *mat = si.material < h->materialCount ? &materials[si.material] : NULL;
+		int tex = mat && mat->texture >= 0 && (uint32_t)mat->texture < h->textureCount ? texture_handles[mat->texture] : -1;
+		InstanceData inst;
+		memcpy(inst.transform, si.transform, sizeof(inst.transform));
+		for (int c = 0; c < 4; ++c)
+			inst.color[c] = mat ? mat->color[c] : 0.8f;
+		groups[std::make_pair(si.mesh, tex)].push_back(inst);
+	}
+	for (std::map<std::pair<uint32_t, int>, std::vector<InstanceData> >::iterator it = groups.begin(); it != groups.end(); ++it)
+	{
+		SceneBatch batch;
+		batch.instances = new InstanceBuffer(scene->meshes[it->first.first], (int)it->second.size());
+		batch.instances->Update(&it->second[0], (int)it->second.size());
+		batch.texture = it->first.second;
+		scene->batches.push_back(batch);
+
+		const SceneMesh& sm = meshes[it->first.first];
+		Aabb local;
+		memcpy(local.min, sm.boundsMin, sizeof(local.min));
+		memcpy(local.max, sm.boundsMax, sizeof(local.max));
+		int owner = scene->culled.AddBuffer(batch.instances);
+		for (size_t i = 0; i < it->second.size(); ++i)
+			scene->culled.Add(owner, it->second[i], local);
+	}
+	scene->culled.Build();
+
+	printf("scene: %s, %u meshes, %u instances in %d batches, %.1f MB geometry, loaded in %.1f ms\n", path,
+		h->meshCount, h->instanceCount, (int)scene->batches.size(),
+		(h->vertexBytes + h->indexBytes) / 1048576.0, (ovr_GetTimeInSeconds() - t0) * 1000.0);
+	unmap_file(m);
+	return scene;
+}
+
+void scene_free(Scene* scene)
+{
+	if (!scene)
+		return;
+	for (size_t i = 0; i < scene->batches.size(); ++i)
+		delete scene->batches[i].instances;
+	for (size_t i = 0; i < scene->meshes.size(); ++i)
+		delete scene->meshes[i];
+	delete scene;
+}
+
+void scene_update_textures(Scene* scene)
+{
+	for (size_t i = 0; i < scene->batches.size(); ++i)
+	{
+		SceneBatch& b = scene->batches[i];
+		if (b.texture >= 0 && b.instances->count > 0)
+			b.instances->texture = texture_stream_get(b.texture);
+	}
+}
+
+int scene_cull(Scene* scene, const Frustum* frustum)
+{
+	return scene->culled.Cull(frustum);
+}
+
+void scene_draw(const Scene* scene)
+{
+	for (size_t i = 0; i < scene->batches.size(); ++i)
+		scene->batches[i].instances->Draw();
+}
+
+void scene_enqueue(const Scene* scene, RenderQueue& queue)
+{
+	for (size_t i = 0; i < scene->batches.size(); ++i)
+		queue.Add(scene->batches[i].instances, 0);
+}
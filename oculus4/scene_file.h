@@ -0,0 +1,44 @@
+#pragma once
+
+#include <vector>
+#include "mesh.h"
+#include "instanced.h"
+#include "texture_stream.h"
+#include "scene_format.h"
+#include "cull.h"
+#include "render_queue.h"
+
+// all instances of one mesh that share a texture, one instanced draw
+struct SceneBatch
+{
+	InstanceBuffer* instances;
+	TextureHandle   texture; // < 0 for untextured
+};
+
+struct Scene
+{
+	std::vector<StaticMesh*>    meshes;
+	std::vector<SceneMesh>      meshInfo;   // counts and bounds as stored in the file
+	std::vector<SceneInstance>  objects;    // every instance, for culling
+	std::vector<SceneMaterial>  materials;
+	std::vector<SceneBatch>     batches;
+	CulledInstances             culled;     // refills the batches with what is in view
+};
+
+// Maps an .o4s file and uploads its vertex and index blocks to buffer objects
+// directly from the mapping, then unmaps it. Textures are queued on the
+// texture streamer. Needs a current GL context; null if the file is missing
+// or not a scene.
+Scene* scene_load(const char* path);
+void scene_free(Scene* scene);
+
+// bind the streamed textures of this frame, after texture_stream_update()
+// and scene_cull(); batches culled away don't touch their texture, so it can
+// be evicted
+void scene_update_textures(Scene* scene);
+// keep only the instances inside frustum (all of them when null) in the
+// batches; returns the number left
+int scene_cull(Scene* scene, const Frustum* frustum);
+void scene_draw(const Scene* scene);
+// every batch for a render queue to sort with the rest of the frame
+void scene_enqueue(const Scene* scene, RenderQueue& queue);
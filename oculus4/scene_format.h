@@ -0,0 +1,70 @@
+#pragma once
+
+#include <stdint.h>
+
+// On-disk layout of a converted scene (.o4s), written by o4conv and mapped
+// by scene_file.cpp. Everything is little endian and every section starts on
+// a SCENE_ALIGN boundary, so the vertex and index blocks can be handed to
+// glBufferData straight out of the mapping:
+//
+//   SceneFileHeader
+//   SceneMesh[meshCount]
+//   SceneMaterial[materialCount]
+//   SceneTexture[textureCount]
+//   SceneInstance[instanceCount]
+//   vertex block: MeshVertex (pos, normal, uv; 32 bytes) for every mesh
+//   index block:  uint16 triangle lists, indices local to their mesh
+
+#define SCENE_MAGIC   0x4353344f // "O4SC"
+#define SCENE_VERSION 1
+#define SCENE_ALIGN   16
+#define SCENE_VERTEX_SIZE 32
+#define SCENE_MAX_MESH_VERTICES 65535 // meshes are split by the converter to stay on 16 bit indices
+
+struct SceneFileHeader
+{
+	uint32_t magic;
+	uint32_t version;
+	uint32_t meshCount;
+	uint32_t materialCount;
+	uint32_t textureCount;
+	uint32_t instanceCount;
+	uint64_t meshOffset;     // all offsets are from the start of the file
+	uint64_t materialOffset;
+	uint64_t textureOffset;
+	uint64_t instanceOffset;
+	uint64_t vertexOffset;
+	uint64_t vertexBytes;
+	uint64_t indexOffset;
+	uint64_t indexBytes;
+};
+
+struct SceneMesh
+{
+	uint64_t vertexOffset; // bytes into the vertex block
+	uint64_t indexOffset;  // bytes into the index block
+	uint32_t vertexCount;
+	uint32_t indexCount;
+	float    boundsMin[3]; // object space
+	float    boundsMax[3];
+};
+
+struct SceneMaterial
+{
+	float   color[4]; // ambient and diffuse
+	int32_t texture;  // index into the texture table, -1 for none
+	int32_t pad[3];
+};
+
+struct SceneTexture
+{
+	char path[128]; // relative to the scene file, zero terminated
+};
+
+struct SceneInstance
+{
+	float    transform[16]; // column-major model matrix
+	uint32_t mesh;
+	uint32_t material;
+	uint32_t pad[2];
+};
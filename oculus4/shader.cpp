@@ -0,0 +1,41 @@
+#include "shader.h"
+#include <stdio.h>
+
+static GLuint compile_shader(GLenum type, const char *src, const char *name)
+{
+	GLuint sdr = glCreateShader(type);
+	glShaderSource(sdr, 1, &src, 0);
+	glCompileShader(sdr);
+
+	GLint status;
+	glGetShaderiv(sdr, GL_COMPILE_STATUS, &status);
+	if (!status)
+	{
+		char log[1024];
+		glGetShaderInfoLog(sdr, sizeof(log), 0, log);
+		fprintf(stderr, "Failed to compile %s shader:\n%s\n", name, log);
+	}
+	return sdr;
+}
+
+GLuint shader_program(const char* vs, const char* fs, const char* name)
+{
+	GLuint vsdr = compile_shader(GL_VERTEX_SHADER, vs, name);
+	GLuint fsdr = compile_shader(GL_FRAGMENT_SHADER, fs, name);
+	GLuint prog = glCreateProgram();
+	glAttachShader(prog, vsdr);
+	glAttachShader(prog, fsdr);
+	glLinkProgram(prog);
+	glDeleteShader(vsdr);
+	glDeleteShader(fsdr);
+
+	GLint status;
+	glGetProgramiv(prog, GL_LINK_STATUS, &status);
+	if (!status)
+	{
+		char log[1024];
+		glGetProgramInfoLog(prog, sizeof(log), 0, log);
+		fprintf(stderr, "Failed to link %s program:\n%s\n", name, log);
+	}
+	return prog;
+}
@@ -0,0 +1,8 @@
+#pragma once
+
+#include <GL/glew.h>
+
+// A vertex and a fragment shader from source, linked into a program. Compile
+// and link errors go to stderr with name in the message; the program is
+// returned either way.
+GLuint shader_program(const char* vs, const char* fs, const char* name);
@@ -0,0 +1,41 @@
+#include "swap_fbo.h"
+#include "gpu_resources.h"
+#include <stdio.h>
+
+bool SwapFramebuffers::Build(const ovrSwapTextureSet* textureSet, GLuint depthTexture)
+{
+	// same number of textures: keep the names, only attach anew
+	if ((int)fbos.size() != textureSet->TextureCount)
+	{
+		Release();
+		fbos.resize(textureSet->TextureCount);
+		gpu_framebuffers_acquire(textureSet->TextureCount, &fbos[0]);
+	}
+
+	bool complete = true;
+	for (int i = 0; i < textureSet->TextureCount; ++i)
+	{
+		const ovrGLTexture* tex = reinterpret_cast<const ovrGLTexture*>(&textureSet->Textures[i]);
+		glBindFramebuffer(GL_FRAMEBUFFER, fbos[i]);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_COLOR_ATTACHMENT0, GL_TEXTURE_2D, tex->OGL.TexId, 0);
+		glFramebufferTexture2D(GL_FRAMEBUFFER, GL_DEPTH_ATTACHMENT, GL_TEXTURE_2D, depthTexture, 0);
+
+		GLenum status = glCheckFramebufferStatus(GL_FRAMEBUFFER);
+		if (status != GL_FRAMEBUFFER_COMPLETE)
+		{
+			fprintf(stderr, "Swap texture framebuffer %d incomplete: 0x%x\n", i, status);
+			complete = false;
+		}
+	}
+	glBindFramebuffer(GL_FRAMEBUFFER, 0);
+	return complete;
+}
+
+void SwapFramebuffers::Release()
+{
+	if (!fbos.empty())
+	{
+		gpu_framebuffers_release((int)fbos.size(), &fbos[0]);
+		fbos.clear();
+	}
+}
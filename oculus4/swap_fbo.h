@@ -0,0 +1,24 @@
+#pragma once
+
+#include <vector>
+#include <GL/glew.h>
+#include <OVR_CAPI_GL.h>
+
+// One complete framebuffer per texture of a swap texture set, all sharing the
+// same depth texture. Attachments are made and validated once in Build(), so
+// the render loop only binds Current() instead of re-attaching every frame.
+// Build() again whenever the swap texture set is recreated; the framebuffer
+// names are kept, or come from the pool in gpu_resources.
+struct SwapFramebuffers
+{
+	std::vector<GLuint> fbos;
+
+	// returns false if any framebuffer is incomplete
+	bool Build(const ovrSwapTextureSet* textureSet, GLuint depthTexture);
+	void Release();
+
+	GLuint Current(const ovrSwapTextureSet* textureSet) const
+	{
+		return fbos[textureSet->CurrentIndex];
+	}
+};
@@ -0,0 +1,609 @@
+#include "texture_stream.h"
+#include <ctype.h>
+#include <stdio.h>
+#include <string.h>
+#include <math.h>
+#include <condition_variable>
+#include <deque>
+#include <list>
+#include <map>
+#include <mutex>
+#include <string>
+#include <thread>
+#include <vector>
+
+#define STREAM_FRAMES 3 // staging slots, one per frame the GPU may still be reading
+
+// RGBA8 with the whole mip chain, bottom row first like GL wants it
+struct DecodedImage
+{
+	int                        width, height, levels;
+	std::vector<size_t>        offset; // of each level in pixels
+	std::vector<unsigned char> pixels;
+
+	int LevelWidth(int level) const { return width >> level > 0 ? width >> level : 1; }
+	int LevelHeight(int level) const { return height >> level > 0 ? height >> level : 1; }
+};
+
+enum StreamState
+{
+	STREAM_UNLOADED,
+	STREAM_DECODING,
+	STREAM_UPLOADING,
+	STREAM_RESIDENT,
+	STREAM_FAILED
+};
+
+struct StreamEntry
+{
+	std::string   path;
+	bool          srgb;
+	StreamState   state;
+	unsigned int  generation; // bumped on eviction so a decode still in flight is dropped
+	GLuint        tex;
+	DecodedImage* image;      // while uploading
+	int           levels;
+	int           upload_level; // counts down to 0
+	int           upload_row;
+	int           base_level;   // finest complete level, == levels while none is
+	size_t        bytes;
+	long long     last_used;
+	std::list<TextureHandle>::iterator lru; // valid while tex != 0
+};
+
+struct DecodeJob
+{
+	TextureHandle handle;
+	unsigned int  generation;
+	std::string   path;
+	bool          srgb;
+	DecodedImage* image; // null if decoding failed
+};
+
+// part of a level copied into the staging buffer this frame
+struct UploadChunk
+{
+	TextureHandle handle;
+	int           level, row, width, rows;
+	size_t        offset;
+	bool          completes_level;
+};
+
+static TextureStreamConfig config;
+static GLuint fallback_tex;
+static std::vector<StreamEntry*> entries;
+static std::map<std::string, TextureHandle> by_path;
+static std::list<TextureHandle> lru; // most recently used first
+static std::deque<TextureHandle> uploads;
+static long long frame;
+static size_t gpu_bytes;
+static long long uploaded_bytes, evictions, stalls;
+
+static GLuint staging;
+static unsigned char *staging_ptr; // persistent mapping, null when each slot is mapped on use
+static size_t slot_bytes;
+static GLsync slot_fence[STREAM_FRAMES];
+static int slot;
+
+static std::vector<std::thread> workers;
+static std::mutex job_lock;
+static std::condition_variable job_cv;
+static std::deque<DecodeJob> jobs;
+static std::vector<DecodeJob> done;
+static bool workers_quit;
+
+static float srgb_to_linear[256];
+
+static bool read_file(const char* path, std::vector<unsigned char>& data)
+{
+	FILE *fp = fopen(path, "rb");
+	if (!fp)
+		return false;
+	fseek(fp, 0, SEEK_END);
+	long size = ftell(fp);
+	fseek(fp, 0, SEEK_SET);
+	if (size > 0)
+	{
+		data.resize(size);
+		if (fread(&data[0], 1, size, fp) != (size_t)size)
+			size = 0;
+	}
+	fclose(fp);
+	return size > 0;
+}
+
+// uncompressed true colour only (image type 2)
+static bool decode_tga(const std::vector<unsigned char>& file, DecodedImage& img)
+{
+	if (file.size() < 18 || file[1] != 0 || file[2] != 2)
+		return false;
+	int bpp = file[16] / 8;
+	if (bpp != 3 && bpp != 4)
+		return false;
+	img.width = file[12] | (file[13] << 8);
+	img.height = file[14] | (file[15] << 8);
+	bool top_down = (file[17] & 0x20) != 0;
+	size_t start = 18 + file[0];
+	if (!img.width || !img.height || file.size() < start + (size_t)img.width * img.height * bpp)
+		return false;
+
+	img.pixels.resize((size_t)img.width * img.height * 4);
+	for (int y = 0; y < img.height; ++y)
+	{
+		const unsigned char *src = &file[start + (size_t)y * img.width * bpp];
+		unsigned char *dst = &img.pixels[(size_t)(top_down ? img.height - 1 - y : y) * img.width * 4];
+		for (int x = 0; x < img.width; ++x, src += bpp, dst += 4)
+		{
+			dst[0] = src[2];
+			dst[1] = src[1];
+			dst[2] = src[0];
+			dst[3] = bpp == 4 ? src[3] : 255;
+		}
+	}
+	return true;
+}
+
+// binary P6 with maxval 255
+static bool decode_ppm(const std::vector<unsigned char>& file, DecodedImage& img)
+{
+	if (file.size() < 2 || file[0] != 'P' || file[1] != '6')
+		return false;
+	size_t pos = 2;
+	int header[3];
+	for (int i = 0; i < 3; ++i)
+	{
+		for (;;)
+		{
+			while (pos < file.size() && isspace(file[pos]))
+				++pos;
+			if (pos < file.size() && file[pos] == '#')
+				while (pos < file.size() && file[pos] != '\n')
+					++pos;
+			else
+				break;
+		}
+		header[i] = 0;
+		while (pos < file.size() && isdigit(file[pos]))
+			header[i] = header[i] * 10 + (file[pos++] - '0');
+	}
+	++pos; // the single whitespace before the raster
+	img.width = header[0];
+	img.height = header[1];
+	if (header[2] != 255 || !img.width || !img.height || file.size() < pos + (size_t)img.width * img.height * 3)
+		return false;
+
+	img.pixels.resize((size_t)img.width * img.height * 4);
+	for (int y = 0; y < img.height; ++y)
+	{
+		const unsigned char *src = &file[pos + (size_t)y * img.width * 3];
+		unsigned char *dst = &img.pixels[(size_t)(img.height - 1 - y) * img.width * 4];
+		for (int x = 0; x < img.width; ++x, src += 3, dst += 4)
+		{
+			dst[0] = src[0];
+			dst[1] = src[1];
+			dst[2] = src[2];
+			dst[3] = 255;
+		}
+	}
+	return true;
+}
+
+static unsigned char to_srgb(float c)
+{
+	c = c <= 0.0031308f ? c * 12.92f : 1.055f * powf(c, 1.0f / 2.4f) - 0.055f;
+	return (unsigned char)(c * 255.0f + 0.5f);
+}
+
+// 2x2 box filter down to 1x1, colour averaged in linear space for sRGB textures
+static void build_mips(DecodedImage& img, bool srgb)
+{
+	int largest = img.width > img.height ? img.width : img.height;
+	img.levels = 1;
+	while (largest >> img.levels)
+		++img.levels;
+
+	img.offset.resize(img.levels);
+	size_t total = 0;
+	for (int l = 0; l < img.levels; ++l)
+	{
+		img.offset[l] = total;
+		total += (size_t)img.LevelWidth(l) * img.LevelHeight(l) * 4;
+	}
+	img.pixels.resize(total);
+
+	for (int l = 1; l < img.levels; ++l)
+	{
+		int sw = img.LevelWidth(l - 1), sh = img.LevelHeight(l - 1);
+		int dw = img.LevelWidth(l), dh = img.LevelHeight(l);
+		const unsigned char *src = &img.pixels[img.offset[l - 1]];
+		unsigned char *dst = &img.pixels[img.offset[l]];
+		for (int y = 0; y < dh; ++y)
+		{
+			int y0 = 2 * y < sh ? 2 * y : sh - 1;
+			int y1 = 2 * y + 1 < sh ? 2 * y + 1 : sh - 1;
+			for (int x = 0; x < dw; ++x, dst += 4)
+			{
+				int x0 = 2 * x < sw ? 2 * x : sw - 1;
+				int x1 = 2 * x + 1 < sw ? 2 * x + 1 : sw - 1;
+				const unsigned char *p[4] = {
+					src + ((size_t)y0 * sw + x0) * 4, src + ((size_t)y0 * sw + x1) * 4,
+					src + ((size_t)y1 * sw + x0) * 4, src + ((size_t)y1 * sw + x1) * 4
+				};
+				for (int c = 0; c < 4; ++c)
+				{
+					if (srgb && c < 3)
+						dst[c] = to_srgb(0.25f * (srgb_to_linear[p[0][c]] + srgb_to_linear[p[1][c]] + srgb_to_linear[p[2][c]] + srgb_to_linear[p[3][c]]));
+					else
+						dst[c] = (unsigned char)((p[0][c] + p[1][c] + p[2][c] + p[3][c] + 2) / 4);
+				}
+			}
+		}
+	}
+}
+
+static DecodedImage* decode(const char* path, bool srgb)
+{
+	std::vector<unsigned char> file;
+	if (!read_file(path, file))
+		return nullptr;
+	DecodedImage *img = new DecodedImage;
+	if (!decode_tga(file, *img) && !decode_ppm(file, *img))
+	{
+		delete img;
+		return nullptr;
+	}
+	build_mips(*img, srgb);
+	return img;
+}
+
+static void worker_main()
+{
+	for (;;)
+	{
+		DecodeJob job;
+		{
+			std::unique_lock<std::mutex> lock(job_lock);
+			while (jobs.empty() && !workers_quit)
+				job_cv.wait(lock);
+			if (workers_quit)
+				return;
+			job = jobs.front();
+			jobs.pop_front();
+		}
+		job.image = decode(job.path.c_str(), job.srgb);
+		std::lock_guard<std::mutex> lock(job_lock);
+		done.push_back(job);
+	}
+}
+
+static void request(TextureHandle handle)
+{
+	StreamEntry& e = *entries[handle];
+	e.state = STREAM_DECODING;
+	DecodeJob job = { handle, e.generation, e.path, e.srgb, nullptr };
+	{
+		std::lock_guard<std::mutex> lock(job_lock);
+		jobs.push_back(job);
+	}
+	job_cv.notify_one();
+}
+
+static void release(StreamEntry& e)
+{
+	if (e.tex)
+	{
+		glDeleteTextures(1, &e.tex);
+		e.tex = 0;
+		gpu_bytes -= e.bytes;
+		lru.erase(e.lru);
+	}
+	delete e.image;
+	e.image = nullptr;
+	e.state = STREAM_UNLOADED;
+	++e.generation;
+}
+
+// allocate the whole chain now, only the levels that are complete get sampled
+static void create_texture(TextureHandle handle, DecodedImage* img)
+{
+	StreamEntry& e = *entries[handle];
+	e.image = img;
+	e.levels = img->levels;
+	e.upload_level = img->levels - 1;
+	e.upload_row = 0;
+	e.base_level = img->levels;
+	e.bytes = img->pixels.size();
+
+	glGenTextures(1, &e.tex);
+	glBindTexture(GL_TEXTURE_2D, e.tex);
+	for (int l = 0; l < img->levels; ++l)
+		glTexImage2D(GL_TEXTURE_2D, l, e.srgb ? GL_SRGB8_ALPHA8 : GL_RGBA8, img->LevelWidth(l), img->LevelHeight(l), 0, GL_RGBA, GL_UNSIGNED_BYTE, NULL);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MIN_FILTER, GL_LINEAR_MIPMAP_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAG_FILTER, GL_LINEAR);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_S, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_WRAP_T, GL_REPEAT);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, img->levels - 1);
+	glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_MAX_LEVEL, img->levels - 1);
+
+	gpu_bytes += e.bytes;
+	lru.push_front(handle);
+	e.lru = lru.begin();
+	e.state = STREAM_UPLOADING;
+	uploads.push_back(handle);
+}
+
+static void collect()
+{
+	std::vector<DecodeJob> finished;
+	{
+		std::lock_guard<std::mutex> lock(job_lock);
+		finished.swap(done);
+	}
+	for (size_t i = 0; i < finished.size(); ++i)
+	{
+		DecodeJob& job = finished[i];
+		StreamEntry& e = *entries[job.handle];
+		if (e.state != STREAM_DECODING || e.generation != job.generation)
+		{
+			delete job.image;
+			continue;
+		}
+		if (!job.image)
+		{
+			fprintf(stderr, "texture_stream: failed to load %s\n", e.path.c_str());
+			e.state = STREAM_FAILED;
+			continue;
+		}
+		create_texture(job.handle, job.image);
+	}
+}
+
+static void upload()
+{
+	if (uploads.empty())
+		return;
+	GLsync& fence = slot_fence[slot];
+	if (fence)
+	{
+		// the GPU may still be reading this slot, try again next frame rather than wait
+		if (glClientWaitSync(fence, 0, 0) == GL_TIMEOUT_EXPIRED)
+		{
+			++stalls;
+			return;
+		}
+		glDeleteSync(fence);
+		fence = 0;
+	}
+
+	size_t base = slot * slot_bytes;
+	size_t budget = config.uploadBytesPerFrame < slot_bytes ? config.uploadBytesPerFrame : slot_bytes;
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+	unsigned char *dst = staging_ptr ? staging_ptr + base :
+		(unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, base, slot_bytes, GL_MAP_WRITE_BIT | GL_MAP_INVALIDATE_RANGE_BIT | GL_MAP_UNSYNCHRONIZED_BIT);
+	if (!dst)
+	{
+		glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+		return;
+	}
+
+	// copy rows in, coarsest level first
+	std::vector<UploadChunk> chunks;
+	size_t used = 0;
+	while (!uploads.empty())
+	{
+		TextureHandle handle = uploads.front();
+		StreamEntry& e = *entries[handle];
+		// evicted while waiting, or a stale copy of a handle that was evicted
+		// and loaded again, whose upload the newer copy already finished
+		if (e.state != STREAM_UPLOADING || e.upload_level < 0)
+		{
+			uploads.pop_front();
+			continue;
+		}
+		int w = e.image->LevelWidth(e.upload_level);
+		int h = e.image->LevelHeight(e.upload_level);
+		size_t row_bytes = (size_t)w * 4;
+		int rows = (int)((budget - used) / row_bytes);
+		if (rows < 1)
+			break;
+		if (rows > h - e.upload_row)
+			rows = h - e.upload_row;
+
+		UploadChunk chunk = { handle, e.upload_level, e.upload_row, w, rows, base + used, false };
+		memcpy(dst + used, &e.image->pixels[e.image->offset[e.upload_level] + e.upload_row * row_bytes], rows * row_bytes);
+		used += rows * row_bytes;
+		e.upload_row += rows;
+		if (e.upload_row == h)
+		{
+			chunk.completes_level = true;
+			e.upload_row = 0;
+			if (--e.upload_level < 0)
+				uploads.pop_front();
+		}
+		chunks.push_back(chunk);
+	}
+	if (!staging_ptr)
+		glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+
+	for (size_t i = 0; i < chunks.size(); ++i)
+	{
+		UploadChunk& c = chunks[i];
+		StreamEntry& e = *entries[c.handle];
+		glBindTexture(GL_TEXTURE_2D, e.tex);
+		glTexSubImage2D(GL_TEXTURE_2D, c.level, 0, c.row, c.width, c.rows, GL_RGBA, GL_UNSIGNED_BYTE, (const GLvoid*)c.offset);
+		if (!c.completes_level)
+			continue;
+		e.base_level = c.level;
+		glTexParameteri(GL_TEXTURE_2D, GL_TEXTURE_BASE_LEVEL, c.level);
+		if (c.level == 0)
+		{
+			delete e.image;
+			e.image = nullptr;
+			e.state = STREAM_RESIDENT;
+		}
+	}
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	if (used)
+	{
+		uploaded_bytes += used;
+		fence = glFenceSync(GL_SYNC_GPU_COMMANDS_COMPLETE, 0);
+		slot = (slot + 1) % STREAM_FRAMES;
+	}
+}
+
+static void evict()
+{
+	// anything used last frame stays, even over budget
+	while (gpu_bytes > config.budgetBytes && !lru.empty())
+	{
+		StreamEntry& e = *entries[lru.back()];
+		if (e.last_used >= frame - 1)
+			break;
+		release(e);
+		++evictions;
+	}
+}
+
+void texture_stream_init(const TextureStreamConfig& cfg, GLuint fallback)
+{
+	config = cfg;
+	fallback_tex = fallback;
+	frame = 0;
+	for (int i = 0; i < 256; ++i)
+	{
+		float c = i / 255.0f;
+		srgb_to_linear[i] = c <= 0.04045f ? c / 12.92f : powf((c + 0.055f) / 1.055f, 2.4f);
+	}
+
+	slot_bytes = config.stagingBytes / STREAM_FRAMES & ~(size_t)3;
+	glGenBuffers(1, &staging);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+	if (GLEW_ARB_buffer_storage)
+	{
+		GLbitfield flags = GL_MAP_WRITE_BIT | GL_MAP_PERSISTENT_BIT | GL_MAP_COHERENT_BIT;
+		glBufferStorage(GL_PIXEL_UNPACK_BUFFER, slot_bytes * STREAM_FRAMES, NULL, flags);
+		staging_ptr = (unsigned char*)glMapBufferRange(GL_PIXEL_UNPACK_BUFFER, 0, slot_bytes * STREAM_FRAMES, flags);
+	}
+	else
+		glBufferData(GL_PIXEL_UNPACK_BUFFER, slot_bytes * STREAM_FRAMES, NULL, GL_STREAM_DRAW);
+	glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+
+	workers_quit = false;
+	for (int i = 0; i < config.workers; ++i)
+		workers.push_back(std::thread(worker_main));
+}
+
+void texture_stream_shutdown()
+{
+	{
+		std::lock_guard<std::mutex> lock(job_lock);
+		workers_quit = true;
+		jobs.clear();
+	}
+	job_cv.notify_all();
+	for (size_t i = 0; i < workers.size(); ++i)
+		workers[i].join();
+	workers.clear();
+	for (size_t i = 0; i < done.size(); ++i)
+		delete done[i].image;
+	done.clear();
+
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		release(*entries[i]);
+		delete entries[i];
+	}
+	entries.clear();
+	by_path.clear();
+	uploads.clear();
+
+	for (int i = 0; i < STREAM_FRAMES; ++i)
+	{
+		if (slot_fence[i])
+			glDeleteSync(slot_fence[i]);
+		slot_fence[i] = 0;
+	}
+	if (staging)
+	{
+		if (staging_ptr)
+		{
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, staging);
+			glUnmapBuffer(GL_PIXEL_UNPACK_BUFFER);
+			glBindBuffer(GL_PIXEL_UNPACK_BUFFER, 0);
+			staging_ptr = nullptr;
+		}
+		glDeleteBuffers(1, &staging);
+		staging = 0;
+	}
+}
+
+TextureHandle texture_stream_load(const char* path, bool srgb)
+{
+	std::map<std::string, TextureHandle>::iterator it = by_path.find(path);
+	if (it != by_path.end())
+		return it->second;
+
+	StreamEntry *e = new StreamEntry;
+	e->path = path;
+	e->srgb = srgb;
+	e->state = STREAM_UNLOADED;
+	e->generation = 0;
+	e->tex = 0;
+	e->image = nullptr;
+	e->levels = 0;
+	e->base_level = 0;
+	e->bytes = 0;
+	e->last_used = frame;
+	TextureHandle handle = (TextureHandle)entries.size();
+	entries.push_back(e);
+	by_path[path] = handle;
+	request(handle);
+	return handle;
+}
+
+void texture_stream_update()
+{
+	++frame;
+	collect();
+	upload();
+	evict();
+}
+
+GLuint texture_stream_get(TextureHandle handle)
+{
+	if (handle < 0 || handle >= (TextureHandle)entries.size())
+		return fallback_tex;
+	StreamEntry& e = *entries[handle];
+	e.last_used = frame;
+	if (e.state == STREAM_UNLOADED)
+		request(handle);
+	if (!e.tex)
+		return fallback_tex;
+	lru.splice(lru.begin(), lru, e.lru);
+	return e.base_level < e.levels ? e.tex : fallback_tex;
+}
+
+bool texture_stream_resident(TextureHandle handle)
+{
+	return handle >= 0 && handle < (TextureHandle)entries.size() && entries[handle]->state == STREAM_RESIDENT;
+}
+
+void texture_stream_stats(TextureStreamStats& stats)
+{
+	memset(&stats, 0, sizeof(stats));
+	for (size_t i = 0; i < entries.size(); ++i)
+	{
+		switch (entries[i]->state)
+		{
+		case STREAM_RESIDENT:  ++stats.resident; break;
+		case STREAM_UPLOADING: ++stats.uploading; break;
+		case STREAM_DECODING:  ++stats.pending; break;
+		default: break;
+		}
+	}
+	stats.gpuBytes = gpu_bytes;
+	stats.uploadedBytes = uploaded_bytes;
+	stats.evictions = evictions;
+	stats.stalls = stalls;
+}
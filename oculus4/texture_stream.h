@@ -0,0 +1,60 @@
+#pragma once
+
+#include <stddef.h>
+#include <GL/glew.h>
+
+// Texture streaming. Files are decoded (and their mip chain built) on worker
+// threads; the render thread only copies finished rows into a ring of pixel
+// buffer objects and issues glTexSubImage2D from there, a few megabytes per
+// frame, coarsest mip first. GL_TEXTURE_BASE_LEVEL follows the finest level
+// that is complete, so a texture can be sampled (blurry) long before all of
+// it is on the GPU. Textures that have not been used recently are evicted
+// once their GPU memory passes the budget and come back on their next use.
+//
+// Decoders: uncompressed TGA (24/32 bit) and binary PPM (P6).
+
+typedef int TextureHandle; // < 0 is invalid
+
+struct TextureStreamConfig
+{
+	int    workers;            // decode threads
+	size_t budgetBytes;        // GPU memory for streamed textures, mips included
+	size_t stagingBytes;       // pixel buffer ring, split across the frames in flight
+	size_t uploadBytesPerFrame;
+
+	TextureStreamConfig() :
+		workers(2),
+		budgetBytes(256 << 20),
+		stagingBytes(12 << 20),
+		uploadBytesPerFrame(2 << 20)
+	{}
+};
+
+struct TextureStreamStats
+{
+	int       resident;  // fully uploaded
+	int       uploading;
+	int       pending;   // waiting for or being decoded
+	size_t    gpuBytes;
+	long long uploadedBytes;
+	long long evictions;
+	long long stalls;    // frames that skipped uploading because the staging slot was still in use
+};
+
+// needs a current GL context; fallback is returned for textures that are not
+// sampleable yet
+void texture_stream_init(const TextureStreamConfig& config, GLuint fallback);
+void texture_stream_shutdown();
+
+// starts loading in the background, the same path returns the same handle
+TextureHandle texture_stream_load(const char* path, bool srgb = true);
+
+// Once per frame on the GL thread: picks up decoded images, uploads within
+// the per-frame budget and evicts least recently used textures.
+void texture_stream_update();
+
+// the texture to bind this frame; marks it used and reloads it if evicted
+GLuint texture_stream_get(TextureHandle handle);
+bool texture_stream_resident(TextureHandle handle);
+
+void texture_stream_stats(TextureStreamStats& stats);
@@ -0,0 +1,107 @@
+#include "tracking_sampler.h"
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+
+static Compositor *sampler_compositor;
+static std::thread sampler;
+static std::atomic<bool> sampler_quit;
+static double sampler_interval;
+static std::atomic<double> display_time;
+
+// seqlock: odd while the writer is inside, readers retry on a change
+static std::atomic<unsigned int> slot_seq;
+static TrackedPose slot;
+
+static void publish(const TrackedPose& pose)
+{
+	unsigned int seq = slot_seq.load(std::memory_order_relaxed);
+	slot_seq.store(seq + 1, std::memory_order_relaxed);
+	std::atomic_thread_fence(std::memory_order_release);
+	memcpy(&slot, &pose, sizeof(slot));
+	slot_seq.store(seq + 2, std::memory_order_release);
+}
+
+static void sample(Compositor* compositor, double target, TrackedPose& pose)
+{
+	pose.sampleTime = ovr_GetTimeInSeconds();
+	pose.displayTime = target > 0 ? target : pose.sampleTime;
+	pose.state = compositor->GetTrackingState(pose.displayTime);
+}
+
+static void sampler_main()
+{
+	TrackedPose pose;
+	pose.sequence = 0;
+	while (!sampler_quit.load(std::memory_order_relaxed))
+	{
+		sample(sampler_compositor, display_time.load(std::memory_order_relaxed), pose);
+		++pose.sequence;
+		publish(pose);
+		std::this_thread::sleep_for(std::chrono::duration<double>(sampler_interval));
+	}
+}
+
+void tracking_start(Compositor* compositor, double intervalSeconds)
+{
+	sampler_compositor = compositor;
+	sampler_interval = intervalSeconds;
+	sampler_quit = false;
+
+	// have a pose before the first frame asks for one
+	TrackedPose pose;
+	sample(compositor, 0, pose);
+	pose.sequence = 0;
+	publish(pose);
+
+	if (intervalSeconds > 0)
+		sampler = std::thread(sampler_main);
+}
+
+void tracking_stop()
+{
+	if (sampler.joinable())
+	{
+		sampler_quit = true;
+		sampler.join();
+	}
+	sampler_compositor = nullptr;
+}
+
+void tracking_set_display_time(double displayTime)
+{
+	display_time.store(displayTime, std::memory_order_relaxed);
+}
+
+void tracking_latest(TrackedPose& out)
+{
+	if (!sampler.joinable())
+	{
+		// no thread: read the runtime directly, still late in the frame
+		sample(sampler_compositor, display_time.load(std::memory_order_relaxed), out);
+		out.sequence = 0;
+		return;
+	}
+
+	double target = display_time.load(std::memory_order_relaxed);
+	for (;;)
+	{
+		unsigned int before = slot_seq.load(std::memory_order_acquire);
+		if (before & 1)
+			continue;
+		memcpy(&out, &slot, sizeof(out));
+		std::atomic_thread_fence(std::memory_order_acquire);
+		if (slot_seq.load(std::memory_order_relaxed) == before)
+			break;
+	}
+
+	// the sampler has not woken since the display time moved on, its pose
+	// is predicted for the previous frame
+	if (target > 0 && out.displayTime != target)
+	{
+		unsigned int sequence = out.sequence;
+		sample(sampler_compositor, target, out);
+		out.sequence = sequence;
+	}
+}
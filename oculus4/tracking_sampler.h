@@ -0,0 +1,30 @@
+#pragma once
+
+#include <OVR_CAPI.h>
+#include "compositor.h"
+
+struct TrackedPose
+{
+	ovrTrackingState state;
+	double           sampleTime;  // ovr_GetTimeInSeconds() when the state was queried
+	double           displayTime; // the time it was predicted for
+	unsigned int     sequence;    // increments with every sample
+};
+
+// A background thread keeps querying the tracking state, predicted for the
+// display time of the frame being rendered, and publishes the newest one in
+// a seqlock slot: one writer, any number of readers, nobody blocks. The
+// render thread reads it right before it builds each eye's view matrix, so
+// the pose is as fresh as possible when the eye is drawn.
+// intervalSeconds <= 0 runs without a thread, tracking_latest() then queries
+// the compositor itself. On Windows an interval below the default timer
+// period (15.6 ms) needs timeBeginPeriod(1), which init() sets.
+void tracking_start(Compositor* compositor, double intervalSeconds);
+void tracking_stop();
+
+// predicted display time of the frame the render thread is working on
+void tracking_set_display_time(double displayTime);
+
+// newest sample; queried right here when the sampler's newest one is
+// predicted for another display time than the one set last
+void tracking_latest(TrackedPose& out);
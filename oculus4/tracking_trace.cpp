@@ -0,0 +1,359 @@
+#include "tracking_trace.h"
+#include "ring_buffer.h"
+#include <stdio.h>
+#include <string.h>
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <vector>
+
+#define TRACE_MAGIC       0x4b54344f // "O4TK"
+#define TRACE_VERSION     1
+#define TRACE_CHUNKS      8
+#define TRACE_CHUNK_BYTES (64 << 10)
+#define TRACE_MAX_LATCHES 8 // poses kept per frame, later ones are not recorded
+
+static_assert(sizeof(ovrTrackingState) % 4 == 0, "tracking state is traced as 32-bit words");
+static const int state_words = sizeof(ovrTrackingState) / 4;
+// worst case of one encoded frame: 10 bytes per 64-bit varint, 5 per 32-bit one
+static const int frame_max_bytes = 3 * 10 + TRACE_MAX_LATCHES * (2 * 10 + state_words * 5);
+
+struct TraceHeader
+{
+	unsigned int magic;
+	unsigned int version;
+	unsigned int stateBytes; // sizeof(ovrTrackingState) of the recording build
+};
+
+struct TraceFrame
+{
+	double      displayTime;
+	TrackedPose latches[TRACE_MAX_LATCHES];
+	int         latchCount;
+	int         nextLatch; // replay only
+	ovrResult   result;
+};
+
+static bool recording, replaying;
+static TraceFrame frame;
+static int frames;
+
+// delta base, the previous value of each field on both sides
+static double prev_frame_time, prev_sample_time, prev_display_time;
+static unsigned int prev_state[sizeof(ovrTrackingState) / 4];
+
+// recording: the render thread encodes into the current chunk, the writer
+// thread writes full ones and hands them back
+static FILE *file;
+static unsigned char chunks[TRACE_CHUNKS][TRACE_CHUNK_BYTES];
+static size_t chunk_size[TRACE_CHUNKS];
+static int current;
+static SpscRing<int, TRACE_CHUNKS> full_chunks, free_chunks;
+static std::thread writer;
+static std::atomic<bool> writer_quit;
+static long long written;
+
+// replay: the whole trace is read in at open
+static std::vector<unsigned char> replay_data;
+static size_t replay_pos;
+
+static unsigned long long double_bits(double d)
+{
+	unsigned long long u;
+	memcpy(&u, &d, sizeof(u));
+	return u;
+}
+
+static double bits_double(unsigned long long u)
+{
+	double d;
+	memcpy(&d, &u, sizeof(d));
+	return d;
+}
+
+static unsigned char* put_varint(unsigned char* p, unsigned long long v)
+{
+	while (v >= 0x80)
+	{
+		*p++ = (unsigned char)(v | 0x80);
+		v >>= 7;
+	}
+	*p++ = (unsigned char)v;
+	return p;
+}
+
+static bool get_varint(unsigned long long& v)
+{
+	v = 0;
+	for (int shift = 0; shift < 64; shift += 7)
+	{
+		if (replay_pos >= replay_data.size())
+			return false;
+		unsigned char b = replay_data[replay_pos++];
+		v |= (unsigned long long)(b & 0x7f) << shift;
+		if (!(b & 0x80))
+			return true;
+	}
+	return false;
+}
+
+static unsigned char* put_time(unsigned char* p, double t, double& prev)
+{
+	p = put_varint(p, double_bits(t) ^ double_bits(prev));
+	prev = t;
+	return p;
+}
+
+static bool get_time(double& t, double& prev)
+{
+	unsigned long long v;
+	if (!get_varint(v))
+		return false;
+	t = bits_double(v ^ double_bits(prev));
+	prev = t;
+	return true;
+}
+
+static unsigned char* encode_frame(unsigned char* p)
+{
+	p = put_varint(p, frame.latchCount);
+	p = put_time(p, frame.displayTime, prev_frame_time);
+	for (int i = 0; i < frame.latchCount; ++i)
+	{
+		const TrackedPose& pose = frame.latches[i];
+		p = put_time(p, pose.sampleTime, prev_sample_time);
+		p = put_time(p, pose.displayTime, prev_display_time);
+		unsigned int words[sizeof(ovrTrackingState) / 4];
+		memcpy(words, &pose.state, sizeof(words));
+		for (int w = 0; w < state_words; ++w)
+		{
+			p = put_varint(p, words[w] ^ prev_state[w]);
+			prev_state[w] = words[w];
+		}
+	}
+	// zigzag, failures are negative
+	unsigned int r = (unsigned int)frame.result;
+	return put_varint(p, (r << 1) ^ (unsigned int)(frame.result >> 31));
+}
+
+static bool decode_frame()
+{
+	unsigned long long count, v;
+	if (!get_varint(count) || count > TRACE_MAX_LATCHES || !get_time(frame.displayTime, prev_frame_time))
+		return false;
+	frame.latchCount = (int)count;
+	frame.nextLatch = 0;
+	for (int i = 0; i < frame.latchCount; ++i)
+	{
+		TrackedPose& pose = frame.latches[i];
+		if (!get_time(pose.sampleTime, prev_sample_time) || !get_time(pose.displayTime, prev_display_time))
+			return false;
+		for (int w = 0; w < state_words; ++w)
+		{
+			if (!get_varint(v))
+				return false;
+			prev_state[w] ^= (unsigned int)v;
+		}
+		memcpy(&pose.state, prev_state, sizeof(pose.state));
+		pose.sequence = i;
+	}
+	if (!get_varint(v))
+		return false;
+	unsigned int r = (unsigned int)v;
+	frame.result = (ovrResult)((r >> 1) ^ (0u - (r & 1)));
+	return true;
+}
+
+static void writer_main()
+{
+	for (;;)
+	{
+		// a chunk pushed before quit was set is seen by the drain after it
+		bool quit = writer_quit.load();
+		int c;
+		while (full_chunks.Pop(c))
+		{
+			fwrite(chunks[c], 1, chunk_size[c], file);
+			free_chunks.Push(c);
+		}
+		if (quit)
+			break;
+		std::this_thread::sleep_for(std::chrono::milliseconds(10));
+	}
+}
+
+// hands the current chunk to the writer and takes a free one, waiting only
+// if the writer has fallen TRACE_CHUNKS chunks behind
+static void flush_chunk()
+{
+	full_chunks.Push(current);
+	while (!free_chunks.Pop(current))
+		std::this_thread::yield();
+	chunk_size[current] = 0;
+}
+
+static void reset()
+{
+	memset(&frame, 0, sizeof(frame));
+	frames = 0;
+	prev_frame_time = prev_sample_time = prev_display_time = 0;
+	memset(prev_state, 0, sizeof(prev_state));
+}
+
+bool tracking_trace_open(const char* path, bool replay)
+{
+	tracking_trace_close();
+	reset();
+
+	if (replay)
+	{
+		FILE *fp = fopen(path, "rb");
+		if (!fp)
+		{
+			fprintf(stderr, "tracking trace: cannot open %s\n", path);
+			return false;
+		}
+		fseek(fp, 0, SEEK_END);
+		long size = ftell(fp);
+		fseek(fp, 0, SEEK_SET);
+		replay_data.resize(size > 0 ? size : 0);
+		size_t got = replay_data.empty() ? 0 : fread(&replay_data[0], 1, replay_data.size(), fp);
+		fclose(fp);
+
+		TraceHeader header;
+		if (got != replay_data.size() || got < sizeof(header))
+		{
+			fprintf(stderr, "tracking trace: %s is truncated\n", path);
+			replay_data.clear();
+			return false;
+		}
+		memcpy(&header, &replay_data[0], sizeof(header));
+		if (header.magic != TRACE_MAGIC || header.version != TRACE_VERSION || header.stateBytes != sizeof(ovrTrackingState))
+		{
+			fprintf(stderr, "tracking trace: %s is not a tracking trace of this build\n", path);
+			replay_data.clear();
+			return false;
+		}
+		replay_pos = sizeof(header);
+		replaying = true;
+		return true;
+	}
+
+	file = fopen(path, "wb");
+	if (!file)
+	{
+		fprintf(stderr, "tracking trace: cannot write %s\n", path);
+		return false;
+	}
+	TraceHeader header = { TRACE_MAGIC, TRACE_VERSION, (unsigned int)sizeof(ovrTrackingState) };
+	fwrite(&header, sizeof(header), 1, file);
+	written = sizeof(header);
+
+	int c;
+	while (full_chunks.Pop(c)) {}
+	while (free_chunks.Pop(c)) {}
+	for (c = 1; c < TRACE_CHUNKS; ++c)
+		free_chunks.Push(c);
+	current = 0;
+	chunk_size[current] = 0;
+	writer_quit = false;
+	writer = std::thread(writer_main);
+	recording = true;
+	return true;
+}
+
+void tracking_trace_close()
+{
+	if (recording)
+	{
+		if (chunk_size[current] > 0)
+			full_chunks.Push(current);
+		writer_quit = true;
+		writer.join();
+		fclose(file);
+		file = NULL;
+		recording = false;
+		printf("tracking trace: %d frames, %.1f KB, %.0f bytes/frame\n", frames, written / 1024.0,
+			frames ? (double)written / frames : 0.0);
+	}
+	if (replaying)
+	{
+		printf("tracking trace: replayed %d frames\n", frames);
+		replay_data.clear();
+		replaying = false;
+	}
+}
+
+bool tracking_trace_recording()
+{
+	return recording;
+}
+
+bool tracking_trace_replaying()
+{
+	return replaying;
+}
+
+void tracking_trace_display_time(double& displayTime)
+{
+	if (recording)
+	{
+		frame.displayTime = displayTime;
+		frame.latchCount = 0;
+	}
+	else if (replaying)
+	{
+		// past the end (or a damaged tail) the last good frame repeats
+		TraceFrame last = frame;
+		if (replay_pos < replay_data.size() && decode_frame())
+			++frames;
+		else
+		{
+			frame = last;
+			frame.nextLatch = 0;
+			replay_pos = replay_data.size();
+		}
+		displayTime = frame.displayTime;
+	}
+}
+
+void tracking_trace_pose(TrackedPose& pose)
+{
+	if (recording)
+	{
+		if (frame.latchCount < TRACE_MAX_LATCHES)
+			frame.latches[frame.latchCount++] = pose;
+	}
+	else if (replaying && frame.latchCount > 0)
+	{
+		// a frame drawn with more latches than were recorded reuses the newest
+		int i = frame.nextLatch < frame.latchCount ? frame.nextLatch++ : frame.latchCount - 1;
+		pose = frame.latches[i];
+	}
+}
+
+void tracking_trace_submit(ovrResult& result)
+{
+	if (recording)
+		frame.result = result;
+	else if (replaying)
+		result = frame.result;
+}
+
+bool tracking_trace_end_frame()
+{
+	if (recording)
+	{
+		if (chunk_size[current] + frame_max_bytes > TRACE_CHUNK_BYTES)
+			flush_chunk();
+		unsigned char *begin = chunks[current] + chunk_size[current];
+		size_t bytes = encode_frame(begin) - begin;
+		chunk_size[current] += bytes;
+		written += bytes;
+		++frames;
+		return true;
+	}
+	if (replaying)
+		return replay_pos < replay_data.size();
+	return true;
+}
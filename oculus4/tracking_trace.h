@@ -0,0 +1,32 @@
+#pragma once
+
+#include <OVR_CAPI.h>
+#include "tracking_sampler.h"
+
+// Tracking trace. Recording keeps, per frame, the predicted display time,
+// every pose the render thread latched and the SubmitFrame result; replay
+// hands exactly those back in the same order instead of the live session,
+// so two builds can be timed along the same head motion.
+//
+// Each latched ovrTrackingState is stored as the XOR of its 32-bit words
+// with the previous one, varint coded: fields that did not change cost a
+// byte, slowly moving floats keep their sign, exponent and top mantissa
+// bits and shrink to a few. The render thread only encodes into memory; a
+// background thread writes full chunks to the file.
+
+// path of the trace to write or to play back; false if it cannot be opened
+// or is not a trace of this ovrTrackingState layout
+bool tracking_trace_open(const char* path, bool replay);
+// flushes and closes a recording, prints its size
+void tracking_trace_close();
+bool tracking_trace_recording();
+bool tracking_trace_replaying();
+
+// The render thread calls these in frame order, the display time first.
+// Recording stores the values; replay replaces them with the recorded ones.
+void tracking_trace_display_time(double& displayTime);
+void tracking_trace_pose(TrackedPose& pose);
+void tracking_trace_submit(ovrResult& result);
+// false once replay has played the last recorded frame, it then keeps
+// repeating that frame
+bool tracking_trace_end_frame();